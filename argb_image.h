@@ -0,0 +1,20 @@
+#ifndef ARGB_IMAGE_H
+#define ARGB_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// View of 32 bit ARGB pixels in plain memory, the frame format the engine
+// colorizes into. stride is the distance between rows in pixels.
+struct argb_image {
+    uint32_t* pixels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;
+
+    uint32_t* line(uint32_t y) const {
+        return pixels + static_cast<size_t>(y) * stride;
+    }
+};
+
+#endif // ARGB_IMAGE_H
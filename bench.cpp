@@ -0,0 +1,383 @@
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mandelbrot.h"
+
+// Microbenchmarks of the escape-time kernels, the coloring and whole frames
+// over a fixed catalogue of viewports. Every benchmark prints one record per
+// viewport and thread count, as CSV or with --json as a JSON array:
+//
+//     bench, viewport, threads, pixels, iterations, seconds, mpixel_s,
+//     giter_s
+//
+// seconds is the best of --repeat runs. Iterations are those of the
+// viewport's pixels as the most precise kernel counts them, pixels that do
+// not escape count max_iter whether or not a kernel stops them earlier.
+
+struct bench_viewport {
+    const char* name;
+    // Center of the view as decimal strings, width in the complex plane
+    const char* center_re;
+    const char* center_im;
+    double width;
+    uint32_t max_iter;
+};
+
+static const bench_viewport VIEWPORTS[] = {
+    {"full_set", "-0.75", "0", 3, 1000},
+    {"seahorse_valley", "-0.745", "0.113", 0.02, 2000},
+    // Period 998 mini-brot, past double precision
+    {"deep_minibrot", "-0.74364388703715887077806454349364257504760996232",
+            "0.131825904205312292821097354874767265262988599679", 3e-15,
+            20000},
+    {"all_interior", "-0.1", "0", 0.1, 1000},
+    {"all_exterior", "1.5", "1.5", 1, 1000}
+};
+
+struct bench_options {
+    uint32_t width = 320;
+    uint32_t height = 240;
+    uint32_t repeat = 3;
+    uint32_t threads = std::thread::hardware_concurrency();
+    // Runs only the benchmarks whose "bench/viewport" contains this
+    std::string only;
+    bool json = false;
+};
+
+struct bench_result {
+    std::string bench;
+    std::string viewport;
+    uint32_t threads;
+    uint64_t pixels;
+    uint64_t iterations;
+    double seconds;
+};
+
+// Pixel coordinates of a viewport as double-double hi + lo, per column and
+// per row
+struct bench_grid {
+    m_dimension d;
+    std::vector<double> real_hi;
+    std::vector<double> real_lo;
+    std::vector<double> imag_hi;
+    std::vector<double> imag_lo;
+};
+
+static volatile uint64_t sink;
+
+static void usage() {
+    std::cout <<
+        "usage: mandelbrot-bench [options]\n"
+        "\n"
+        "  --size WxH       frame size in pixels (320x240)\n"
+        "  --repeat N       runs per benchmark, the best counts (3)\n"
+        "  --threads N      largest thread count of the frame benchmarks\n"
+        "                   (all cores)\n"
+        "  --only S         only benchmarks whose bench/viewport contains S\n"
+        "  --json           print JSON instead of CSV\n";
+}
+
+static bool parseUnsigned(const std::string& s, uint32_t& v) {
+    char* end;
+    unsigned long r = std::strtoul(s.c_str(), &end, 10);
+    v = static_cast<uint32_t>(r);
+    return !s.empty() && *end == '\0' && r <= UINT32_MAX;
+}
+
+static bench_grid makeGrid(const bench_viewport& v, uint32_t width,
+        uint32_t height) {
+    bench_grid g;
+    g.d.m_width = v.width;
+    g.d.m_height = v.width * (height - 1) / (width - 1);
+
+    double step = g.d.m_width / (width - 1);
+    uint32_t bits = static_cast<uint32_t>(std::max(0.0, -std::log2(step)))
+            + 64;
+    bigfloat cr;
+    bigfloat ci;
+    bigfloat::parse(v.center_re, bits, cr);
+    bigfloat::parse(v.center_im, bits, ci);
+    bigfloat x0 = cr - bigfloat(g.d.m_width / 2);
+    bigfloat y0 = ci + bigfloat(g.d.m_height / 2);
+    setExactOffset(g.d, x0, y0);
+
+    for(uint32_t x=0; x<width; x++) {
+        bigfloat c = x0 + bigfloat(x * step);
+        g.real_hi.push_back(c.toDouble());
+        g.real_lo.push_back((c - bigfloat(g.real_hi.back())).toDouble());
+    }
+    for(uint32_t y=0; y<height; y++) {
+        bigfloat c = y0 - bigfloat(y * step);
+        g.imag_hi.push_back(c.toDouble());
+        g.imag_lo.push_back((c - bigfloat(g.imag_hi.back())).toDouble());
+    }
+    return g;
+}
+
+// Best time of repeat runs of f
+template<class F>
+static double bestOf(uint32_t repeat, F f) {
+    double best = INFINITY;
+    for(uint32_t r=0; r<repeat; r++) {
+        auto start = timer::now();
+        f();
+        std::chrono::duration<double> diff = timer::now() - start;
+        best = std::min(best, diff.count());
+    }
+    return best;
+}
+
+static uint64_t countIterations(const std::vector<int32_t>& it,
+        uint32_t max_iter) {
+    uint64_t n = 0;
+    for(int32_t i : it)
+        n += i == INT32_MIN ? max_iter : static_cast<uint64_t>(i) + 1;
+    return n;
+}
+
+static void printResults(const std::vector<bench_result>& results,
+        bool json) {
+    if(json)
+        std::printf("[\n");
+    else
+        std::printf("bench,viewport,threads,pixels,iterations,seconds,"
+                "mpixel_s,giter_s\n");
+
+    for(size_t i=0; i<results.size(); i++) {
+        const bench_result& r = results.at(i);
+        double mpix = r.pixels / r.seconds * 1e-6;
+        double giter = r.iterations / r.seconds * 1e-9;
+        if(json)
+            std::printf("  {\"bench\": \"%s\", \"viewport\": \"%s\", "
+                    "\"threads\": %u, \"pixels\": %llu, "
+                    "\"iterations\": %llu, \"seconds\": %.6g, "
+                    "\"mpixel_s\": %.6g, \"giter_s\": %.6g}%s\n",
+                    r.bench.c_str(), r.viewport.c_str(), r.threads,
+                    static_cast<unsigned long long>(r.pixels),
+                    static_cast<unsigned long long>(r.iterations), r.seconds,
+                    mpix, giter, i + 1 < results.size() ? "," : "");
+        else
+            std::printf("%s,%s,%u,%llu,%llu,%.6g,%.6g,%.6g\n",
+                    r.bench.c_str(), r.viewport.c_str(), r.threads,
+                    static_cast<unsigned long long>(r.pixels),
+                    static_cast<unsigned long long>(r.iterations), r.seconds,
+                    mpix, giter);
+    }
+
+    if(json)
+        std::printf("]\n");
+}
+
+// Thread counts of the scaling curve: powers of two up to max, and max
+static std::vector<uint32_t> threadCounts(uint32_t max) {
+    std::vector<uint32_t> res;
+    for(uint32_t t=1; t<max; t*=2)
+        res.push_back(t);
+    res.push_back(max);
+    return res;
+}
+
+static void runViewport(const bench_viewport& v, const bench_options& o,
+        std::vector<bench_result>& results) {
+    uint32_t w = o.width;
+    uint32_t h = o.height;
+    uint64_t pixels = static_cast<uint64_t>(w) * h;
+    bench_grid g = makeGrid(v, w, h);
+    auto wanted = [&](const std::string& bench) {
+        return (bench + "/" + v.name).find(o.only) != std::string::npos;
+    };
+
+    Mandelbrot m(1);
+    m.setMaxIter(v.max_iter);
+    std::vector<int32_t> it(pixels);
+    std::vector<float> norm(pixels);
+
+    // Scalar results feed the coloring benchmarks, so they always run once
+    auto scalar = [&]() {
+        for(uint32_t y=0; y<h; y++) {
+            for(uint32_t x=0; x<w; x++) {
+                auto mb = m.calcMandelbrot(complex(g.real_hi[x],
+                            g.imag_hi[y]));
+                it[y * w + x] = mb.second;
+                norm[y * w + x] = mb.first;
+            }
+        }
+    };
+    double t = bestOf(wanted("kernel_scalar") ? o.repeat : 1, scalar);
+    std::vector<int32_t> scalar_it = it;
+    std::vector<float> scalar_norm = norm;
+
+    const kernel_table& k = m.kernelTable();
+    double t_simd = 0;
+    uint64_t simd_iterations = 0;
+    if(k.escape_time && wanted("kernel_simd")) {
+        t_simd = bestOf(o.repeat, [&]() {
+            double real[MAX_LANES];
+            double imag[MAX_LANES];
+            for(uint64_t i=0; i<pixels; i+=k.lanes) {
+                for(uint32_t l=0; l<k.lanes; l++) {
+                    uint64_t p = std::min<uint64_t>(i + l, pixels - 1);
+                    real[l] = g.real_hi[p % w];
+                    imag[l] = g.imag_hi[p / w];
+                }
+                auto mb = m.calcMandelbrot_simd(real, imag);
+                for(uint32_t l=0; l<k.lanes && i + l < pixels; l++)
+                    it[i + l] = mb.it[l];
+            }
+        });
+        simd_iterations = countIterations(it, v.max_iter);
+    }
+
+    // The most precise kernel defines the viewport's iterations
+    uint64_t iterations = countIterations(scalar_it, v.max_iter);
+    double t_dd = 0;
+    if(k.escape_time_dd) {
+        t_dd = bestOf(wanted("kernel_dd") ? o.repeat : 1, [&]() {
+            double real_hi[MAX_LANES];
+            double real_lo[MAX_LANES];
+            double imag_hi[MAX_LANES];
+            double imag_lo[MAX_LANES];
+            for(uint64_t i=0; i<pixels; i+=k.lanes) {
+                for(uint32_t l=0; l<k.lanes; l++) {
+                    uint64_t p = std::min<uint64_t>(i + l, pixels - 1);
+                    real_hi[l] = g.real_hi[p % w];
+                    real_lo[l] = g.real_lo[p % w];
+                    imag_hi[l] = g.imag_hi[p / w];
+                    imag_lo[l] = g.imag_lo[p / w];
+                }
+                auto mb = m.calcMandelbrot_dd(real_hi, real_lo, imag_hi,
+                        imag_lo);
+                for(uint32_t l=0; l<k.lanes && i + l < pixels; l++)
+                    it[i + l] = mb.it[l];
+            }
+        });
+        iterations = countIterations(it, v.max_iter);
+    }
+
+    if(wanted("kernel_scalar"))
+        results.push_back({"kernel_scalar", v.name, 1, pixels,
+                countIterations(scalar_it, v.max_iter), t});
+    if(k.escape_time && wanted("kernel_simd"))
+        results.push_back({"kernel_simd", v.name, 1, pixels, simd_iterations,
+                t_simd});
+    if(k.escape_time_dd && wanted("kernel_dd"))
+        results.push_back({"kernel_dd", v.name, 1, pixels, iterations, t_dd});
+
+    SmoothColoring coloring({0x000764, 0x206bcb, 0xedffff, 0xffaa00,
+            0x000200}, 50);
+    if(wanted("color")) {
+        t = bestOf(o.repeat, [&]() {
+            uint64_t sum = 0;
+            for(uint64_t p=0; p<pixels; p++)
+                sum += coloring.getColor(scalar_it[p], scalar_norm[p]);
+            sink = sum;
+        });
+        results.push_back({"color", v.name, 1, pixels, 0, t});
+    }
+    if(wanted("color_avx")) {
+        t = bestOf(o.repeat, [&]() {
+            uint64_t sum = 0;
+            for(uint64_t p=0; p<pixels; p++)
+                sum += coloring.getColor_avx(scalar_it[p], scalar_norm[p],
+                        k);
+            sink = sum;
+        });
+        results.push_back({"color_avx", v.name, 1, pixels, 0, t});
+    }
+    if(wanted("color_batch")) {
+        std::vector<uint32_t> argb(pixels);
+        t = bestOf(o.repeat, [&]() {
+            coloring.getColors(scalar_it.data(), scalar_norm.data(),
+                    argb.data(), pixels, k);
+            sink = argb[pixels / 2];
+        });
+        results.push_back({"color_batch", v.name, 1, pixels, 0, t});
+    }
+
+    // Whole frames in one pass, from scratch every run
+    std::vector<uint32_t> pixels_argb(pixels);
+    argb_image image;
+    image.pixels = pixels_argb.data();
+    image.width = w;
+    image.height = h;
+    image.stride = w;
+    for(auto mode : {render_mode::full, render_mode::subdivide}) {
+        std::string bench = mode == render_mode::full ? "frame"
+                : "frame_subdivide";
+        if(!wanted(bench))
+            continue;
+
+        for(uint32_t threads : threadCounts(o.threads)) {
+            t = bestOf(o.repeat, [&]() {
+                Mandelbrot f(threads);
+                f.setPreviewBlock(1);
+                f.setColoring(std::unique_ptr<Coloring>(
+                            new SmoothColoring(coloring)));
+                f.setMaxIter(v.max_iter);
+                f.setRenderMode(mode);
+                f.updateComplexDimensions(g.d);
+                while(!f.refreshMandelbrotTiled(image));
+            });
+            results.push_back({bench, v.name, threads, pixels, iterations,
+                    t});
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    bench_options o;
+    for(size_t i=0; i<args.size(); i++) {
+        const std::string& a = args.at(i);
+        if(a == "-h" || a == "--help") {
+            usage();
+            return 0;
+        }
+        if(a == "--json") {
+            o.json = true;
+            continue;
+        }
+        if(i + 1 >= args.size()) {
+            std::cerr << "unknown option or missing value: " << a << std::endl;
+            return 1;
+        }
+
+        const std::string& v = args.at(++i);
+        bool ok;
+        if(a == "--size") {
+            char x;
+            char rest;
+            ok = std::sscanf(v.c_str(), "%u%c%u%c", &o.width, &x, &o.height,
+                    &rest) == 3 && x == 'x' && o.width >= 2 && o.height >= 2;
+        } else if(a == "--repeat") {
+            ok = parseUnsigned(v, o.repeat) && o.repeat > 0;
+        } else if(a == "--threads") {
+            ok = parseUnsigned(v, o.threads) && o.threads > 0;
+        } else if(a == "--only") {
+            o.only = v;
+            ok = true;
+        } else {
+            std::cerr << "unknown option: " << a << std::endl;
+            return 1;
+        }
+        if(!ok) {
+            std::cerr << "invalid value for " << a << ": " << v << std::endl;
+            return 1;
+        }
+    }
+    o.threads = std::max<uint32_t>(o.threads, 1);
+
+    // The records do not say which kernels ran, MANDELBROT_ISA selects them
+    std::cerr << "kernels: " << kernels().name << std::endl;
+
+    std::vector<bench_result> results;
+    for(const bench_viewport& v : VIEWPORTS)
+        runViewport(v, o, results);
+    printResults(results, o.json);
+    return 0;
+}
@@ -0,0 +1,283 @@
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include "bigfloat.h"
+
+bigfloat::bigfloat(): neg(false), limbs(1, 0) {}
+
+bigfloat::bigfloat(double v): neg(v < 0), limbs(1, 0) {
+    if(v == 0 || !std::isfinite(v)) {
+        neg = false;
+        return;
+    }
+    if(std::fabs(v) >= 4294967296.0) {
+        saturate();
+        return;
+    }
+
+    // v = mant * 2^exp with an integer mantissa of 53 bits
+    int exp;
+    double m = std::frexp(std::fabs(v), &exp);
+    uint64_t mant = static_cast<uint64_t>(std::ldexp(m, 53));
+    exp -= 53;
+
+    // Enough fractional limbs to hold the lowest mantissa bit. Below 2^32
+    // exp is negative, so the shift stays below 32.
+    uint32_t frac = (-exp + 31) / 32;
+    uint32_t shift = exp + 32 * frac;
+    limbs.assign(frac + 1, 0);
+
+    unsigned __int128 val = static_cast<unsigned __int128>(mant) << shift;
+    for(uint32_t i=0; i<limbs.size() && val != 0; i++) {
+        limbs.at(i) = static_cast<uint32_t>(val);
+        val >>= 32;
+    }
+}
+
+bool bigfloat::parse(const std::string& s, uint32_t bits, bigfloat& out) {
+    size_t i = 0;
+    bool negative = false;
+    if(i < s.size() && (s[i] == '-' || s[i] == '+'))
+        negative = s[i++] == '-';
+
+    // Digits without the decimal point, which sits before digits[point]
+    std::string digits;
+    int64_t point = -1;
+    for(; i < s.size(); i++) {
+        if(std::isdigit(static_cast<unsigned char>(s[i])))
+            digits.push_back(s[i]);
+        else if(s[i] == '.' && point < 0)
+            point = digits.size();
+        else
+            break;
+    }
+    if(digits.empty())
+        return false;
+    if(point < 0)
+        point = digits.size();
+
+    if(i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+        const char* start = s.c_str() + i + 1;
+        char* end;
+        long exp = std::strtol(start, &end, 10);
+        if(end == start || std::labs(exp) > 100000)
+            return false;
+        point += exp;
+        i = end - s.c_str();
+    }
+    if(i != s.size())
+        return false;
+
+    // Integer part, digits past the end are zeros shifted in by the exponent
+    int64_t len = digits.size();
+    uint64_t integer = 0;
+    for(int64_t k = 0; k < point; k++) {
+        integer = integer * 10 + (k < len ? digits[k] - '0' : 0);
+        if(integer > UINT32_MAX)
+            return false;
+    }
+
+    // Fraction from its least significant digit up: r = (r + d) / 10
+    bigfloat r;
+    r.limbs.assign((bits + 31) / 32 + 1, 0);
+    for(int64_t k = len; k-- > std::min<int64_t>(point, len);) {
+        r.limbs.back() += k >= 0 ? digits[k] - '0' : 0;
+        r.divide(10);
+        // Below the precision nothing is left to shift in
+        if(k < 0 && r.isZero())
+            break;
+    }
+
+    r.limbs.back() = integer;
+    r.neg = negative;
+    r.normalize();
+    out = r;
+    return true;
+}
+
+uint32_t bigfloat::fracLimbs() const {
+    return limbs.size() - 1;
+}
+
+uint32_t bigfloat::precision() const {
+    return 32 * fracLimbs();
+}
+
+bigfloat bigfloat::extended(uint32_t frac) const {
+    if(frac <= fracLimbs())
+        return *this;
+
+    bigfloat r;
+    r.neg = neg;
+    r.limbs.assign(frac - fracLimbs(), 0);
+    r.limbs.insert(r.limbs.end(), limbs.begin(), limbs.end());
+    return r;
+}
+
+bigfloat bigfloat::truncated(uint32_t bits) const {
+    uint32_t frac = (bits + 31) / 32;
+    if(frac >= fracLimbs())
+        return *this;
+
+    bigfloat r;
+    r.neg = neg;
+    r.limbs.assign(limbs.end() - frac - 1, limbs.end());
+    r.normalize();
+    return r;
+}
+
+bool bigfloat::magnitudeLess(const bigfloat& r) const {
+    // Both operands have the same number of limbs here
+    for(uint32_t i=limbs.size(); i-- > 0;) {
+        if(limbs.at(i) != r.limbs.at(i))
+            return limbs.at(i) < r.limbs.at(i);
+    }
+    return false;
+}
+
+void bigfloat::divide(uint32_t d) {
+    uint64_t rem = 0;
+    for(uint32_t i=limbs.size(); i-- > 0;) {
+        uint64_t cur = (rem << 32) | limbs.at(i);
+        limbs.at(i) = static_cast<uint32_t>(cur / d);
+        rem = cur % d;
+    }
+}
+
+void bigfloat::saturate() {
+    std::fill(limbs.begin(), limbs.end(), UINT32_MAX);
+}
+
+void bigfloat::normalize() {
+    if(isZero())
+        neg = false;
+}
+
+double bigfloat::toDouble() const {
+    // Three limbs from the most significant non-zero one carry more bits
+    // than a double mantissa
+    uint32_t top = limbs.size();
+    while(top > 1 && limbs.at(top - 1) == 0)
+        top--;
+
+    double v = 0;
+    int32_t frac = fracLimbs();
+    uint32_t low = top > 3 ? top - 3 : 0;
+    for(uint32_t i=low; i<top; i++)
+        v += std::ldexp(static_cast<double>(limbs.at(i)),
+                32 * (static_cast<int32_t>(i) - frac));
+
+    return neg ? -v : v;
+}
+
+std::string bigfloat::toString() const {
+    std::string s = neg ? "-" : "";
+    s += std::to_string(limbs.back());
+
+    // Each multiplication by 10 carries the next digit out of the fraction.
+    // A fraction of n bits has at most n digits.
+    std::vector<uint32_t> frac(limbs.begin(), limbs.end() - 1);
+    auto zero = [&]() {
+        return std::all_of(frac.begin(), frac.end(),
+                [](uint32_t l) { return l == 0; });
+    };
+    if(!zero())
+        s += '.';
+    while(!zero()) {
+        uint64_t carry = 0;
+        for(uint32_t& l : frac) {
+            uint64_t cur = static_cast<uint64_t>(l) * 10 + carry;
+            l = static_cast<uint32_t>(cur);
+            carry = cur >> 32;
+        }
+        s += static_cast<char>('0' + carry);
+    }
+    return s;
+}
+
+bool bigfloat::isNegative() const {
+    return neg;
+}
+
+bool bigfloat::isZero() const {
+    return std::all_of(limbs.begin(), limbs.end(),
+            [](uint32_t l) { return l == 0; });
+}
+
+bigfloat bigfloat::operator-() const {
+    bigfloat r(*this);
+    r.neg = !neg;
+    r.normalize();
+    return r;
+}
+
+bigfloat bigfloat::operator+(const bigfloat& r) const {
+    uint32_t frac = std::max(fracLimbs(), r.fracLimbs());
+    bigfloat a = extended(frac);
+    bigfloat b = r.extended(frac);
+
+    if(a.neg != b.neg) {
+        // Subtract the smaller magnitude from the larger one
+        if(a.magnitudeLess(b))
+            std::swap(a, b);
+
+        int64_t borrow = 0;
+        for(uint32_t i=0; i<a.limbs.size(); i++) {
+            int64_t d = static_cast<int64_t>(a.limbs.at(i)) - b.limbs.at(i)
+                    - borrow;
+            borrow = d < 0;
+            a.limbs.at(i) = static_cast<uint32_t>(d);
+        }
+    } else {
+        uint64_t carry = 0;
+        for(uint32_t i=0; i<a.limbs.size(); i++) {
+            uint64_t s = static_cast<uint64_t>(a.limbs.at(i)) + b.limbs.at(i)
+                    + carry;
+            carry = s >> 32;
+            a.limbs.at(i) = static_cast<uint32_t>(s);
+        }
+        if(carry)
+            a.saturate();
+    }
+
+    a.normalize();
+    return a;
+}
+
+bigfloat bigfloat::operator-(const bigfloat& r) const {
+    return *this + (-r);
+}
+
+bigfloat bigfloat::operator*(const bigfloat& r) const {
+    uint32_t na = limbs.size();
+    uint32_t nb = r.limbs.size();
+    std::vector<uint32_t> prod(na + nb, 0);
+
+    for(uint32_t i=0; i<na; i++) {
+        uint64_t carry = 0;
+        uint64_t a = limbs.at(i);
+        if(a == 0)
+            continue;
+
+        for(uint32_t j=0; j<nb; j++) {
+            uint64_t t = a * r.limbs.at(j) + prod.at(i + j) + carry;
+            prod.at(i + j) = static_cast<uint32_t>(t);
+            carry = t >> 32;
+        }
+        prod.at(i + nb) += static_cast<uint32_t>(carry);
+    }
+
+    // The product has fa + fb fractional limbs, keep the larger of fa, fb
+    uint32_t frac = std::max(fracLimbs(), r.fracLimbs());
+    uint32_t drop = fracLimbs() + r.fracLimbs() - frac;
+
+    bigfloat res;
+    res.neg = neg != r.neg;
+    res.limbs.assign(prod.begin() + drop, prod.begin() + drop + frac + 1);
+    if(std::any_of(prod.begin() + drop + frac + 1, prod.end(),
+            [](uint32_t l) { return l != 0; }))
+        res.saturate();
+    res.normalize();
+    return res;
+}
@@ -0,0 +1,65 @@
+#ifndef BIGFLOAT_H
+#define BIGFLOAT_H
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <iostream>
+
+// Signed fixed-point number of arbitrary precision: one 32 bit integer limb
+// and any number of 32 bit fractional limbs. Used for viewport coordinates
+// and reference orbits beyond the resolution of double.
+//
+// Addition and subtraction are exact, multiplication truncates to the
+// larger precision of its operands. Magnitudes of 2^32 and beyond do not
+// fit the integer limb, they saturate to the largest one of the precision.
+class bigfloat
+{
+private:
+    bool neg;
+    // Magnitude, least significant limb first. The last limb holds the
+    // integer part, all others are fractional.
+    std::vector<uint32_t> limbs;
+
+    uint32_t fracLimbs() const;
+    bigfloat extended(uint32_t frac) const;
+    bool magnitudeLess(const bigfloat& r) const;
+    void normalize();
+    // Sets the magnitude to the largest one of the precision
+    void saturate();
+    // Divides the magnitude by d, truncating
+    void divide(uint32_t d);
+
+public:
+    bigfloat();
+    explicit bigfloat(double v);
+
+    // Parses a decimal number with optional sign, fraction and exponent,
+    // e.g. "-0.743643887037158704752191506114774". The fraction is rounded
+    // down to the given number of bits. Returns false if s is malformed or
+    // the integer part does not fit the integer limb.
+    static bool parse(const std::string& s, uint32_t bits, bigfloat& out);
+
+    // Number of fractional bits
+    uint32_t precision() const;
+    // Drops fractional limbs beyond the given number of bits
+    bigfloat truncated(uint32_t bits) const;
+
+    double toDouble() const;
+    // Exact decimal representation, which parse reads back unchanged given
+    // precision() bits
+    std::string toString() const;
+    bool isNegative() const;
+    bool isZero() const;
+
+    bigfloat operator-() const;
+    bigfloat operator+(const bigfloat& r) const;
+    bigfloat operator-(const bigfloat& r) const;
+    bigfloat operator*(const bigfloat& r) const;
+
+    friend std::ostream& operator<<(std::ostream& s, const bigfloat& b) {
+        return s << b.toDouble();
+    }
+};
+
+#endif // BIGFLOAT_H
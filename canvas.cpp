@@ -1,92 +1,192 @@
+#include <fstream>
 #include "canvas.h"
 
+static const uint32_t BLACK = 0xff000000;
+
+// QImage sharing the pixels of f
+static QImage wrapFrame(const FrameBuffer& f) {
+    const argb_image& i = f.image();
+    return QImage(reinterpret_cast<uchar*>(i.pixels), i.width, i.height,
+            i.stride * sizeof(uint32_t), QImage::Format_ARGB32);
+}
+
 Canvas::Canvas(QWidget* parent): QWidget(parent) {
     dim_viewport.m_height = 2;
     dim_viewport.m_offset_y = 1;
     dim_viewport.m_offset_x = -2;
     dim_viewport.m_width = 3;
-
-    thread_num = 4;
-
-    mandelbrot = std::unique_ptr<Mandelbrot>(new Mandelbrot());
-    t_draw_buffer.resize(thread_num);
-    t_preview_buffer.resize(thread_num);
-    resizeBuffer();
-
-    mandelbrot->updateComplexDimensions(dim_viewport);
+    // Picked to fit the view above once the widget has a size
+    level = -1;
+    wheel_delta = 0;
+
+    generation = 0;
+    show_stats = false;
+
+    // Results are copied into the display on the render threads, only the
+    // repaints and the stats are queued to the GUI thread
+    renderer = std::unique_ptr<Renderer>(new Renderer(
+            [this](uint64_t gen, const argb_image& part, const QRect& rect) {
+        showPart(gen, part, rect);
+    }, [this](uint64_t gen, const frame_stats& s) {
+        QMetaObject::invokeMethod(this, [this, gen, s]() {
+            showStats(gen, s);
+        }, Qt::QueuedConnection);
+    }));
+
+    settle.setSingleShot(true);
+    settle.setInterval(SETTLE_MS);
+    connect(&settle, &QTimer::timeout, this, [this]() {
+        if(!mousePressed)
+            requestFrame(dim_viewport);
+    });
 
     mousePressed = false;
     this->setMouseTracking(true);
+    this->setFocusPolicy(Qt::StrongFocus);
 }
 
+void Canvas::requestFrame(const m_dimension& d, bool interactive) {
+    if(this->width() < 2 || this->height() < 2)
+        return;
 
-void Canvas::resizeBuffer() {
-    uint32_t seg_height = this->height() / thread_num;
-    for(uint32_t i=0; i<t_draw_buffer.size(); i++) {
-        if(i < t_draw_buffer.size() - 1)
-            t_draw_buffer.at(i) = QImage(this->width(), seg_height,
-                    QImage::Format_ARGB32);
-        else
-            t_draw_buffer.at(i) = QImage(this->width(), this->height()
-                    - (thread_num - 1) * seg_height,
-                    QImage::Format_ARGB32);
+    // Parts of the new frame wait until its generation is known
+    std::lock_guard<std::mutex> l(display_lock);
+    generation = renderer->request(d, this->width(), this->height(),
+            interactive);
+}
 
-    }
+void Canvas::setDisplay(std::unique_ptr<FrameBuffer> f) {
+    frames.give(std::move(display));
+    display = std::move(f);
+    display_image = wrapFrame(*display);
+}
 
-    double ratio = static_cast<double>(this->width()) / this->height();
-    uint32_t nw = std::sqrt(PREVIEW_PIXCOUNT);
-    uint32_t nh = std::sqrt(PREVIEW_PIXCOUNT/(ratio * ratio));
-    uint32_t pseg_height = nh / thread_num;
-    for(uint32_t i=0; i<t_preview_buffer.size(); i++) {
-        if(i < t_preview_buffer.size() - 1)
-            t_preview_buffer.at(i) = QImage(nw, pseg_height,
-                    QImage::Format_ARGB32);
-        else
-            t_preview_buffer.at(i) = QImage(nw, nh
-                    - (thread_num - 1) * pseg_height,
-                    QImage::Format_ARGB32);
+void Canvas::showPart(uint64_t gen, const argb_image& part,
+        const QRect& rect) {
+    bool queue;
+    {
+        std::lock_guard<std::mutex> l(display_lock);
+        if(gen != generation || !display)
+            return;
+
+        display->copyFrom(part, rect.x(), rect.y());
+        queue = dirty.isEmpty();
+        dirty |= rect;
+    }
+    if(queue)
+        QMetaObject::invokeMethod(this, [this]() {
+            flushDirty();
+        }, Qt::QueuedConnection);
+}
 
+void Canvas::flushDirty() {
+    QRect r;
+    {
+        std::lock_guard<std::mutex> l(display_lock);
+        std::swap(r, dirty);
     }
-    preview_buffer = QImage(nw, nh, QImage::Format_ARGB32);
+    update(r);
+}
+
+void Canvas::showStats(uint64_t gen, const frame_stats& s) {
+    if(gen != generation || !show_stats)
+        return;
+
+    stats = s;
+    update();
 }
 
 void Canvas::paintEvent(QPaintEvent* ev) {
     QPainter p(this);
-    if(!mousePressed) {
-        // Directly draw tiles onto main draw buffer
-        mandelbrot->refreshMandelbrotTiled(t_draw_buffer);
-        uint32_t cur_hstart = 0;
-        uint32_t cur_hend = t_draw_buffer.at(0).height();
-        for(uint32_t i=0; i<t_draw_buffer.size(); i++) {
-            if(i > 0) {
-                cur_hstart = cur_hend;
-                cur_hend = cur_hstart + t_draw_buffer.at(i).height();
-            }
-            p.drawImage(0, cur_hstart, t_draw_buffer.at(i));
-        }
+    {
+        std::lock_guard<std::mutex> l(display_lock);
+        if(display)
+            p.drawImage(ev->rect(), display_image, ev->rect());
+    }
+    if(show_stats)
+        paintStats(p);
+}
+
+void Canvas::paintStats(QPainter& p) {
+    const int32_t LINE = 14;
+    const int32_t HISTOGRAM_HEIGHT = 40;
+
+    // Tiles of the final pass tinted by their time, the slowest one most
+    double slowest = 0;
+    for(const tile_stats& t : stats.tiles)
+        slowest = std::max(slowest, t.end - t.start);
+    for(const tile_stats& t : stats.tiles) {
+        if(t.block != 1 || slowest <= 0)
+            continue;
+        p.fillRect(QRect(t.tile.x, t.tile.y, t.tile.width, t.tile.height),
+                QColor(255, 0, 0, static_cast<int32_t>(
+                        160 * (t.end - t.start) / slowest)));
+    }
+
+    std::vector<std::string> lines = summarizeStats(stats);
+    if(stats.passes == 0)
+        lines = {"statistics follow with the next frame"};
+
+    QRect box(8, 8, 360, LINE * lines.size() + HISTOGRAM_HEIGHT + 16);
+    p.fillRect(box, QColor(0, 0, 0, 180));
+    p.setPen(QColor(Qt::white));
+    for(uint32_t i=0; i<lines.size(); i++)
+        p.drawText(box.x() + 6, box.y() + LINE * (i + 1),
+                QString::fromStdString(lines.at(i)));
+
+    // Escape iterations in powers of two, counts on a log scale
+    double top = 0;
+    for(uint64_t n : stats.histogram)
+        top = std::max(top, std::log1p(static_cast<double>(n)));
+    int32_t bar = (box.width() - 12) / frame_stats::HISTOGRAM_BUCKETS;
+    int32_t bottom = box.y() + box.height() - 6;
+    for(uint32_t k=0; k<frame_stats::HISTOGRAM_BUCKETS && top > 0; k++) {
+        int32_t h = HISTOGRAM_HEIGHT
+                * std::log1p(static_cast<double>(stats.histogram.at(k))) / top;
+        p.fillRect(QRect(box.x() + 6 + k * bar, bottom - h, bar - 1, h),
+                QColor(255, 170, 0));
+    }
+}
 
+void Canvas::keyPressEvent(QKeyEvent* ev) {
+    if(ev->key() == Qt::Key_F3) {
+        show_stats = !show_stats;
+        stats = frame_stats();
+        renderer->setCollectStats(show_stats);
+        update();
+    } else if(ev->key() == Qt::Key_F4 && stats.passes > 0) {
+        std::ofstream file(TRACE_PATH);
+        if(!writeChromeTrace({stats}, file))
+            std::cerr << "cannot write " << TRACE_PATH << std::endl;
     } else {
-        // First draw preview tile onto preview buffer
-        mandelbrot->refreshMandelbrotTiled(t_preview_buffer);
-        QPainter pp(&preview_buffer);
-
-        uint32_t cur_hstart = 0;
-        uint32_t cur_hend = t_preview_buffer.at(0).height();
-        for(uint32_t i=0; i<t_draw_buffer.size(); i++) {
-            if(i > 0) {
-                cur_hstart = cur_hend;
-                cur_hend = cur_hstart + t_preview_buffer.at(i).height();
-            }
-            pp.drawImage(0, cur_hstart, t_preview_buffer.at(i));
-        }
-
-        // Draw (scaled) preview buffer to main draw buffer
-        p.drawImage(0, 0, preview_buffer.scaled(this->width(), this->height()));
+        QWidget::keyPressEvent(ev);
     }
 }
 
 void Canvas::resizeEvent(QResizeEvent* ev) {
-    resizeBuffer();
+    {
+        std::lock_guard<std::mutex> l(display_lock);
+        std::unique_ptr<FrameBuffer> resized = frames.take(this->width(),
+                this->height());
+        resized->fill(BLACK);
+        if(display)
+            resized->copyFrom(display->image());
+        setDisplay(std::move(resized));
+        generation = 0;
+    }
+
+    // Resizing shows more or less of the plane at the same spacing
+    if(level < 0)
+        level = nearestGridLevel(std::max(
+                dim_viewport.m_width / (this->width() - 1),
+                dim_viewport.m_height / (this->height() - 1)));
+    dim_viewport = gridViewport(dim_viewport, level, this->width(),
+            this->height());
+    if(mousePressed)
+        tmp_viewport = gridViewport(tmp_viewport, level, this->width(),
+                this->height());
+
+    requestFrame(mousePressed ? tmp_viewport : dim_viewport);
 
     QWidget::resizeEvent(ev);
 }
@@ -95,6 +195,9 @@ void Canvas::mousePressEvent(QMouseEvent* ev) {
     mousePressed = true;
     mousePressedX = ev->x();
     mousePressedY = ev->y();
+    pannedX = 0;
+    pannedY = 0;
+    tmp_viewport = dim_viewport;
 
     this->setCursor(Qt::OpenHandCursor);
 
@@ -115,18 +218,29 @@ void Canvas::mouseMoveEvent(QMouseEvent* ev) {
     if(!mousePressed)
         return;
 
-    tmp_viewport = dim_viewport;
-
-    double xratio = static_cast<double>(mousePressedX - ev->x())
-            / this->width();
-    double yratio = static_cast<double>(ev->y() - mousePressedY)
-            / this->height();
+    // Pan by whole pixels, so the previous frame can be scrolled and only
+    // the exposed strips need to be computed.
+    int32_t px = mousePressedX - ev->x();
+    int32_t py = mousePressedY - ev->y();
+    if(px == pannedX && py == pannedY)
+        return;
 
-    tmp_viewport.m_offset_x += xratio * tmp_viewport.m_width;
-    tmp_viewport.m_offset_y += yratio * tmp_viewport.m_height;
+    tmp_viewport = dim_viewport;
+    double step_x = tmp_viewport.m_width / (this->width() - 1);
+    double step_y = tmp_viewport.m_height / (this->height() - 1);
+    translateDimensions(tmp_viewport, px * step_x, -py * step_y);
+
+    // Show the old frame shifted until the renderer fills the gaps
+    {
+        std::lock_guard<std::mutex> l(display_lock);
+        display->scroll(px - pannedX, py - pannedY, BLACK);
+        generation = 0;
+    }
 
-    mandelbrot->updateComplexDimensions(tmp_viewport);
-    repaint();
+    requestFrame(tmp_viewport, true);
+    scroll(pannedX - px, pannedY - py);
+    pannedX = px;
+    pannedY = py;
 }
 
 void Canvas::mouseReleaseEvent(QMouseEvent* ev) {
@@ -135,43 +249,65 @@ void Canvas::mouseReleaseEvent(QMouseEvent* ev) {
 
     mousePressed = false;
     dim_viewport = tmp_viewport;
+    requestFrame(dim_viewport);
 
     this->setCursor(Qt::ArrowCursor);
 
-    this->repaint();
-
     QWidget::mouseReleaseEvent(ev);
 }
 
 void Canvas::wheelEvent(QWheelEvent* ev) {
-    double focal_real = dim_viewport.m_offset_x
-            + (static_cast<double>(ev->x()) / this->width())
-            * dim_viewport.m_width;
-    double focal_imag = dim_viewport.m_offset_y
-            - (static_cast<double>(ev->y()) / this->height())
-            * dim_viewport.m_height;
+    // One grid level, a factor of two, per notch of the wheel
+    wheel_delta += ev->delta();
+    int32_t notches = wheel_delta / 120;
+    wheel_delta -= notches * 120;
+    int32_t new_level = std::max(level + notches, 0);
+    if(new_level == level || this->width() < 2 || this->height() < 2)
+        return;
+
     double real_ratio = static_cast<double>(ev->x()) / this->width();
     double imag_ratio = static_cast<double>(ev->y()) / this->height();
-
-    double zoom = static_cast<double>(ev->delta()) / 100;
-    if(zoom > 0) {
-        dim_viewport.m_width /= zoom;
-        dim_viewport.m_height /= zoom;
-    } else {
-        dim_viewport.m_width *= -zoom;
-        dim_viewport.m_height *= -zoom;
+    double old_width = dim_viewport.m_width;
+    double old_height = dim_viewport.m_height;
+
+    double zoom = std::ldexp(1.0, new_level - level);
+    dim_viewport.m_width /= zoom;
+    dim_viewport.m_height /= zoom;
+
+    // Keep the point under the cursor fixed, up to the snap to the grid
+    translateDimensions(dim_viewport,
+            real_ratio * (old_width - dim_viewport.m_width),
+            imag_ratio * (dim_viewport.m_height - old_height));
+    dim_viewport = gridViewport(dim_viewport, new_level, this->width(),
+            this->height());
+    level = new_level;
+
+    // Preview: the old frame scaled about the cursor
+    double s = old_width / dim_viewport.m_width;
+    {
+        std::lock_guard<std::mutex> l(display_lock);
+        std::unique_ptr<FrameBuffer> zoomed = frames.take(display->width(),
+                display->height());
+        QImage target = wrapFrame(*zoomed);
+        target.fill(Qt::black);
+        QPainter p(&target);
+        p.drawImage(QRectF(-real_ratio * (s - 1) * (this->width() - 1),
+                    -imag_ratio * (s - 1) * (this->height() - 1),
+                    s * this->width(), s * this->height()), display_image);
+        p.end();
+        setDisplay(std::move(zoomed));
+        generation = 0;
     }
 
-    dim_viewport.m_offset_x = focal_real - real_ratio * dim_viewport.m_width;
-    dim_viewport.m_offset_y = focal_imag + imag_ratio * dim_viewport.m_height;
-
-    mandelbrot->updateComplexDimensions(dim_viewport);
-    repaint();
+    requestFrame(dim_viewport, true);
+    settle.start();
+    update();
 }
 
 void Canvas::setThreads(uint8_t t) {
-    thread_num = t;
-    t_draw_buffer.resize(t);
-    t_preview_buffer.resize(t);
-    resizeBuffer();
+    renderer->setThreads(t);
+}
+
+void Canvas::setTargetFrameRate(double fps) {
+    renderer->setTargetFrameRate(fps);
 }
@@ -4,13 +4,16 @@
 #include <QWidget>
 #include <QResizeEvent>
 #include <QMouseEvent>
+#include <QKeyEvent>
 #include <QPainter>
+#include <QImage>
+#include <QTimer>
 #include <memory>
 #include <mutex>
 #include <random>
 #include <set>
 #include <functional>
-#include "mandelbrot.h"
+#include "renderer.h"
 
 class Canvas: public QWidget
 {
@@ -18,6 +21,12 @@ class Canvas: public QWidget
 public:
     Canvas(QWidget* parent = 0);
     void setThreads(uint8_t t);
+    void setTargetFrameRate(double fps);
+
+    // Idle time after the last wheel event until the zoom counts as done
+    const int32_t SETTLE_MS = 200;
+    // Where F4 writes the Chrome trace of the last frame
+    const char* const TRACE_PATH = "mandelbrot-trace.json";
 
 protected:
     void paintEvent(QPaintEvent* ev) override;
@@ -26,22 +35,52 @@ protected:
     void mousePressEvent(QMouseEvent* ev) override;
     void mouseMoveEvent(QMouseEvent* ev) override;
     void mouseReleaseEvent(QMouseEvent* ev) override;
+    // F3 toggles the statistics overlay, F4 writes a trace of its frame
+    void keyPressEvent(QKeyEvent* ev) override;
 private:
-    const uint32_t PREVIEW_PIXCOUNT = 30000;
-    uint8_t thread_num;
-
+    // Viewports stay on the grid of the tile cache: level sets the pixel
+    // spacing, pans move by whole pixels
     m_dimension dim_viewport;
     m_dimension tmp_viewport;
+    int32_t level;
+    // Wheel rotation not yet turned into a level change
+    int32_t wheel_delta;
     bool mousePressed;
     int32_t mousePressedX;
     int32_t mousePressedY;
+    // Pixels the widget contents were scrolled by during the current drag
+    int32_t pannedX;
+    int32_t pannedY;
 
-    std::unique_ptr<Mandelbrot> mandelbrot;
-    QImage preview_buffer;
-    std::vector<QImage> t_draw_buffer;
-    std::vector<QImage> t_preview_buffer;
+    // What the widget shows, patched with the renderer's results on its
+    // threads. display_lock guards it, display_image, generation and dirty.
+    std::mutex display_lock;
+    std::unique_ptr<FrameBuffer> display;
+    // display for QPainter, sharing its pixels
+    QImage display_image;
+    // Buffers the display is swapped with on resizes and zooms
+    FramePool frames;
+    // Generation of the latest frame requested, older results are dropped.
+    // 0 while the display is changed before the next request.
+    uint64_t generation;
+    // Part of display patched since the last repaint was queued
+    QRect dirty;
+    // Ends a zoom gesture, restoring full render settings
+    QTimer settle;
+    std::unique_ptr<Renderer> renderer;
+    bool show_stats;
+    // Statistics of the last finished frame while the overlay is shown
+    frame_stats stats;
 
-    void resizeBuffer();
+    void requestFrame(const m_dimension& d, bool interactive = false);
+    // Makes f the display, with display_lock held
+    void setDisplay(std::unique_ptr<FrameBuffer> f);
+    // Copies a part of a frame into the display, on the render threads
+    void showPart(uint64_t gen, const argb_image& part, const QRect& rect);
+    // Repaints the parts showPart patched
+    void flushDirty();
+    void showStats(uint64_t gen, const frame_stats& s);
+    void paintStats(QPainter& p);
 signals:
     void positionCoordsChanged(QString real, QString imag);
 };
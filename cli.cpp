@@ -0,0 +1,556 @@
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "distributed_render.h"
+#include "image_writer.h"
+#include "mandelbrot.h"
+#include "streamed_render.h"
+#include "zoom_video.h"
+
+// Headless renderer: one image per invocation, or a batch file of jobs
+// rendered in parallel, one job per core. Images are rendered and written
+// in bands, so their size is not bounded by memory. With --frames a job
+// renders a zoom video instead. With --serve it iterates tiles for other
+// instances instead, which spread their images over such servers with
+// --nodes.
+
+struct cli_job {
+    // Center of the view, decimal strings of any precision
+    std::string center_re = "-0.75";
+    std::string center_im = "0";
+    // Width of the view in the complex plane, the height follows from the
+    // image size
+    double width = 3;
+    uint32_t image_width = 800;
+    uint32_t image_height = 600;
+    uint32_t max_iter = 1000;
+    // Raise max_iter until few pixels escape near it
+    bool auto_iter = false;
+    formula fractal = formula::mandelbrot;
+    double julia_re = -0.8;
+    double julia_im = 0.156;
+    render_mode mode = render_mode::full;
+    // Extra samples of pixels on edges, 0 for none
+    uint32_t aa = 0;
+    bool aa_refine = false;
+    // 0xRRGGBB base colors, empty for a random palette
+    std::vector<uint32_t> palette = {0x000764, 0x206bcb, 0xedffff,
+            0xffaa00, 0x000200};
+    uint32_t gradient = 50;
+    bool format_set = false;
+    image_format format = image_format::png;
+    std::string output;
+    // Chrome trace of the render, if not empty
+    std::string trace;
+
+    // Zoom video, rendered if frames is not 0. The target defaults to the
+    // center.
+    uint32_t frames = 0;
+    double frame_zoom = 1.05;
+    std::string target_re;
+    std::string target_im;
+    double key_scale = 2;
+};
+
+static void usage() {
+    std::cout <<
+        "usage: mandelbrot-cli [options] -o FILE\n"
+        "       mandelbrot-cli [options] --batch JOBFILE\n"
+        "\n"
+        "  --center RE IM   center of the view, any precision (-0.75 0)\n"
+        "  --width W        width of the view in the complex plane (3)\n"
+        "  --size WxH       image size in pixels (800x600)\n"
+        "  --iter N         iteration limit (1000)\n"
+        "  --auto-iter on|off\n"
+        "                   double the limit while the view still gains\n"
+        "                   detail from it (off, not for videos)\n"
+        "  --mode M         full or subdivide (full)\n"
+        "  --aa N           antialias edges with N jittered samples per\n"
+        "                   pixel, 0 for none (0)\n"
+        "  --aa-refine on|off\n"
+        "                   sample pixels that still vary once more (off)\n"
+        "  --formula F      mandelbrot, multibrot3, multibrot4,\n"
+        "                   burning_ship, julia or julia3 (mandelbrot)\n"
+        "  --julia RE IM    constant of the Julia formulas (-0.8 0.156)\n"
+        "  --palette P      'random' or base colors as RRGGBB,RRGGBB,...\n"
+        "  --gradient N     colors in the gradient (50)\n"
+        "  --format F       png, ppm or raw (from the file extension)\n"
+        "  -o FILE          output file\n"
+        "  --trace FILE     write per-tile timings of the render as Chrome\n"
+        "                   trace JSON (not for videos)\n"
+        "\n"
+        "  --frames N       render a zoom video of N frames instead\n"
+        "  --frame-zoom F   magnification per frame (1.05)\n"
+        "  --target RE IM   point to zoom into, within the view (the\n"
+        "                   center)\n"
+        "  --key-scale S    maximum keyframe oversampling (2)\n"
+        "                   video frames are written to -o FILE as a\n"
+        "                   pattern such as frame%05d.png, or with -o - as\n"
+        "                   raw BGRA frames to stdout for an encoder, e.g.\n"
+        "                   ffmpeg -f rawvideo -pix_fmt bgra -s WxH -i -\n"
+        "\n"
+        "  --threads N      threads to use (all cores)\n"
+        "  --batch FILE     render the jobs in FILE, one per line, each\n"
+        "                   given as options on top of the command line's\n"
+        "  --nodes LIST     render images on the servers in LIST, given as\n"
+        "                   host:port,host:port,... (not for videos)\n"
+        "  --serve PORT     run as a server iterating tiles for --nodes\n"
+        "  --bind ADDR      numeric address --serve listens on, * for all\n"
+        "                   interfaces (127.0.0.1); servers take tiles\n"
+        "                   from anyone who can reach them\n";
+}
+
+static bool parseUnsigned(const std::string& s, uint32_t& v) {
+    char* end;
+    unsigned long r = std::strtoul(s.c_str(), &end, 10);
+    if(s.empty() || *end != '\0' || s[0] == '-' || r > UINT32_MAX)
+        return false;
+    v = r;
+    return true;
+}
+
+static bool parseDouble(const std::string& s, double& v) {
+    char* end;
+    v = std::strtod(s.c_str(), &end);
+    return !s.empty() && *end == '\0';
+}
+
+// True if s holds exactly one printf conversion and that is an integer one
+// such as %05d
+static bool isFramePattern(const std::string& s) {
+    size_t p = s.find('%');
+    if(p == std::string::npos)
+        return false;
+
+    size_t i = p + 1;
+    while(i < s.size() && std::isdigit(static_cast<unsigned char>(s[i])))
+        i++;
+    return i < s.size() && s[i] == 'd' && s.find('%', i) == std::string::npos;
+}
+
+static bool parsePalette(const std::string& s, std::vector<uint32_t>& colors) {
+    colors.clear();
+    if(s == "random")
+        return true;
+
+    std::stringstream ss(s);
+    std::string c;
+    while(std::getline(ss, c, ',')) {
+        char* end;
+        unsigned long v = std::strtoul(c.c_str(), &end, 16);
+        if(c.size() != 6 || *end != '\0')
+            return false;
+        colors.push_back(v);
+    }
+    return colors.size() >= 2;
+}
+
+// Options of the command line that batch jobs cannot set
+struct cli_global {
+    // hardware_concurrency is 0 where it is not known
+    uint32_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::string batch;
+    // Render server port, 0 unless serving
+    uint32_t serve = 0;
+    // Address served on, empty for the loopback one
+    std::string bind;
+    std::vector<render_node> nodes;
+};
+
+static bool isOption(const std::string& a, bool top_level) {
+    for(const char* o : {"--center", "--width", "--size", "--iter",
+            "--auto-iter", "--mode", "--aa", "--aa-refine",
+            "--formula", "--julia", "--palette", "--gradient", "--format",
+            "-o", "--trace", "--frames", "--frame-zoom", "--target",
+            "--key-scale"}) {
+        if(a == o)
+            return true;
+    }
+    return top_level && (a == "--threads" || a == "--batch"
+            || a == "--nodes" || a == "--serve" || a == "--bind");
+}
+
+// Applies the options in args to job. The global ones are only accepted
+// where global is non-null.
+static bool parseArgs(const std::vector<std::string>& args, cli_job& job,
+        cli_global* global) {
+    for(size_t i=0; i<args.size(); i++) {
+        const std::string& a = args.at(i);
+        if(!isOption(a, global)) {
+            std::cerr << "unknown option " << a << std::endl;
+            return false;
+        }
+
+        uint32_t values = a == "--center" || a == "--target"
+                || a == "--julia" ? 2 : 1;
+        if(i + values >= args.size()) {
+            std::cerr << "missing value for " << a << std::endl;
+            return false;
+        }
+
+        const std::string& v = args.at(i + 1);
+        bigfloat check;
+        bool ok = true;
+        if(a == "--center") {
+            job.center_re = v;
+            job.center_im = args.at(i + 2);
+            ok = bigfloat::parse(job.center_re, 0, check)
+                    && bigfloat::parse(job.center_im, 0, check);
+        } else if(a == "--target") {
+            job.target_re = v;
+            job.target_im = args.at(i + 2);
+            ok = bigfloat::parse(job.target_re, 0, check)
+                    && bigfloat::parse(job.target_im, 0, check);
+        } else if(a == "--width") {
+            ok = parseDouble(v, job.width) && job.width > 0;
+        } else if(a == "--frames") {
+            ok = parseUnsigned(v, job.frames);
+        } else if(a == "--frame-zoom") {
+            ok = parseDouble(v, job.frame_zoom) && job.frame_zoom > 1;
+        } else if(a == "--key-scale") {
+            ok = parseDouble(v, job.key_scale) && job.key_scale >= 1;
+        } else if(a == "--size") {
+            char x;
+            char rest;
+            ok = std::sscanf(v.c_str(), "%u%c%u%c", &job.image_width, &x,
+                    &job.image_height, &rest) == 3 && x == 'x'
+                    && job.image_width >= 2 && job.image_height >= 2;
+        } else if(a == "--iter") {
+            ok = parseUnsigned(v, job.max_iter) && job.max_iter > 0;
+        } else if(a == "--auto-iter") {
+            ok = v == "on" || v == "off";
+            job.auto_iter = v == "on";
+        } else if(a == "--mode") {
+            ok = v == "full" || v == "subdivide";
+            job.mode = v == "subdivide" ? render_mode::subdivide
+                    : render_mode::full;
+        } else if(a == "--aa") {
+            ok = parseUnsigned(v, job.aa) && job.aa <= 256;
+        } else if(a == "--aa-refine") {
+            ok = v == "on" || v == "off";
+            job.aa_refine = v == "on";
+        } else if(a == "--formula") {
+            ok = parseFormula(v, job.fractal);
+        } else if(a == "--julia") {
+            ok = parseDouble(v, job.julia_re)
+                    && parseDouble(args.at(i + 2), job.julia_im);
+        } else if(a == "--palette") {
+            ok = parsePalette(v, job.palette);
+        } else if(a == "--gradient") {
+            ok = parseUnsigned(v, job.gradient) && job.gradient >= 2;
+        } else if(a == "--format") {
+            ok = parseImageFormat(v, job.format);
+            job.format_set = true;
+        } else if(a == "-o") {
+            job.output = v;
+        } else if(a == "--trace") {
+            job.trace = v;
+        } else if(a == "--threads") {
+            ok = parseUnsigned(v, global->threads) && global->threads > 0;
+        } else if(a == "--nodes") {
+            ok = parseNodes(v, global->nodes);
+        } else if(a == "--serve") {
+            ok = parseUnsigned(v, global->serve) && global->serve > 0
+                    && global->serve <= UINT16_MAX;
+        } else if(a == "--bind") {
+            global->bind = v;
+            ok = !v.empty();
+        } else {
+            global->batch = v;
+        }
+
+        if(!ok) {
+            std::cerr << "invalid value for " << a << ": " << v << std::endl;
+            return false;
+        }
+        i += values;
+    }
+    return true;
+}
+
+static bool renderVideo(Mandelbrot& m, const cli_job& job,
+        const m_dimension& d, uint32_t bits, uint32_t threads) {
+    bool to_stdout = job.output == "-";
+    if(!to_stdout && !isFramePattern(job.output)) {
+        std::cerr << "video output needs a frame pattern or -: "
+                  << job.output << std::endl;
+        return false;
+    }
+
+    zoom_sequence z;
+    z.start = d;
+    z.frames = job.frames;
+    z.frame_zoom = job.frame_zoom;
+    z.width = job.image_width;
+    z.height = job.image_height;
+    z.key_scale = job.key_scale;
+    bigfloat::parse(job.target_re.empty() ? job.center_re : job.target_re,
+            bits, z.target_x);
+    bigfloat::parse(job.target_im.empty() ? job.center_im : job.target_im,
+            bits, z.target_y);
+    if(!zoomTargetInFrame(z)) {
+        std::cerr << "the target has to lie within the view" << std::endl;
+        return false;
+    }
+
+    image_format format = job.format_set ? job.format
+            : formatFromPath(job.output);
+    return renderZoomSequence(m, z, threads,
+            [&](uint32_t k, const argb_image& image) {
+        if(to_stdout) {
+            for(uint32_t y=0; y<image.height; y++)
+                std::fwrite(image.line(y), sizeof(uint32_t), image.width,
+                        stdout);
+            return !std::ferror(stdout);
+        }
+
+        std::vector<char> name(job.output.size() + 16);
+        std::snprintf(name.data(), name.size(), job.output.c_str(),
+                static_cast<int>(k));
+        if(!writeImage(name.data(), image, format)) {
+            std::cerr << "cannot write " << name.data() << std::endl;
+            return false;
+        }
+        return true;
+    });
+}
+
+static std::unique_ptr<Coloring> makeColoring(const cli_job& job) {
+    if(job.palette.empty())
+        return std::unique_ptr<Coloring>(new SmoothColoring(4, job.gradient));
+    return std::unique_ptr<Coloring>(
+            new SmoothColoring(job.palette, job.gradient));
+}
+
+// Renders the image on the render servers
+static bool renderOnNodes(const cli_job& job, const m_dimension& d,
+        const std::vector<render_node>& nodes) {
+    if(job.frames > 0 || !job.trace.empty() || job.aa > 0) {
+        std::cerr << "--nodes does not render videos, traces or --aa"
+                  << std::endl;
+        return false;
+    }
+
+    tile_settings s;
+    s.max_iter = job.max_iter;
+    s.fractal = job.fractal;
+    s.julia_re = job.julia_re;
+    s.julia_im = job.julia_im;
+    s.mode = job.mode;
+    std::unique_ptr<Coloring> coloring = makeColoring(job);
+
+    image_format format = job.format_set ? job.format
+            : formatFromPath(job.output);
+    std::unique_ptr<ImageStream> out = openImageStream(job.output,
+            job.image_width, job.image_height, format);
+    if(!out) {
+        std::cerr << "cannot write " << job.output << std::endl;
+        return false;
+    }
+    if(!renderDistributed(nodes, s, d, job.image_width, job.image_height,
+            *coloring, *out)) {
+        std::cerr << "cannot render " << job.output << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Width of the preview --auto-iter finds the iteration limit on
+constexpr uint32_t AUTO_ITER_PREVIEW = 256;
+
+// Iteration limit m settles on with automatic iterations for the view d of
+// job, on a preview of it. The image is then rendered band by band with
+// that limit, so every band uses the same.
+static uint32_t autoIterations(Mandelbrot& m, const cli_job& job,
+        m_dimension d) {
+    uint32_t w = std::min(job.image_width, AUTO_ITER_PREVIEW);
+    uint32_t h = std::max<uint32_t>(2, std::lround((job.image_height - 1.0)
+            * (w - 1) / (job.image_width - 1)) + 1);
+    // Same center and width, the height follows from the preview's shape
+    double height = d.m_width * (h - 1) / (w - 1);
+    translateDimensions(d, 0, (height - d.m_height) / 2);
+    d.m_height = height;
+
+    std::vector<uint32_t> pixels(static_cast<size_t>(w) * h);
+    argb_image image;
+    image.pixels = pixels.data();
+    image.width = w;
+    image.height = h;
+    image.stride = w;
+    m.setKeepOrbits(true);
+    m.setAutoIterations(true);
+    m.updateComplexDimensions(d);
+    while(!m.refreshMandelbrotTiled(image));
+    m.setAutoIterations(false);
+    m.setKeepOrbits(false);
+    return m.getMaxIter();
+}
+
+static bool renderJob(Mandelbrot& m, cli_job job, uint32_t threads,
+        const std::vector<render_node>& nodes,
+        std::vector<uint32_t>& pixels) {
+    m_dimension d;
+    d.m_width = job.width;
+    d.m_height = job.width * (job.image_height - 1) / (job.image_width - 1);
+
+    // Coordinates need the bits down to the finest pixel spacing, that of
+    // the last frame of a video, plus guard bits
+    double step = d.m_width / (job.image_width - 1);
+    if(job.frames > 0)
+        step /= std::pow(job.frame_zoom, job.frames - 1.0);
+    uint32_t bits = static_cast<uint32_t>(std::max(0.0, -std::log2(step)))
+            + 64;
+    bigfloat cr;
+    bigfloat ci;
+    bigfloat::parse(job.center_re, bits, cr);
+    bigfloat::parse(job.center_im, bits, ci);
+    setExactOffset(d, cr - bigfloat(d.m_width / 2),
+            ci + bigfloat(d.m_height / 2));
+
+    if(job.frames > 0 && (!job.trace.empty() || job.auto_iter)) {
+        std::cerr << "--trace and --auto-iter are not supported for videos"
+                  << std::endl;
+        return false;
+    }
+
+    m.setColoring(makeColoring(job));
+    m.setMaxIter(job.max_iter);
+    m.setFormula(job.fractal);
+    m.setJuliaConstant(job.julia_re, job.julia_im);
+    m.setRenderMode(job.mode);
+    m.setAntialiasing(0, false);
+    if(job.auto_iter)
+        job.max_iter = autoIterations(m, job, d);
+
+    if(!nodes.empty())
+        return renderOnNodes(job, d, nodes);
+
+    m.setAntialiasing(job.aa, job.aa_refine);
+    if(job.frames > 0)
+        return renderVideo(m, job, d, bits, threads);
+
+    image_format format = job.format_set ? job.format
+            : formatFromPath(job.output);
+    std::unique_ptr<ImageStream> out = openImageStream(job.output,
+            job.image_width, job.image_height, format);
+    std::vector<frame_stats> stats;
+    m.setCollectStats(!job.trace.empty());
+    bool ok = out && renderStreamed(m, d, job.image_width, job.image_height,
+            *out, pixels, STREAM_BAND_PIXELS,
+            job.trace.empty() ? nullptr : &stats);
+    m.setCollectStats(false);
+    if(!ok) {
+        std::cerr << "cannot write " << job.output << std::endl;
+        return false;
+    }
+
+    if(!job.trace.empty()) {
+        std::ofstream file(job.trace);
+        if(!writeChromeTrace(stats, file)) {
+            std::cerr << "cannot write " << job.trace << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool readBatch(const std::string& path, const cli_job& base,
+        std::vector<cli_job>& jobs) {
+    std::ifstream f(path);
+    if(!f) {
+        std::cerr << "cannot read " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for(uint32_t n=1; std::getline(f, line); n++) {
+        std::stringstream ss(line);
+        std::vector<std::string> args;
+        std::string a;
+        while(ss >> a)
+            args.push_back(a);
+        if(args.empty() || args.at(0)[0] == '#')
+            continue;
+
+        cli_job job = base;
+        job.output.clear();
+        if(!parseArgs(args, job, nullptr) || job.output.empty()) {
+            std::cerr << path << ":" << n << ": invalid job" << std::endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for(const std::string& a : args) {
+        if(a == "-h" || a == "--help") {
+            usage();
+            return 0;
+        }
+    }
+
+    cli_job base;
+    cli_global global;
+    if(!parseArgs(args, base, &global))
+        return 1;
+    uint32_t threads = global.threads;
+
+    if(global.serve > 0) {
+        std::string where = global.bind.empty() ? "127.0.0.1" : global.bind;
+        std::cerr << "serving tiles on " << where << " port " << global.serve
+                  << std::endl;
+        if(!runRenderServer(global.bind, global.serve, threads)) {
+            std::cerr << "cannot listen on " << where << " port "
+                      << global.serve << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if(global.batch.empty()) {
+        if(base.output.empty()) {
+            usage();
+            return 1;
+        }
+
+        // A single image spreads its tiles over all threads, in one pass
+        Mandelbrot m(threads);
+        m.setPreviewBlock(1);
+        std::vector<uint32_t> pixels;
+        return renderJob(m, base, threads, global.nodes, pixels) ? 0 : 1;
+    }
+
+    std::vector<cli_job> jobs;
+    if(!readBatch(global.batch, base, jobs))
+        return 1;
+
+    // Jobs are small and many, so each thread renders whole jobs on its own
+    std::atomic<uint32_t> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    for(uint32_t t=0; t<std::min<size_t>(threads, jobs.size()); t++) {
+        workers.emplace_back([&]() {
+            Mandelbrot m(1);
+            m.setPreviewBlock(1);
+            std::vector<uint32_t> pixels;
+            for(uint32_t i; (i = next++) < jobs.size();) {
+                if(!renderJob(m, jobs.at(i), 1, global.nodes, pixels))
+                    failed = true;
+            }
+        });
+    }
+    for(std::thread& w : workers)
+        w.join();
+
+    return failed ? 1 : 0;
+}
@@ -2,3 +2,6 @@
 
 Coloring::Coloring() {
 }
+
+Coloring::~Coloring() {
+}
@@ -1,15 +1,33 @@
 #ifndef _COLORING_H
 #define _COLORING_H
 
-#include <QPainter>
+#include <cstdint>
+
+struct kernel_table;
+
+// Color with channels in [0, 1]
+struct rgb_color {
+    double r;
+    double g;
+    double b;
+};
 
 class Coloring {
     private:
 
     public:
         Coloring();
-        virtual QColor getColor(int32_t iterations, double normal) = 0;
-        virtual QColor getColor_avx(int32_t iterations, double normal) = 0;
+        virtual ~Coloring();
+        // Colors as packed ARGB32
+        virtual uint32_t getColor(int32_t iterations, double normal) = 0;
+        // getColor with the vector kernels of k
+        virtual uint32_t getColor_avx(int32_t iterations, double normal,
+                const kernel_table& k) = 0;
+
+        // Batch variant of getColor: colorizes n pixels into packed ARGB32
+        // with the vector kernels of k.
+        virtual void getColors(const int32_t* iterations, const float* normals,
+                uint32_t* argb, uint32_t n, const kernel_table& k) = 0;
 };
 
 #endif
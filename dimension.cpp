@@ -0,0 +1,22 @@
+#include "dimension.h"
+
+void translateDimensions(m_dimension& d, double dx, double dy) {
+    bigfloat x = exactOffsetX(d) + bigfloat(dx);
+    bigfloat y = exactOffsetY(d) + bigfloat(dy);
+    setExactOffset(d, x, y);
+}
+
+void setExactOffset(m_dimension& d, const bigfloat& x, const bigfloat& y) {
+    d.m_offset_x = x.toDouble();
+    d.m_offset_y = y.toDouble();
+    d.m_offset_x_lo = x - bigfloat(d.m_offset_x);
+    d.m_offset_y_lo = y - bigfloat(d.m_offset_y);
+}
+
+bigfloat exactOffsetX(const m_dimension& d) {
+    return bigfloat(d.m_offset_x) + d.m_offset_x_lo;
+}
+
+bigfloat exactOffsetY(const m_dimension& d) {
+    return bigfloat(d.m_offset_y) + d.m_offset_y_lo;
+}
@@ -0,0 +1,44 @@
+#ifndef DIMENSION_H
+#define DIMENSION_H
+
+#include <cstdint>
+#include "bigfloat.h"
+
+// Viewport in the complex plane. m_offset_x/m_offset_y is the upper left
+// corner. Once zooms go past double resolution, m_offset_x_lo and
+// m_offset_y_lo hold what the double offsets lost, so that
+// m_offset_x + m_offset_x_lo is the exact offset.
+struct m_dimension {
+    double m_offset_x;
+    double m_offset_y;
+    double m_width;
+    double m_height;
+    bigfloat m_offset_x_lo;
+    bigfloat m_offset_y_lo;
+};
+
+// Rectangle of the frame in pixel coordinates, the unit of work handed to
+// the thread pool.
+struct m_tile {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Single pixel of the frame
+struct m_pixel {
+    uint32_t x;
+    uint32_t y;
+};
+
+// Moves the viewport by (dx, dy) without losing precision in the offsets.
+void translateDimensions(m_dimension& d, double dx, double dy);
+
+// Sets the offsets to the exact values x, y
+void setExactOffset(m_dimension& d, const bigfloat& x, const bigfloat& y);
+
+bigfloat exactOffsetX(const m_dimension& d);
+bigfloat exactOffsetY(const m_dimension& d);
+
+#endif // DIMENSION_H
@@ -0,0 +1,875 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef MANDELBROT_ZLIB
+#include <zlib.h>
+#endif
+#include "distributed_render.h"
+
+// Every message is a 32 bit length, then a type byte and the fields of
+// that type, all in host byte order: the nodes of a render cluster are
+// expected to share their architecture.
+//
+//   hello   server's first message: threads (u32), then 1 (u32), which a
+//           coordinator of the other byte order reads as 1 << 24
+//   tile    id (u64), offset x and y of the image as exact decimal
+//           strings, their precision in bits (u32), width and height of
+//           the image in the plane (f64), size of the tile in pixels
+//           (u32 x 2), its first row and the image height (u32 x 2),
+//           max_iter (u32), formula, Julia constant (f64 x 2), mode,
+//           whether the reply may be deflated (u8 each)
+//   result  id (u64), size in pixels (u32 x 2), whether the iteration
+//           counts are deflated (u8), their size in bytes (u32), the
+//           counts (i32) and then the norms (f32), both in row-major
+//           order. Norms are sent as they are, their low bits hardly
+//           compress.
+//   ping    sent by the coordinator, answered by a pong
+
+enum class message : uint8_t {
+    hello = 1,
+    tile,
+    result,
+    ping,
+    pong
+};
+
+// Largest tile of a frame within NODE_MAX_WIDTH
+constexpr uint32_t MAX_TILE_PIXELS = std::max(NODE_TILE_PIXELS,
+        2 * NODE_MAX_WIDTH);
+// Precision of tile offsets, beyond what the deepest zoom of double
+// viewport sizes takes
+constexpr uint32_t MAX_OFFSET_BITS = 1 << 13;
+// Larger messages are taken as garbage. Results take 8 bytes per pixel,
+// deflated ones never more; tiles mostly their offsets, a decimal digit per
+// bit.
+constexpr uint32_t MAX_MESSAGE = 8 * MAX_TILE_PIXELS + 1024;
+static_assert(MAX_MESSAGE > 2 * MAX_OFFSET_BITS + 1024,
+        "tile messages must fit");
+
+// Seconds of work each server has queued beyond one tile per thread, so
+// that it never waits for the next tile
+constexpr double PIPELINE_SECONDS = 0.05;
+
+static double now() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct message_writer {
+    std::vector<uint8_t> data = std::vector<uint8_t>(4);
+
+    explicit message_writer(message type) {
+        put(static_cast<uint8_t>(type));
+    }
+
+    template<class T>
+    void put(T v) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&v);
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+
+    void putString(const std::string& s) {
+        put(static_cast<uint32_t>(s.size()));
+        data.insert(data.end(), s.begin(), s.end());
+    }
+
+    // Fills in the length and sends the message, false if the connection
+    // failed
+    bool send(int fd) {
+        uint32_t size = data.size() - 4;
+        std::memcpy(data.data(), &size, 4);
+        for(size_t done = 0; done < data.size();) {
+            ssize_t n = ::send(fd, data.data() + done, data.size() - done,
+                    MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            done += n;
+        }
+        return true;
+    }
+};
+
+// Reads the fields of a message, ok turns false once one runs past its end
+struct message_reader {
+    const uint8_t* p;
+    size_t left;
+    bool ok = true;
+
+    message_reader(const uint8_t* data, size_t size): p(data), left(size) {}
+
+    template<class T>
+    T get() {
+        T v{};
+        if(left < sizeof(T)) {
+            ok = false;
+            return v;
+        }
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        left -= sizeof(T);
+        return v;
+    }
+
+    std::string getString() {
+        uint32_t size = get<uint32_t>();
+        if(!ok || left < size) {
+            ok = false;
+            return std::string();
+        }
+        std::string s(reinterpret_cast<const char*>(p), size);
+        p += size;
+        left -= size;
+        return s;
+    }
+};
+
+static bool readAll(int fd, uint8_t* data, size_t size) {
+    for(size_t done = 0; done < size;) {
+        ssize_t n = ::recv(fd, data + done, size - done, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Blocks until a whole message arrived, body holds it without the length
+static bool readMessage(int fd, std::vector<uint8_t>& body) {
+    uint32_t size;
+    if(!readAll(fd, reinterpret_cast<uint8_t*>(&size), 4) || size == 0
+            || size > MAX_MESSAGE)
+        return false;
+    body.resize(size);
+    return readAll(fd, body.data(), size);
+}
+
+bool parseNodes(const std::string& s, std::vector<render_node>& nodes) {
+    nodes.clear();
+    std::stringstream ss(s);
+    std::string n;
+    while(std::getline(ss, n, ',')) {
+        size_t colon = n.rfind(':');
+        if(colon == std::string::npos || colon == 0)
+            return false;
+
+        char* end;
+        std::string port = n.substr(colon + 1);
+        unsigned long p = std::strtoul(port.c_str(), &end, 10);
+        if(port.empty() || *end != '\0' || p == 0 || p > UINT16_MAX)
+            return false;
+        nodes.push_back({n.substr(0, colon), static_cast<uint16_t>(p)});
+    }
+    return !nodes.empty();
+}
+
+struct tile_job {
+    uint64_t id;
+    m_dimension d;
+    uint32_t width;
+    uint32_t height;
+    // Rows of the image of d the tile is a band of
+    uint32_t top;
+    uint32_t image_height;
+    tile_settings s;
+    bool deflate;
+};
+
+static bool parseTile(message_reader& r, tile_job& j) {
+    j.id = r.get<uint64_t>();
+    std::string x = r.getString();
+    std::string y = r.getString();
+    uint32_t bits = r.get<uint32_t>();
+    j.d.m_width = r.get<double>();
+    j.d.m_height = r.get<double>();
+    j.width = r.get<uint32_t>();
+    j.height = r.get<uint32_t>();
+    j.top = r.get<uint32_t>();
+    j.image_height = r.get<uint32_t>();
+    j.s.max_iter = r.get<uint32_t>();
+    uint8_t f = r.get<uint8_t>();
+    j.s.julia_re = r.get<double>();
+    j.s.julia_im = r.get<double>();
+    uint8_t mode = r.get<uint8_t>();
+    j.deflate = r.get<uint8_t>() != 0;
+
+    bigfloat ox;
+    bigfloat oy;
+    if(!r.ok || bits > MAX_OFFSET_BITS || !bigfloat::parse(x, bits, ox)
+            || !bigfloat::parse(y, bits, oy) || j.width < 2 || j.height < 2
+            || j.width > NODE_MAX_WIDTH
+            || static_cast<uint64_t>(j.width) * j.height > MAX_TILE_PIXELS
+            || static_cast<uint64_t>(j.top) + j.height > j.image_height
+            || j.s.max_iter == 0 || j.s.max_iter > NODE_MAX_ITER
+            || f > static_cast<uint8_t>(formula::julia3)
+            || mode > static_cast<uint8_t>(render_mode::subdivide))
+        return false;
+
+    j.s.fractal = static_cast<formula>(f);
+    j.s.mode = static_cast<render_mode>(mode);
+    setExactOffset(j.d, ox, oy);
+    return true;
+}
+
+// Iterates the tile and builds the reply, false if cancelled
+static bool renderTile(Mandelbrot& m, const tile_job& j,
+        std::vector<uint32_t>& pixels, message_writer& reply,
+        const std::atomic<bool>& closed) {
+    m.setMaxIter(j.s.max_iter);
+    m.setFormula(j.s.fractal);
+    m.setJuliaConstant(j.s.julia_re, j.s.julia_im);
+    m.setRenderMode(j.s.mode);
+    m.updateComplexDimensions(j.d);
+    m.setFrameWindow(j.top, j.image_height);
+
+    // The colors are not needed, only the iteration buffer
+    pixels.resize(static_cast<size_t>(j.width) * j.height);
+    argb_image image;
+    image.pixels = pixels.data();
+    image.width = j.width;
+    image.height = j.height;
+    image.stride = j.width;
+    while(!m.refreshMandelbrotTiled(image)) {
+        if(closed)
+            return false;
+    }
+
+    const iter_buffer& b = m.frameResults();
+    size_t n = static_cast<size_t>(j.width) * j.height * 4;
+    const uint8_t* it = reinterpret_cast<const uint8_t*>(
+            b.iterations.data());
+    const uint8_t* norms = reinterpret_cast<const uint8_t*>(b.norms.data());
+
+    reply.put(j.id);
+    reply.put(j.width);
+    reply.put(j.height);
+#ifdef MANDELBROT_ZLIB
+    if(j.deflate) {
+        uLongf size = compressBound(n);
+        std::vector<uint8_t> packed(size);
+        if(compress2(packed.data(), &size, it, n, Z_BEST_SPEED) == Z_OK
+                && size < n) {
+            reply.put<uint8_t>(1);
+            reply.put(static_cast<uint32_t>(size));
+            reply.data.insert(reply.data.end(), packed.begin(),
+                    packed.begin() + size);
+            reply.data.insert(reply.data.end(), norms, norms + n);
+            return true;
+        }
+    }
+#endif
+    reply.put<uint8_t>(0);
+    reply.put(static_cast<uint32_t>(n));
+    reply.data.insert(reply.data.end(), it, it + n);
+    reply.data.insert(reply.data.end(), norms, norms + n);
+    return true;
+}
+
+// Runs one coordinator's connection until it is closed. The reader answers
+// pings at once while the workers iterate the queued tiles.
+static void serveConnection(int fd, uint32_t threads) {
+    std::mutex send_lock;
+    std::mutex queue_lock;
+    std::condition_variable queued;
+    std::deque<tile_job> jobs;
+    std::atomic<bool> closed(false);
+
+    message_writer hello(message::hello);
+    hello.put(threads);
+    hello.put<uint32_t>(1);
+    hello.send(fd);
+
+    std::vector<std::thread> workers;
+    for(uint32_t t=0; t<threads; t++) {
+        workers.emplace_back([&]() {
+            Mandelbrot m(1);
+            m.setPreviewBlock(1);
+            m.setCancelCheck([&]() { return closed.load(); });
+            std::vector<uint32_t> pixels;
+            for(;;) {
+                tile_job j;
+                {
+                    std::unique_lock<std::mutex> l(queue_lock);
+                    queued.wait(l, [&]() { return closed || !jobs.empty(); });
+                    if(closed)
+                        return;
+                    j = jobs.front();
+                    jobs.pop_front();
+                }
+
+                message_writer reply(message::result);
+                if(!renderTile(m, j, pixels, reply, closed))
+                    return;
+                std::lock_guard<std::mutex> l(send_lock);
+                reply.send(fd);
+            }
+        });
+    }
+
+    std::vector<uint8_t> body;
+    while(readMessage(fd, body)) {
+        message_reader r(body.data() + 1, body.size() - 1);
+        message type = static_cast<message>(body.at(0));
+        if(type == message::ping) {
+            std::lock_guard<std::mutex> l(send_lock);
+            message_writer(message::pong).send(fd);
+        } else if(type == message::tile) {
+            tile_job j;
+            if(!parseTile(r, j))
+                break;
+            std::lock_guard<std::mutex> l(queue_lock);
+            jobs.push_back(j);
+            queued.notify_one();
+        } else {
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> l(queue_lock);
+        closed = true;
+    }
+    queued.notify_all();
+    for(std::thread& w : workers)
+        w.join();
+}
+
+RenderServer::RenderServer(): listen_fd(-1), closing(false) {
+}
+
+RenderServer::~RenderServer() {
+    if(listen_fd >= 0)
+        ::close(listen_fd);
+}
+
+bool RenderServer::listen(uint16_t port, const std::string& address) {
+    // Numeric addresses only, so the one listened on is the one given
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+    const char* host = address.empty() ? "127.0.0.1"
+            : address == "*" ? nullptr : address.c_str();
+    addrinfo* addrs;
+    if(getaddrinfo(host, std::to_string(port).c_str(), &hints, &addrs) != 0)
+        return false;
+
+    // The IPv6 wildcard address takes IPv4 connections as well where the
+    // system allows it, so it is tried first
+    int s = -1;
+    for(int family : {AF_INET6, AF_INET}) {
+        for(addrinfo* a = addrs; a && s < 0; a = a->ai_next) {
+            if(a->ai_family != family)
+                continue;
+            s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if(s < 0)
+                continue;
+            int on = 1;
+            int off = 0;
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if(family == AF_INET6)
+                setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+            if(bind(s, a->ai_addr, a->ai_addrlen) != 0
+                    || ::listen(s, 16) != 0) {
+                ::close(s);
+                s = -1;
+            }
+        }
+    }
+    freeaddrinfo(addrs);
+    listen_fd = s;
+    return s >= 0;
+}
+
+uint16_t RenderServer::port() const {
+    sockaddr_storage a{};
+    socklen_t size = sizeof(a);
+    if(getsockname(listen_fd, reinterpret_cast<sockaddr*>(&a), &size) != 0)
+        return 0;
+    if(a.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<sockaddr_in6*>(&a)->sin6_port);
+    return ntohs(reinterpret_cast<sockaddr_in*>(&a)->sin_port);
+}
+
+void RenderServer::serve(uint32_t threads) {
+    for(;;) {
+        int c = accept(listen_fd, nullptr, nullptr);
+        std::lock_guard<std::mutex> l(lock);
+        if(closing) {
+            if(c >= 0)
+                ::close(c);
+            break;
+        }
+        if(c < 0)
+            continue;
+
+        int on = 1;
+        setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        connections.insert(c);
+        std::thread([this, c, threads]() {
+            serveConnection(c, threads);
+            // Closed only once off the list, its number may be reused
+            std::lock_guard<std::mutex> l(lock);
+            connections.erase(c);
+            ::close(c);
+            idle.notify_all();
+        }).detach();
+    }
+
+    std::unique_lock<std::mutex> l(lock);
+    idle.wait(l, [&]() { return connections.empty(); });
+}
+
+void RenderServer::close() {
+    std::lock_guard<std::mutex> l(lock);
+    closing = true;
+    // Wakes accept and the connections' readers
+    shutdown(listen_fd, SHUT_RDWR);
+    for(int c : connections)
+        shutdown(c, SHUT_RDWR);
+}
+
+bool runRenderServer(const std::string& address, uint16_t port,
+        uint32_t threads) {
+    RenderServer s;
+    if(!s.listen(port, address))
+        return false;
+    s.serve(threads);
+    return true;
+}
+
+// Connects with a timeout, -1 if no address of the node answered
+static int connectNode(const render_node& n) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addrs;
+    if(getaddrinfo(n.host.c_str(), std::to_string(n.port).c_str(), &hints,
+            &addrs) != 0)
+        return -1;
+
+    int s = -1;
+    for(addrinfo* a = addrs; a && s < 0; a = a->ai_next) {
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(s < 0)
+            continue;
+
+        int flags = fcntl(s, F_GETFL);
+        fcntl(s, F_SETFL, flags | O_NONBLOCK);
+        bool ok = connect(s, a->ai_addr, a->ai_addrlen) == 0;
+        if(!ok && errno == EINPROGRESS) {
+            pollfd p = {s, POLLOUT, 0};
+            int err = 0;
+            socklen_t len = sizeof(err);
+            ok = poll(&p, 1, NODE_TIMEOUT_SECONDS * 1000) == 1
+                    && getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == 0
+                    && err == 0;
+        }
+        fcntl(s, F_SETFL, flags);
+        if(!ok) {
+            close(s);
+            s = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+
+    if(s >= 0) {
+        int on = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return s;
+}
+
+// Rows y to y + height - 1 of the image, rendered in a frame starting at
+// row top
+struct tile_rect {
+    uint32_t top;
+    uint32_t y;
+    uint32_t height;
+};
+
+static uint32_t frameRows(const tile_rect& r) {
+    return r.y + r.height - r.top;
+}
+
+// Rows of a tile, kept until the tiles above it are written
+struct tile_rows {
+    std::vector<int32_t> iterations;
+    std::vector<float> norms;
+};
+
+struct in_flight_tile {
+    double sent;
+    // Whether it was handed out again already
+    bool retried;
+};
+
+struct node_state {
+    render_node addr;
+    int fd = -1;
+    // Known once the server said hello
+    uint32_t threads = 0;
+    // Bytes received that do not make a whole message yet
+    std::vector<uint8_t> input;
+    std::map<uint64_t, in_flight_tile> in_flight;
+    double last_heard = 0;
+    double last_ping = 0;
+    // Time spent with tiles outstanding, up to busy_since if some are
+    double busy = 0;
+    double busy_since = 0;
+    uint64_t pixels = 0;
+
+    // Pixels per second iterated while it had work, 0 until known
+    double rate(double t) const {
+        double b = busy + (in_flight.empty() ? 0 : t - busy_since);
+        return pixels > 0 && b > 0 ? pixels / b : 0;
+    }
+
+    // Tiles kept outstanding: one per thread plus what the server gets
+    // through in PIPELINE_SECONDS, so faster servers queue more
+    uint32_t window(double t) const {
+        double ahead = rate(t) * PIPELINE_SECONDS / NODE_TILE_PIXELS;
+        return threads + std::min<uint32_t>(std::max(ahead, 1.0),
+                2 * threads);
+    }
+};
+
+static bool decodeResult(message_reader& r, uint64_t& id, uint32_t& width,
+        uint32_t& height, std::vector<uint8_t>& raw) {
+    id = r.get<uint64_t>();
+    width = r.get<uint32_t>();
+    height = r.get<uint32_t>();
+    bool deflated = r.get<uint8_t>() != 0;
+    uint32_t packed = r.get<uint32_t>();
+    size_t n = static_cast<size_t>(width) * height * 4;
+    if(!r.ok || r.left != packed + n)
+        return false;
+
+    raw.resize(2 * n);
+    std::memcpy(raw.data() + n, r.p + packed, n);
+    if(!deflated) {
+        std::memcpy(raw.data(), r.p, n);
+        return packed == n;
+    }
+#ifdef MANDELBROT_ZLIB
+    uLongf size = n;
+    return uncompress(raw.data(), &size, r.p, packed) == Z_OK && size == n;
+#else
+    return false;
+#endif
+}
+
+bool renderDistributed(const std::vector<render_node>& nodes,
+        const tile_settings& s, const m_dimension& d, uint32_t width,
+        uint32_t height, Coloring& coloring, ImageStream& out,
+        uint32_t band_pixels) {
+    if(width > NODE_MAX_WIDTH || s.max_iter > NODE_MAX_ITER) {
+        std::cerr << "render nodes take images up to " << NODE_MAX_WIDTH
+                  << " pixels wide and " << NODE_MAX_ITER << " iterations"
+                  << std::endl;
+        return false;
+    }
+
+    double t = now();
+    std::vector<node_state> cluster;
+    for(const render_node& n : nodes) {
+        node_state ns;
+        ns.addr = n;
+        ns.fd = connectNode(n);
+        ns.last_heard = t;
+        ns.last_ping = t;
+        if(ns.fd < 0)
+            std::cerr << "cannot connect to " << n.host << ":" << n.port
+                      << std::endl;
+        else
+            cluster.push_back(std::move(ns));
+    }
+
+    // As in renderStreamed, a single last row is rendered together with
+    // the one above it
+    uint32_t band = std::min(height, std::max(NODE_TILE_PIXELS / width, 2u));
+    std::vector<tile_rect> tiles;
+    for(uint32_t y0 = 0; y0 < height; y0 += band) {
+        tile_rect r;
+        r.y = y0;
+        r.height = std::min(band, height - y0);
+        r.top = r.height == 1 ? y0 - 1 : y0;
+        tiles.push_back(r);
+    }
+    // Tiles handed out ahead of the first incomplete one, which bounds the
+    // results held in memory
+    uint32_t ahead = std::max<uint32_t>(band_pixels
+            / (static_cast<uint64_t>(width) * band), 2);
+
+#ifdef MANDELBROT_ZLIB
+    uint8_t deflate = 1;
+#else
+    uint8_t deflate = 0;
+#endif
+    // Every tile is a band of the image's viewport
+    bigfloat x = exactOffsetX(d);
+    bigfloat y = exactOffsetY(d);
+    std::string x_str = x.toString();
+    std::string y_str = y.toString();
+    uint32_t bits = std::max(x.precision(), y.precision());
+    auto send = [&](node_state& n, uint64_t id) {
+        const tile_rect& r = tiles.at(id);
+        message_writer m(message::tile);
+        m.put(id);
+        m.putString(x_str);
+        m.putString(y_str);
+        m.put(bits);
+        m.put(d.m_width);
+        m.put(d.m_height);
+        m.put(width);
+        m.put(frameRows(r));
+        m.put(r.top);
+        m.put(height);
+        m.put(s.max_iter);
+        m.put(static_cast<uint8_t>(s.fractal));
+        m.put(s.julia_re);
+        m.put(s.julia_im);
+        m.put(static_cast<uint8_t>(s.mode));
+        m.put(deflate);
+        return m.send(n.fd);
+    };
+
+    // Tiles to hand out again, before the ones not handed out yet
+    std::deque<uint64_t> retry;
+    uint64_t next = 0;
+    std::vector<bool> done(tiles.size());
+    std::map<uint64_t, tile_rows> results;
+    uint64_t written = 0;
+
+    auto drop = [&](node_state& n) {
+        std::cerr << "lost render node " << n.addr.host << ":"
+                  << n.addr.port << std::endl;
+        close(n.fd);
+        n.fd = -1;
+        for(const auto& f : n.in_flight) {
+            if(!done.at(f.first))
+                retry.push_front(f.first);
+        }
+        n.in_flight.clear();
+    };
+
+    auto receive = [&](node_state& n, const std::vector<uint8_t>& body,
+            double t) {
+        message_reader r(body.data() + 1, body.size() - 1);
+        message type = static_cast<message>(body.at(0));
+        if(type == message::hello) {
+            n.threads = std::max(r.get<uint32_t>(), 1u);
+            if(r.get<uint32_t>() != 1) {
+                std::cerr << "render node " << n.addr.host << ":"
+                          << n.addr.port << " has another byte order"
+                          << std::endl;
+                return false;
+            }
+            return r.ok;
+        }
+        if(type == message::pong)
+            return true;
+        if(type != message::result)
+            return false;
+
+        uint64_t id;
+        uint32_t w;
+        uint32_t h;
+        std::vector<uint8_t> raw;
+        if(!decodeResult(r, id, w, h, raw) || id >= tiles.size()
+                || w != width || h != frameRows(tiles.at(id))
+                || !n.in_flight.erase(id))
+            return false;
+        n.pixels += static_cast<uint64_t>(w) * h;
+        if(n.in_flight.empty())
+            n.busy += t - n.busy_since;
+        // Late answers to tiles handed out twice
+        if(done.at(id))
+            return true;
+
+        done.at(id) = true;
+        // Only the rows below the ones rendered for the frame's sake
+        const tile_rect& tr = tiles.at(id);
+        size_t skip = static_cast<size_t>(tr.y - tr.top) * width;
+        size_t n_kept = static_cast<size_t>(tr.height) * width;
+        const int32_t* it = reinterpret_cast<const int32_t*>(raw.data())
+                + skip;
+        const float* norms = reinterpret_cast<const float*>(raw.data()
+                + raw.size() / 2) + skip;
+        tile_rows& row = results[id];
+        row.iterations.assign(it, it + n_kept);
+        row.norms.assign(norms, norms + n_kept);
+        return true;
+    };
+
+    auto closeAll = [&]() {
+        for(node_state& n : cluster) {
+            if(n.fd >= 0)
+                close(n.fd);
+        }
+    };
+
+    std::vector<uint32_t> pixels;
+    std::vector<uint8_t> buf(1 << 20);
+    while(written < tiles.size()) {
+        t = now();
+        for(node_state& n : cluster) {
+            if(n.fd < 0)
+                continue;
+            if(t - n.last_heard > NODE_TIMEOUT_SECONDS) {
+                drop(n);
+                continue;
+            }
+            if(t - n.last_ping >= HEARTBEAT_SECONDS) {
+                n.last_ping = t;
+                if(!message_writer(message::ping).send(n.fd)) {
+                    drop(n);
+                    continue;
+                }
+            }
+
+            // Tiles taking far longer than the node's throughput suggests
+            // were probably lost on the way
+            double rate = n.rate(t);
+            double expected = rate > 0 ? 4.0 * NODE_TILE_PIXELS
+                    * n.in_flight.size() / rate : 0;
+            for(auto& f : n.in_flight) {
+                if(!f.second.retried && !done.at(f.first)
+                        && t - f.second.sent > std::max(expected,
+                            TILE_TIMEOUT_SECONDS)) {
+                    f.second.retried = true;
+                    retry.push_back(f.first);
+                }
+            }
+        }
+
+        // Fastest nodes first, so that the last tiles go to them
+        std::vector<node_state*> order;
+        for(node_state& n : cluster) {
+            if(n.fd >= 0)
+                order.push_back(&n);
+        }
+        if(order.empty()) {
+            std::cerr << "no render node left" << std::endl;
+            closeAll();
+            return false;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                [&](const node_state* a, const node_state* b) {
+            return a->rate(t) > b->rate(t);
+        });
+
+        for(node_state* n : order) {
+            while(n->fd >= 0 && n->in_flight.size() < n->window(t)) {
+                uint64_t id;
+                while(!retry.empty() && (done.at(retry.front())
+                            || n->in_flight.count(retry.front())))
+                    retry.pop_front();
+                if(!retry.empty()) {
+                    id = retry.front();
+                    retry.pop_front();
+                } else if(next < tiles.size()
+                        && next < written + ahead) {
+                    id = next++;
+                } else {
+                    break;
+                }
+
+                if(!send(*n, id)) {
+                    retry.push_front(id);
+                    drop(*n);
+                    break;
+                }
+                if(n->in_flight.empty())
+                    n->busy_since = t;
+                n->in_flight[id] = {t, false};
+            }
+        }
+
+        std::vector<pollfd> fds;
+        for(node_state* n : order)
+            fds.push_back({n->fd, POLLIN, 0});
+        poll(fds.data(), fds.size(), HEARTBEAT_SECONDS * 1000 / 4);
+        t = now();
+        for(size_t i=0; i<fds.size(); i++) {
+            node_state& n = *order.at(i);
+            if(!(fds.at(i).revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            ssize_t got = recv(n.fd, buf.data(), buf.size(), 0);
+            if(got <= 0) {
+                if(got < 0 && errno == EINTR)
+                    continue;
+                drop(n);
+                continue;
+            }
+            n.last_heard = t;
+            n.input.insert(n.input.end(), buf.begin(), buf.begin() + got);
+
+            size_t used = 0;
+            bool ok = true;
+            while(ok && n.input.size() - used >= 4) {
+                uint32_t size;
+                std::memcpy(&size, n.input.data() + used, 4);
+                if(size == 0 || size > MAX_MESSAGE) {
+                    ok = false;
+                    break;
+                }
+                if(n.input.size() - used - 4 < size)
+                    break;
+                std::vector<uint8_t> body(n.input.begin() + used + 4,
+                        n.input.begin() + used + 4 + size);
+                used += 4 + size;
+                ok = receive(n, body, t);
+            }
+            n.input.erase(n.input.begin(), n.input.begin() + used);
+            if(!ok)
+                drop(n);
+        }
+
+        // Colorizes and writes the tiles in order as far as they are back
+        for(auto r = results.find(written); r != results.end();
+                r = results.find(written)) {
+            tile_rows& row = r->second;
+            uint32_t row_height = row.iterations.size() / width;
+            pixels.resize(row.iterations.size());
+            coloring.getColors(row.iterations.data(), row.norms.data(),
+                    pixels.data(), pixels.size(), kernels());
+
+            argb_image image;
+            image.pixels = pixels.data();
+            image.width = width;
+            image.height = row_height;
+            image.stride = width;
+            if(!out.writeRows(image)) {
+                closeAll();
+                return false;
+            }
+            results.erase(r);
+            written++;
+        }
+    }
+
+    closeAll();
+    return out.finish();
+}
@@ -0,0 +1,108 @@
+#ifndef DISTRIBUTED_RENDER_H
+#define DISTRIBUTED_RENDER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "coloring.h"
+#include "dimension.h"
+#include "formula.h"
+#include "image_writer.h"
+#include "mandelbrot.h"
+#include "streamed_render.h"
+
+// Rendering spread over several machines. Render servers iterate tiles of
+// a frame for a coordinator and send back their iteration counts and
+// norms; the coordinator shards the image over the servers, colorizes the
+// tiles and writes the image band by band like renderStreamed. They talk
+// over TCP in the host byte order, so a cluster must share it; the messages
+// are described in distributed_render.cpp. Servers take no credentials,
+// they should only listen where the coordinators alone can reach them.
+
+// Pixels of the tiles handed out. Tiles are bands of full rows, frame
+// windows like the ones of renderStreamed, so the image is the one
+// renderStreamed gives.
+constexpr uint32_t NODE_TILE_PIXELS = 1 << 14;
+// Limits of the frames renderDistributed takes, which servers also hold
+// the tiles they are sent to. Tiles are at least two rows, so up to
+// 2 * NODE_MAX_WIDTH pixels.
+constexpr uint32_t NODE_MAX_WIDTH = 2 * NODE_TILE_PIXELS;
+constexpr uint32_t NODE_MAX_ITER = 1 << 24;
+// Interval of the pings the coordinator sends every server
+constexpr double HEARTBEAT_SECONDS = 0.5;
+// A server not heard from for this long is dropped and its tiles go to the
+// others
+constexpr double NODE_TIMEOUT_SECONDS = 5;
+// Tiles outstanding for this long, or four times as long as the server's
+// throughput suggests if that is more, are handed out again
+constexpr double TILE_TIMEOUT_SECONDS = 10;
+
+struct render_node {
+    std::string host;
+    uint16_t port;
+};
+
+// Parses a list such as "localhost:7000,10.0.0.2:7000"
+bool parseNodes(const std::string& s, std::vector<render_node>& nodes);
+
+// Everything the servers need to iterate a tile besides its viewport
+struct tile_settings {
+    uint32_t max_iter = 1000;
+    formula fractal = formula::mandelbrot;
+    double julia_re = -0.8;
+    double julia_im = 0.156;
+    render_mode mode = render_mode::full;
+};
+
+// Render server that can be stopped, e.g. to run several in one process
+class RenderServer
+{
+public:
+    RenderServer();
+    // Must not be serving any more
+    ~RenderServer();
+
+    RenderServer(const RenderServer&) = delete;
+    RenderServer& operator=(const RenderServer&) = delete;
+
+    // Listens on port of address, 0 for one the system picks. An empty
+    // address is the IPv4 loopback one, "*" every interface. False if that
+    // fails.
+    bool listen(uint16_t port, const std::string& address = std::string());
+    // Port listened on
+    uint16_t port() const;
+    // Serves coordinators, each connection iterating up to threads tiles at
+    // once, until close is called. Returns once every connection is done.
+    void serve(uint32_t threads);
+    // Stops serve and drops the connections, like a server that went away.
+    // Safe to call from any thread.
+    void close();
+
+private:
+    int listen_fd;
+    std::mutex lock;
+    std::condition_variable idle;
+    std::set<int> connections;
+    bool closing;
+};
+
+// Serves coordinators on port of address as RenderServer::listen takes
+// it, each connection iterating up to threads tiles at once. Returns false
+// if the port cannot be listened on, else it runs until the process ends.
+bool runRenderServer(const std::string& address, uint16_t port,
+        uint32_t threads);
+
+// renderStreamed on the render servers of nodes. Tiles are queued to each
+// server in proportion to the throughput it has shown, servers that stop
+// answering are dropped and tiles that do not come back are retried on
+// another one. Fails if no server is left, out cannot be written or the
+// frame is beyond NODE_MAX_WIDTH or NODE_MAX_ITER.
+bool renderDistributed(const std::vector<render_node>& nodes,
+        const tile_settings& s, const m_dimension& d, uint32_t width,
+        uint32_t height, Coloring& coloring, ImageStream& out,
+        uint32_t band_pixels = STREAM_BAND_PIXELS);
+
+#endif // DISTRIBUTED_RENDER_H
@@ -0,0 +1,34 @@
+#include <cmath>
+#include "formula.h"
+
+static const formula_info FORMULAS[FORMULA_COUNT] = {
+    {"mandelbrot", 2, false, false},
+    {"multibrot3", 3, false, false},
+    {"multibrot4", 4, false, false},
+    {"burning_ship", 2, false, true},
+    {"julia", 2, true, false},
+    {"julia3", 3, true, false}
+};
+
+const formula_info& formulaInfo(formula f) {
+    return FORMULAS[static_cast<uint32_t>(f)];
+}
+
+bool parseFormula(const std::string& s, formula& f) {
+    for(uint32_t i=0; i<FORMULA_COUNT; i++) {
+        if(s == FORMULAS[i].name) {
+            f = static_cast<formula>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+double quadraticNorm(double norm, uint32_t power) {
+    // The smooth count it + 1 - log_d(log2 |z|) of degree d, rewritten as
+    // it + 1 - log2(log2 |z'|)
+    if(power == 2)
+        return norm;
+    double log_z = std::log2(norm) / 2;
+    return std::exp2(2 * std::pow(log_z, 1 / std::log2(power)));
+}
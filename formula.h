@@ -0,0 +1,42 @@
+#ifndef FORMULA_H
+#define FORMULA_H
+
+#include <cstdint>
+#include <string>
+
+// Escape-time formulas. Every kernel table holds one kernel per formula,
+// each compiled for it alone, so the iteration has no formula switches.
+enum class formula {
+    // z^2 + c
+    mandelbrot,
+    // z^3 + c, z^4 + c
+    multibrot3,
+    multibrot4,
+    // (|Re z| + i |Im z|)^2 + c
+    burning_ship,
+    // z^2 + k, z^3 + k for a fixed k, starting at the pixel
+    julia,
+    julia3
+};
+
+constexpr uint32_t FORMULA_COUNT = 6;
+
+struct formula_info {
+    const char* name;
+    // Degree of the polynomial
+    uint32_t power;
+    bool julia;
+    // Iterates on the absolute values of the parts of z
+    bool burning_ship;
+};
+
+const formula_info& formulaInfo(formula f);
+
+bool parseFormula(const std::string& s, formula& f);
+
+// Maps |z|^2 at escape of a formula of the given power to the |z|^2 a
+// quadratic one would have escaped with at the same smooth iteration
+// count, which is what the colorings assume.
+double quadraticNorm(double norm, uint32_t power);
+
+#endif // FORMULA_H
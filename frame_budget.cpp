@@ -0,0 +1,42 @@
+#include <algorithm>
+#include "frame_budget.h"
+
+FrameBudget::FrameBudget(double fps): block(16), max_iter(0), iter_cap(0) {
+    setTargetFrameRate(fps);
+}
+
+void FrameBudget::setTargetFrameRate(double fps) {
+    frame_time = 1 / std::max(fps, 1.0);
+}
+
+void FrameBudget::setMaxIter(uint32_t it) {
+    max_iter = it;
+    iter_cap = it;
+}
+
+void FrameBudget::update(double seconds) {
+    if(seconds > frame_time) {
+        if(block < MAX_BLOCK)
+            block *= 2;
+        else
+            iter_cap = std::max(iter_cap / 2, std::min(max_iter, MIN_ITER));
+        return;
+    }
+
+    // Doubling the cap at most doubles the time, halving the block size
+    // quadruples the pixels
+    if(iter_cap < max_iter) {
+        if(2 * seconds < HEADROOM * frame_time)
+            iter_cap = std::min(iter_cap * 2, max_iter);
+    } else if(block > 1 && 4 * seconds < HEADROOM * frame_time) {
+        block /= 2;
+    }
+}
+
+uint32_t FrameBudget::previewBlock() const {
+    return block;
+}
+
+uint32_t FrameBudget::iterationCap() const {
+    return iter_cap;
+}
@@ -0,0 +1,42 @@
+#ifndef FRAME_BUDGET_H
+#define FRAME_BUDGET_H
+
+#include <cstdint>
+
+// Feedback controller for interactive frames. It is fed the time the first
+// refinement pass of each frame took and steers the block size of that pass
+// and an iteration cap so the pass fits the frame time of the target rate:
+// coarser blocks first, fewer iterations once the blocks are at their
+// largest. With time to spare it gives back iterations first, then
+// resolution.
+class FrameBudget
+{
+public:
+    // Largest block size of the preview pass
+    const uint32_t MAX_BLOCK = 32;
+    // Lowest iteration cap
+    const uint32_t MIN_ITER = 64;
+    // Share of the frame time a finer setting must be expected to stay
+    // under, so the controller does not oscillate between two settings
+    const double HEADROOM = 0.8;
+
+    explicit FrameBudget(double fps = 30);
+
+    void setTargetFrameRate(double fps);
+    // Full iteration limit, the cap never exceeds it
+    void setMaxIter(uint32_t it);
+    // Feeds the time of one preview pass
+    void update(double seconds);
+
+    uint32_t previewBlock() const;
+    // Iteration limit for interactive frames
+    uint32_t iterationCap() const;
+
+private:
+    double frame_time;
+    uint32_t block;
+    uint32_t max_iter;
+    uint32_t iter_cap;
+};
+
+#endif // FRAME_BUDGET_H
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "frame_buffer.h"
+
+FrameBuffer::FrameBuffer(uint32_t width, uint32_t height) {
+    const uint32_t line = FRAME_ALIGN / sizeof(uint32_t);
+    frame.width = width;
+    frame.height = height;
+    frame.stride = (width + line - 1) / line * line;
+
+    // Room to move the start up to the next cache line
+    storage.resize(static_cast<size_t>(frame.stride) * height + line);
+    uintptr_t p = reinterpret_cast<uintptr_t>(storage.data());
+    frame.pixels = storage.data()
+            + (FRAME_ALIGN - p % FRAME_ALIGN) % FRAME_ALIGN / sizeof(uint32_t);
+}
+
+argb_image FrameBuffer::view(uint32_t x, uint32_t y, uint32_t w,
+        uint32_t h) const {
+    argb_image v = frame;
+    v.pixels = frame.line(y) + x;
+    v.width = w;
+    v.height = h;
+    return v;
+}
+
+void FrameBuffer::fill(uint32_t argb) {
+    for(uint32_t y = 0; y < frame.height; y++)
+        std::fill_n(frame.line(y), frame.width, argb);
+}
+
+void FrameBuffer::copyFrom(const argb_image& src, uint32_t x, uint32_t y) {
+    if(x >= frame.width || y >= frame.height)
+        return;
+
+    uint32_t w = std::min(src.width, frame.width - x);
+    uint32_t h = std::min(src.height, frame.height - y);
+    for(uint32_t r = 0; r < h; r++)
+        std::memcpy(frame.line(y + r) + x, src.line(r),
+                w * sizeof(uint32_t));
+}
+
+void FrameBuffer::scroll(int32_t dx, int32_t dy, uint32_t argb) {
+    uint32_t adx = std::min<uint32_t>(std::abs(dx), frame.width);
+    uint32_t ady = std::min<uint32_t>(std::abs(dy), frame.height);
+    uint32_t n = frame.width - adx;
+    uint32_t from = dx > 0 ? adx : 0;
+    uint32_t to = dx > 0 ? 0 : adx;
+    auto row = [&](uint32_t dst, uint32_t src) {
+        std::memmove(frame.line(dst) + to, frame.line(src) + from,
+                n * sizeof(uint32_t));
+        std::fill_n(frame.line(dst) + (dx > 0 ? n : 0), adx, argb);
+    };
+
+    if(dy > 0) {
+        for(uint32_t y = 0; y + ady < frame.height; y++)
+            row(y, y + ady);
+        for(uint32_t y = frame.height - ady; y < frame.height; y++)
+            std::fill_n(frame.line(y), frame.width, argb);
+    } else {
+        for(uint32_t y = frame.height; y-- > ady;)
+            row(y, y - ady);
+        for(uint32_t y = 0; y < ady; y++)
+            std::fill_n(frame.line(y), frame.width, argb);
+    }
+}
+
+std::unique_ptr<FrameBuffer> FramePool::take(uint32_t width,
+        uint32_t height) {
+    for(auto it = spare.rbegin(); it != spare.rend(); ++it) {
+        if((*it)->width() == width && (*it)->height() == height) {
+            std::unique_ptr<FrameBuffer> f = std::move(*it);
+            spare.erase(std::next(it).base());
+            return f;
+        }
+    }
+    return std::unique_ptr<FrameBuffer>(new FrameBuffer(width, height));
+}
+
+void FramePool::give(std::unique_ptr<FrameBuffer> f) {
+    if(!f)
+        return;
+
+    spare.push_back(std::move(f));
+    if(spare.size() > FRAME_POOL_SIZE)
+        spare.erase(spare.begin());
+}
@@ -0,0 +1,59 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "argb_image.h"
+
+// Rows of frame buffers start on a cache line of this many bytes, so the
+// colorizing workers of neighbouring tiles never share one
+constexpr uint32_t FRAME_ALIGN = 64;
+// Free frame buffers a FramePool keeps
+constexpr uint32_t FRAME_POOL_SIZE = 4;
+
+// ARGB32 frame in one block of memory, every row padded to a whole number
+// of cache lines. Workers draw into views of it, which do not own pixels.
+class FrameBuffer
+{
+public:
+    FrameBuffer(uint32_t width, uint32_t height);
+
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    uint32_t width() const { return frame.width; }
+    uint32_t height() const { return frame.height; }
+    // The whole frame
+    const argb_image& image() const { return frame; }
+    // Pixels x ... x + w - 1 of rows y ... y + h - 1
+    argb_image view(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const;
+
+    void fill(uint32_t argb);
+    // Copies src to pixel (x, y) on, as far as it fits
+    void copyFrom(const argb_image& src, uint32_t x = 0, uint32_t y = 0);
+    // Moves the contents so that pixel (x, y) receives what was at
+    // (x + dx, y + dy), pixels shifted in from outside get argb
+    void scroll(int32_t dx, int32_t dy, uint32_t argb);
+
+private:
+    std::vector<uint32_t> storage;
+    argb_image frame;
+};
+
+// Frame buffers no longer in use, kept for the next frame of their size so
+// that swapping buffers or resizing back and forth does not allocate. The
+// least recently returned ones go first. Not thread safe.
+class FramePool
+{
+public:
+    // A free buffer of that size, or a new one. Its contents are undefined.
+    std::unique_ptr<FrameBuffer> take(uint32_t width, uint32_t height);
+    void give(std::unique_ptr<FrameBuffer> f);
+
+private:
+    // Most recently returned last
+    std::vector<std::unique_ptr<FrameBuffer>> spare;
+};
+
+#endif // FRAME_BUFFER_H
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <array>
+#include <vector>
+#include "image_writer.h"
+
+#ifdef MANDELBROT_ZLIB
+#include <zlib.h>
+#endif
+
+static void putBE32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t n) {
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> t;
+        for(uint32_t i=0; i<256; i++) {
+            uint32_t c = i;
+            for(uint32_t k=0; k<8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    for(size_t i=0; i<n; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+ImageStream::~ImageStream() {
+}
+
+// RGB rows behind a zlib stream, split into one IDAT chunk per band.
+// Without zlib the stream is made of stored deflate blocks, which every
+// decoder reads but which are not compressed.
+class PngStream: public ImageStream
+{
+public:
+    PngStream(const std::string& path, uint32_t width, uint32_t height);
+    ~PngStream();
+
+    bool ok() const;
+    bool writeRows(const argb_image& band) override;
+    bool finish() override;
+
+private:
+    std::vector<uint8_t> rows;
+    std::vector<uint8_t> out;
+#ifdef MANDELBROT_ZLIB
+    z_stream zs;
+#else
+    uint32_t adler_a;
+    uint32_t adler_b;
+#endif
+
+    void putChunk(const char* type, const std::vector<uint8_t>& data);
+    void compress(bool last);
+};
+
+PngStream::PngStream(const std::string& path, uint32_t width,
+        uint32_t height) {
+    file.open(path, std::ios::binary);
+
+    const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    // 8 bit RGB, no interlacing
+    std::vector<uint8_t> header;
+    putBE32(header, width);
+    putBE32(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    putChunk("IHDR", header);
+
+#ifdef MANDELBROT_ZLIB
+    zs = z_stream();
+    deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+#else
+    adler_a = 1;
+    adler_b = 0;
+    out = {0x78, 0x01};
+#endif
+}
+
+PngStream::~PngStream() {
+#ifdef MANDELBROT_ZLIB
+    deflateEnd(&zs);
+#endif
+}
+
+bool PngStream::ok() const {
+    return file.good();
+}
+
+void PngStream::putChunk(const char* type, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> chunk;
+    putBE32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBE32(chunk, crc32Update(0xffffffff, chunk.data() + 4,
+                chunk.size() - 4) ^ 0xffffffff);
+    file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+void PngStream::compress(bool last) {
+#ifdef MANDELBROT_ZLIB
+    zs.next_in = rows.data();
+    zs.avail_in = rows.size();
+    int flush = last ? Z_FINISH : Z_NO_FLUSH;
+    do {
+        size_t used = out.size();
+        out.resize(used + 65536);
+        zs.next_out = out.data() + used;
+        zs.avail_out = 65536;
+        deflate(&zs, flush);
+        out.resize(out.size() - zs.avail_out);
+    } while(zs.avail_in > 0 || (last && zs.avail_out == 0));
+#else
+    size_t pos = 0;
+    do {
+        uint32_t n = std::min<size_t>(rows.size() - pos, 65535);
+        out.push_back(last && pos + n == rows.size() ? 1 : 0);
+        out.push_back(n);
+        out.push_back(n >> 8);
+        out.push_back(~n);
+        out.push_back(~n >> 8);
+        out.insert(out.end(), rows.begin() + pos, rows.begin() + pos + n);
+        pos += n;
+    } while(pos < rows.size());
+
+    for(uint8_t v : rows) {
+        adler_a = (adler_a + v) % 65521;
+        adler_b = (adler_b + adler_a) % 65521;
+    }
+    if(last)
+        putBE32(out, (adler_b << 16) | adler_a);
+#endif
+
+    if(!out.empty())
+        putChunk("IDAT", out);
+    out.clear();
+}
+
+bool PngStream::writeRows(const argb_image& band) {
+    // Every row starts with filter type 0 (none)
+    rows.clear();
+    for(uint32_t y=0; y<band.height; y++) {
+        const uint32_t* line = band.line(y);
+        rows.push_back(0);
+        for(uint32_t x=0; x<band.width; x++) {
+            rows.push_back(line[x] >> 16);
+            rows.push_back(line[x] >> 8);
+            rows.push_back(line[x]);
+        }
+    }
+    compress(false);
+    return file.good();
+}
+
+bool PngStream::finish() {
+    rows.clear();
+    compress(true);
+    putChunk("IEND", std::vector<uint8_t>());
+    file.close();
+    return !file.fail();
+}
+
+class PpmStream: public ImageStream
+{
+public:
+    PpmStream(const std::string& path, uint32_t width, uint32_t height);
+
+    bool ok() const;
+    bool writeRows(const argb_image& band) override;
+    bool finish() override;
+
+private:
+    std::vector<uint8_t> row;
+};
+
+PpmStream::PpmStream(const std::string& path, uint32_t width,
+        uint32_t height): row(static_cast<size_t>(width) * 3) {
+    file.open(path, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+}
+
+bool PpmStream::ok() const {
+    return file.good();
+}
+
+bool PpmStream::writeRows(const argb_image& band) {
+    for(uint32_t y=0; y<band.height; y++) {
+        const uint32_t* line = band.line(y);
+        for(uint32_t x=0; x<band.width; x++) {
+            row[3 * x] = line[x] >> 16;
+            row[3 * x + 1] = line[x] >> 8;
+            row[3 * x + 2] = line[x];
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+    return file.good();
+}
+
+bool PpmStream::finish() {
+    file.close();
+    return !file.fail();
+}
+
+class RawStream: public ImageStream
+{
+public:
+    RawStream(const std::string& path);
+
+    bool ok() const;
+    bool writeRows(const argb_image& band) override;
+    bool finish() override;
+};
+
+RawStream::RawStream(const std::string& path) {
+    file.open(path, std::ios::binary);
+}
+
+bool RawStream::ok() const {
+    return file.good();
+}
+
+bool RawStream::writeRows(const argb_image& band) {
+    for(uint32_t y=0; y<band.height; y++)
+        file.write(reinterpret_cast<const char*>(band.line(y)),
+                band.width * sizeof(uint32_t));
+    return file.good();
+}
+
+bool RawStream::finish() {
+    file.close();
+    return !file.fail();
+}
+
+image_format formatFromPath(const std::string& path) {
+    size_t dot = path.rfind('.');
+    image_format format = image_format::png;
+    if(dot != std::string::npos)
+        parseImageFormat(path.substr(dot + 1), format);
+    return format;
+}
+
+bool parseImageFormat(const std::string& name, image_format& format) {
+    if(name == "png")
+        format = image_format::png;
+    else if(name == "ppm")
+        format = image_format::ppm;
+    else if(name == "raw")
+        format = image_format::raw;
+    else
+        return false;
+    return true;
+}
+
+std::unique_ptr<ImageStream> openImageStream(const std::string& path,
+        uint32_t width, uint32_t height, image_format format) {
+    switch(format) {
+    case image_format::png: {
+        std::unique_ptr<PngStream> s(new PngStream(path, width, height));
+        return s->ok() ? std::move(s) : nullptr;
+    }
+    case image_format::ppm: {
+        std::unique_ptr<PpmStream> s(new PpmStream(path, width, height));
+        return s->ok() ? std::move(s) : nullptr;
+    }
+    case image_format::raw: {
+        std::unique_ptr<RawStream> s(new RawStream(path));
+        return s->ok() ? std::move(s) : nullptr;
+    }
+    }
+    return nullptr;
+}
+
+bool writeImage(const std::string& path, const argb_image& image,
+        image_format format) {
+    std::unique_ptr<ImageStream> s = openImageStream(path, image.width,
+            image.height, format);
+    return s && s->writeRows(image) && s->finish();
+}
@@ -0,0 +1,46 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "argb_image.h"
+
+enum class image_format {
+    png,
+    // Binary portable pixmap (P6)
+    ppm,
+    // The ARGB32 pixels as they are in memory, row after row
+    raw
+};
+
+// Writes an image of known size band by band from the top, so images far
+// larger than memory can be encoded while they are rendered.
+class ImageStream
+{
+public:
+    virtual ~ImageStream();
+
+    // Appends the rows of band, which is as wide as the image
+    virtual bool writeRows(const argb_image& band) = 0;
+    // Completes the file once all rows are written
+    virtual bool finish() = 0;
+
+protected:
+    std::ofstream file;
+};
+
+// Picks the format from the extension of path, png if it has none known
+image_format formatFromPath(const std::string& path);
+bool parseImageFormat(const std::string& name, image_format& format);
+
+// Creates the file and writes the header, nullptr if that failed
+std::unique_ptr<ImageStream> openImageStream(const std::string& path,
+        uint32_t width, uint32_t height, image_format format);
+
+// Writes the whole image, returns false if the file could not be written
+bool writeImage(const std::string& path, const argb_image& image,
+        image_format format);
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,76 @@
+#ifndef ITER_BUFFER_H
+#define ITER_BUFFER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Escape-time results of a frame in row-major order. Pixels that did not
+// escape hold INT32_MIN as iteration count and 0 as norm; the others hold
+// |z|^2 at escape.
+struct iter_buffer {
+    // Grain of pixels nothing is known about yet
+    static constexpr uint8_t GRAIN_UNKNOWN = 255;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<int32_t> iterations;
+    std::vector<float> norms;
+    // Side length of the block a pixel's value stands in for: 1 once the
+    // pixel itself was iterated, larger while it holds a preview value.
+    std::vector<uint8_t> grain;
+
+    void resize(uint32_t w, uint32_t h) {
+        width = w;
+        height = h;
+        iterations.resize(static_cast<size_t>(w) * h);
+        norms.resize(static_cast<size_t>(w) * h);
+        grain.resize(static_cast<size_t>(w) * h, GRAIN_UNKNOWN);
+    }
+
+    int32_t* iterRow(uint32_t y) {
+        return iterations.data() + static_cast<size_t>(y) * width;
+    }
+
+    float* normRow(uint32_t y) {
+        return norms.data() + static_cast<size_t>(y) * width;
+    }
+
+    uint8_t* grainRow(uint32_t y) {
+        return grain.data() + static_cast<size_t>(y) * width;
+    }
+
+    // Moves the contents so that pixel (x, y) receives what was at
+    // (x + dx, y + dy). Pixels shifted in from outside become unknown.
+    void scroll(int32_t dx, int32_t dy) {
+        uint32_t ady = std::min<uint32_t>(std::abs(dy), height);
+        if(dy > 0) {
+            for(uint32_t y = 0; y + ady < height; y++)
+                scrollRow(y, y + ady, dx);
+            std::fill(grainRow(height - ady), grain.data() + grain.size(),
+                    GRAIN_UNKNOWN);
+        } else {
+            for(uint32_t y = height; y-- > ady;)
+                scrollRow(y, y - ady, dx);
+            std::fill(grainRow(0), grainRow(ady), GRAIN_UNKNOWN);
+        }
+    }
+
+private:
+    void scrollRow(uint32_t dst, uint32_t src, int32_t dx) {
+        uint32_t adx = std::min<uint32_t>(std::abs(dx), width);
+        uint32_t n = width - adx;
+        uint32_t from = dx > 0 ? adx : 0;
+        uint32_t to = dx > 0 ? 0 : adx;
+        std::memmove(iterRow(dst) + to, iterRow(src) + from,
+                n * sizeof(int32_t));
+        std::memmove(normRow(dst) + to, normRow(src) + from,
+                n * sizeof(float));
+        std::memmove(grainRow(dst) + to, grainRow(src) + from, n);
+        std::fill_n(grainRow(dst) + (dx > 0 ? n : 0), adx, GRAIN_UNKNOWN);
+    }
+};
+
+#endif // ITER_BUFFER_H
@@ -0,0 +1,78 @@
+#include <cstdlib>
+#include <iostream>
+#include "kernels_impl.h"
+
+const kernel_table& kernelTable_scalar() {
+    static const kernel_table t = {isa::scalar, "scalar", vec1d::width,
+            formulaKernels<vec1d>(), nullptr, nullptr, interpolateColor};
+    return t;
+}
+
+static bool cpuSupports(isa level) {
+    // The checks include the operating system saving the vector registers
+    switch(level) {
+    case isa::scalar:
+    case isa::sse2:
+        return true;
+    case isa::avx2:
+        return __builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma");
+    case isa::avx512:
+        // Skylake-SP subset, masks compile far better with VL and BW
+        return __builtin_cpu_supports("avx512f")
+                && __builtin_cpu_supports("avx512dq")
+                && __builtin_cpu_supports("avx512bw")
+                && __builtin_cpu_supports("avx512vl")
+                && __builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma");
+    }
+    return false;
+}
+
+const kernel_table* kernelsFor(isa level) {
+    if(!cpuSupports(level))
+        return nullptr;
+
+    switch(level) {
+    case isa::scalar:
+        return &kernelTable_scalar();
+    case isa::sse2:
+        return &kernelTable_sse2();
+    case isa::avx2:
+        return &kernelTable_avx2();
+    case isa::avx512:
+        return &kernelTable_avx512();
+    }
+    return nullptr;
+}
+
+bool parseIsa(const std::string& s, isa& level) {
+    static const char* const names[] = {"scalar", "sse2", "avx2", "avx512"};
+    for(uint32_t l=0; l<4; l++) {
+        if(s == names[l]) {
+            level = static_cast<isa>(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+static const kernel_table& selectKernels() {
+    isa cap = isa::avx512;
+    const char* env = std::getenv("MANDELBROT_ISA");
+    if(env && !parseIsa(env, cap))
+        std::cerr << "unknown MANDELBROT_ISA " << env << ", ignored"
+                  << std::endl;
+
+    for(int32_t l = static_cast<int32_t>(cap); l >= 0; l--) {
+        const kernel_table* t = kernelsFor(static_cast<isa>(l));
+        if(t)
+            return *t;
+    }
+    return kernelTable_scalar();
+}
+
+const kernel_table& kernels() {
+    static const kernel_table& t = selectKernels();
+    return t;
+}
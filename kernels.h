@@ -0,0 +1,89 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstdint>
+#include <string>
+#include "coloring.h"
+#include "formula.h"
+
+// Vectorized kernels are compiled once per instruction set, each in a
+// translation unit of its own, and one table of them is picked at run time
+// from the CPU's features. The rest of the engine is built for the
+// baseline x86-64 CPU and only calls them through the table.
+
+enum class isa {
+    // Plain C++, one pixel at a time
+    scalar,
+    sse2,
+    // AVX2 with FMA
+    avx2,
+    avx512
+};
+
+// Most pixels any kernel handles per call
+constexpr uint32_t MAX_LANES = 8;
+
+// Inputs of the escape-time kernels besides the coordinates
+struct escape_params {
+    uint32_t max_iter;
+    double bail_out;
+    double period_eps;
+    // c of the Julia formulas
+    double julia_re;
+    double julia_im;
+    // If not null, receive z of the lanes still iterating at max_iter and
+    // NaN for the others, in structure-of-arrays layout
+    double* z_re;
+    double* z_im;
+    // Iteration the orbits continue at from the z in z_re and z_im, 0 to
+    // start them at the pixels
+    uint32_t start_iter;
+};
+
+// Iterates lanes pixels at once, coordinates in structure-of-arrays layout.
+// Results as Mandelbrot::calcMandelbrot returns them.
+using escape_kernel = void (*)(const double* real, const double* imag,
+        const escape_params& p, int32_t* it, double* norm);
+
+struct kernel_table {
+    isa level;
+    const char* name;
+    // Pixels per call of the escape-time kernels
+    uint32_t lanes;
+
+    // One kernel per formula, indexed by it
+    const escape_kernel* escape_time;
+    // The mandelbrot kernel on double-double coordinates hi + lo. Needs
+    // FMA, null where the instruction set lacks it.
+    void (*escape_time_dd)(const double* real_hi, const double* real_lo,
+            const double* imag_hi, const double* imag_lo, uint32_t max_iter,
+            double bail_out, int32_t* it, double* norm);
+    // Smooth palette lookup of SmoothColoring::getColors. Colorizes a
+    // prefix of the n pixels and returns its length, the caller does the
+    // rest. Null if the instruction set has no gather.
+    uint32_t (*palette_colors)(const int32_t* iterations,
+            const float* normals, uint32_t* argb, uint32_t n,
+            const uint32_t* palette, uint32_t palette_size,
+            uint32_t n_gradient);
+    // c1 + (c2 - c1) * r
+    rgb_color (*interpolate_color)(const rgb_color& c1, const rgb_color& c2,
+            double r);
+};
+
+// Kernels of the best instruction set the CPU supports, chosen on first
+// use. MANDELBROT_ISA=scalar|sse2|avx2|avx512 in the environment caps the
+// choice, e.g. to test the fallbacks on a newer machine.
+const kernel_table& kernels();
+
+// Kernels for level, null if the CPU does not support it
+const kernel_table* kernelsFor(isa level);
+
+bool parseIsa(const std::string& s, isa& level);
+
+// Tables of the per instruction set translation units
+const kernel_table& kernelTable_scalar();
+const kernel_table& kernelTable_sse2();
+const kernel_table& kernelTable_avx2();
+const kernel_table& kernelTable_avx512();
+
+#endif // KERNELS_H
@@ -0,0 +1,9 @@
+#include "kernels_impl.h"
+
+// Built with -mavx2 -mfma
+const kernel_table& kernelTable_avx2() {
+    static const kernel_table t = {isa::avx2, "avx2", vec4d::width,
+            formulaKernels<vec4d>(), escapeTimeDD<vec4d>, paletteColors_avx2,
+            interpolateColor_avx2};
+    return t;
+}
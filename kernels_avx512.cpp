@@ -0,0 +1,10 @@
+#include "kernels_impl.h"
+
+// Built with AVX-512 F, DQ, BW and VL, AVX2 and FMA. The palette lookup
+// keeps its 8 lanes of AVX2.
+const kernel_table& kernelTable_avx512() {
+    static const kernel_table t = {isa::avx512, "avx512", vec8d::width,
+            formulaKernels<vec8d>(), escapeTimeDD<vec8d>, paletteColors_avx2,
+            interpolateColor_avx2};
+    return t;
+}
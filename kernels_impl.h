@@ -0,0 +1,368 @@
+#ifndef KERNELS_IMPL_H
+#define KERNELS_IMPL_H
+
+#include <cfloat>
+#include <cstdint>
+#include <immintrin.h>
+#include "kernels.h"
+#include "simd.h"
+
+// Kernel templates, included only by the per instruction set translation
+// units. Everything here has internal linkage so no instance compiled for
+// one instruction set stands in for another at link time. Nothing from the
+// standard library is used for the same reason.
+
+namespace {
+
+// Vectorized insideMainBulbs
+template<class V>
+inline typename V::mask mainBulbsMask(typename V::reg cr,
+        typename V::reg ci) {
+    using reg = typename V::reg;
+
+    reg xq = V::sub(cr, V::set1(0.25));
+    reg y2 = V::mul(ci, ci);
+    reg q = V::muladd(xq, xq, y2);
+    reg xb = V::add(cr, V::set1(1.0));
+    return V::mask_or(
+            V::le(V::mul(q, V::add(q, xq)), V::mul(V::set1(0.25), y2)),
+            V::le(V::muladd(xb, xb, y2), V::set1(0.0625)));
+}
+
+// z^D + c of every lane, on |Re z| + i |Im z| if ABS. Only called with
+// constants, so the powers unroll into plain multiplications.
+template<class V, uint32_t D, bool ABS>
+inline void formulaStep(typename V::reg zr, typename V::reg zi,
+        typename V::reg cr, typename V::reg ci, typename V::reg& nzr,
+        typename V::reg& nzi) {
+    using reg = typename V::reg;
+
+    if(ABS) {
+        zr = V::abs(zr);
+        zi = V::abs(zi);
+    }
+
+    reg zr2 = V::mul(zr, zr);
+    reg zi2 = V::mul(zi, zi);
+    if(D == 2) {
+        nzi = V::muladd(V::add(zr, zr), zi, ci);
+        nzr = V::add(V::sub(zr2, zi2), cr);
+        return;
+    }
+
+    reg pr = V::sub(zr2, zi2);
+    reg pi = V::mul(V::add(zr, zr), zi);
+    for(uint32_t k = 2; k < D - 1; k++) {
+        reg t = V::sub(V::mul(pr, zr), V::mul(pi, zi));
+        pi = V::muladd(pr, zi, V::mul(pi, zr));
+        pr = t;
+    }
+    nzr = V::add(V::sub(V::mul(pr, zr), V::mul(pi, zi)), cr);
+    nzi = V::add(V::muladd(pr, zi, V::mul(pi, zr)), ci);
+}
+
+// Escape time of V::width pixels under z -> z^D + c. Mandelbrot-type
+// formulas start at z = c with c the pixel, JULIA ones at z = the pixel
+// with c = p.julia_re + i p.julia_im. Orbits stopped at an earlier limit
+// resume from the z they stopped at.
+template<class V, uint32_t D, bool JULIA, bool ABS>
+void escapeTime(const double* real, const double* imag,
+        const escape_params& p, int32_t* it, double* norm) {
+    using reg = typename V::reg;
+    using mask = typename V::mask;
+
+    const reg cr = JULIA ? V::set1(p.julia_re) : V::load(real);
+    const reg ci = JULIA ? V::set1(p.julia_im) : V::load(imag);
+    const reg bail = V::set1(p.bail_out);
+    const reg eps = V::set1(p.period_eps);
+    const uint32_t max_iter = p.max_iter;
+    const uint32_t start = p.start_iter;
+
+    reg zr = V::load(start > 0 ? p.z_re : real);
+    reg zi = V::load(start > 0 ? p.z_im : imag);
+    reg itv = V::set1(-1.0);
+
+    // Lanes in the main cardioid or the period-2 bulb never enter the loop
+    mask active = V::ones();
+    if(D == 2 && !JULIA && !ABS)
+        active = V::mask_andnot(mainBulbsMask<V>(cr, ci), active);
+
+    // Brent-style cycle detection, all lanes share one schedule
+    reg sr = zr;
+    reg si = zi;
+    uint32_t check = 1;
+
+    for(uint32_t i=start; i<max_iter && V::movemask(active) != 0; i++) {
+        // z_n = z_(n-1)^D + c, lanes that already finished keep their z
+        reg nzr;
+        reg nzi;
+        formulaStep<V, D, ABS>(zr, zi, cr, ci, nzr, nzi);
+        zr = V::blend(zr, nzr, active);
+        zi = V::blend(zi, nzi, active);
+
+        // |z_n|, record the iteration for lanes escaping just now
+        reg zn = V::muladd(zr, zr, V::mul(zi, zi));
+        mask inside = V::mask_and(active, V::lt(zn, bail));
+        itv = V::blend(itv, V::set1(i), V::mask_andnot(inside, active));
+
+        // Lanes caught in a cycle stop without an iteration count
+        mask periodic = V::mask_and(
+                V::lt(V::abs(V::sub(zr, sr)), eps),
+                V::lt(V::abs(V::sub(zi, si)), eps));
+        active = V::mask_andnot(periodic, inside);
+
+        if(i - start == check) {
+            sr = zr;
+            si = zi;
+            check *= 2;
+        }
+    }
+
+    if(p.z_re) {
+        const reg nan = V::set1(__builtin_nan(""));
+        V::store(p.z_re, V::blend(nan, zr, active));
+        V::store(p.z_im, V::blend(nan, zi, active));
+    }
+
+    double its[V::width];
+    V::store(its, itv);
+    V::store(norm, V::muladd(zr, zr, V::mul(zi, zi)));
+
+    for(uint32_t l = 0; l < V::width; l++) {
+        it[l] = its[l] < 0 ? INT32_MIN : static_cast<int32_t>(its[l]);
+        if(its[l] < 0)
+            norm[l] = 0;
+    }
+}
+
+// The escape-time kernels of V, in the order of enum formula
+template<class V>
+const escape_kernel* formulaKernels() {
+    static const escape_kernel kernels[FORMULA_COUNT] = {
+        escapeTime<V, 2, false, false>,
+        escapeTime<V, 3, false, false>,
+        escapeTime<V, 4, false, false>,
+        escapeTime<V, 2, false, true>,
+        escapeTime<V, 2, true, false>,
+        escapeTime<V, 3, true, false>
+    };
+    return kernels;
+}
+
+#ifdef __FMA__
+// V::width complex numbers in double-double arithmetic: every part is the
+// unevaluated sum hi + lo of two doubles, about 106 bits of mantissa. The
+// error-free transforms rely on fused multiply-add.
+template<class V>
+struct dd_complex {
+    using reg = typename V::reg;
+
+    reg re_hi;
+    reg re_lo;
+    reg im_hi;
+    reg im_lo;
+
+    // s + e == a + b exactly
+    static inline void twoSum(reg a, reg b, reg& s, reg& e) {
+        s = V::add(a, b);
+        reg bb = V::sub(s, a);
+        e = V::add(V::sub(a, V::sub(s, bb)), V::sub(b, bb));
+    }
+
+    // As twoSum, requires |a| >= |b|
+    static inline void quickTwoSum(reg a, reg b, reg& s, reg& e) {
+        s = V::add(a, b);
+        e = V::sub(b, V::sub(s, a));
+    }
+
+    // p + e == a * b exactly
+    static inline void twoProd(reg a, reg b, reg& p, reg& e) {
+        p = V::mul(a, b);
+        e = V::fmsub(a, b, p);
+    }
+
+    static inline void add(reg ah, reg al, reg bh, reg bl, reg& h, reg& l) {
+        reg s;
+        reg e;
+        twoSum(ah, bh, s, e);
+        e = V::add(e, V::add(al, bl));
+        quickTwoSum(s, e, h, l);
+    }
+
+    static inline void mul(reg ah, reg al, reg bh, reg bl, reg& h, reg& l) {
+        reg p;
+        reg e;
+        twoProd(ah, bh, p, e);
+        e = V::fmadd(ah, bl, V::fmadd(al, bh, e));
+        quickTwoSum(p, e, h, l);
+    }
+
+    // z = z^2 + c
+    inline void sqrAdd(const dd_complex& c) {
+        reg rr_h, rr_l, ii_h, ii_l, ri_h, ri_l;
+        mul(re_hi, re_lo, re_hi, re_lo, rr_h, rr_l);
+        mul(im_hi, im_lo, im_hi, im_lo, ii_h, ii_l);
+        mul(re_hi, re_lo, im_hi, im_lo, ri_h, ri_l);
+
+        reg d_h, d_l;
+        add(rr_h, rr_l, V::sub(V::set1(0.0), ii_h), V::sub(V::set1(0.0), ii_l),
+                d_h, d_l);
+        add(d_h, d_l, c.re_hi, c.re_lo, re_hi, re_lo);
+
+        // 2 * re * im is exact in the doubled parts
+        add(V::add(ri_h, ri_h), V::add(ri_l, ri_l), c.im_hi, c.im_lo,
+                im_hi, im_lo);
+    }
+
+    // |z|^2 from the high parts, enough for the bail-out test
+    inline reg norm() const {
+        return V::fmadd(re_hi, re_hi, V::mul(im_hi, im_hi));
+    }
+};
+
+// Same iteration as escapeTime on double-double coordinates. The cycle
+// check is left out: its fixed tolerance is far coarser than the pixel
+// spacing at the zoom levels this kernel runs at.
+template<class V>
+void escapeTimeDD(const double* real_hi, const double* real_lo,
+        const double* imag_hi, const double* imag_lo, uint32_t max_iter,
+        double bail_out, int32_t* it, double* norm) {
+    using reg = typename V::reg;
+    using mask = typename V::mask;
+
+    const dd_complex<V> c{V::load(real_hi), V::load(real_lo),
+            V::load(imag_hi), V::load(imag_lo)};
+    const reg bail = V::set1(bail_out);
+
+    dd_complex<V> z = c;
+    reg itv = V::set1(-1.0);
+    mask active = V::mask_andnot(mainBulbsMask<V>(c.re_hi, c.im_hi),
+            V::ones());
+
+    for(uint32_t i=0; i<max_iter && V::movemask(active) != 0; i++) {
+        dd_complex<V> nz = z;
+        nz.sqrAdd(c);
+        z.re_hi = V::blend(z.re_hi, nz.re_hi, active);
+        z.re_lo = V::blend(z.re_lo, nz.re_lo, active);
+        z.im_hi = V::blend(z.im_hi, nz.im_hi, active);
+        z.im_lo = V::blend(z.im_lo, nz.im_lo, active);
+
+        mask inside = V::mask_and(active, V::lt(z.norm(), bail));
+        itv = V::blend(itv, V::set1(i), V::mask_andnot(inside, active));
+        active = inside;
+    }
+
+    double its[V::width];
+    V::store(its, itv);
+    V::store(norm, z.norm());
+
+    for(uint32_t l = 0; l < V::width; l++) {
+        it[l] = its[l] < 0 ? INT32_MIN : static_cast<int32_t>(its[l]);
+        if(its[l] < 0)
+            norm[l] = 0;
+    }
+}
+#endif
+
+inline rgb_color interpolateColor(const rgb_color& c1, const rgb_color& c2,
+        double r) {
+    return rgb_color{c1.r + (c2.r - c1.r) * r, c1.g + (c2.g - c1.g) * r,
+            c1.b + (c2.b - c1.b) * r};
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+// interpolateColor, rounded as it does
+rgb_color interpolateColor_avx2(const rgb_color& c1, const rgb_color& c2,
+        double r) {
+    __m256d vr = _mm256_set1_pd(r);
+    __m256d vc1 = _mm256_setr_pd(c1.r, c1.g, c1.b, 0);
+    __m256d vc2 = _mm256_setr_pd(c2.r, c2.g, c2.b, 0);
+
+    __m256d vcdiff = _mm256_sub_pd(vc2, vc1);
+    vc1 = _mm256_add_pd(_mm256_mul_pd(vcdiff, vr), vc1);
+
+    return rgb_color{vc1[0], vc1[1], vc1[2]};
+}
+
+// log2 of positive finite floats, as fastLog2 in smooth_color.cpp
+inline __m256 fastLog2_avx(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+                _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    bits = _mm256_or_si256(_mm256_and_si256(bits,
+                _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000));
+    __m256 t = _mm256_sub_ps(_mm256_castsi256_ps(bits), _mm256_set1_ps(1.0f));
+
+    __m256 p = _mm256_set1_ps(0.0458707517f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(-0.194390433f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(0.415397767f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(-0.708674935f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(1.44182512f));
+
+    return _mm256_add_ps(e, _mm256_mul_ps(p, t));
+}
+
+uint32_t paletteColors_avx2(const int32_t* iterations, const float* normals,
+        uint32_t* argb, uint32_t n, const uint32_t* palette,
+        uint32_t palette_size, uint32_t n_gradient) {
+    // it % n_gradient + frac stays within one wrap of the palette for
+    // gradients of at least 8 colors, so one correction step suffices.
+    if(n_gradient < 8)
+        return 0;
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i interior = _mm256_set1_epi32(INT32_MIN);
+    const __m256i black = _mm256_set1_epi32(0xff000000);
+    const __m256i vn = _mm256_set1_epi32(n_gradient);
+    const __m256i vn1 = _mm256_set1_epi32(n_gradient - 1);
+    const __m256i size = _mm256_set1_epi32(palette_size);
+    const __m256i size1 = _mm256_set1_epi32(palette_size - 1);
+    const __m256d inv_n = _mm256_set1_pd(1.0 / n_gradient);
+    const __m256 steps = _mm256_set1_ps(palette_size / n_gradient);
+
+    uint32_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256i it = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(iterations + i));
+        __m256 norm = _mm256_loadu_ps(normals + i);
+        norm = _mm256_min_ps(_mm256_max_ps(norm, _mm256_set1_ps(4.0f)),
+                _mm256_set1_ps(FLT_MAX));
+        __m256 frac = _mm256_sub_ps(_mm256_set1_ps(2.0f),
+                fastLog2_avx(fastLog2_avx(norm)));
+
+        // it % n_gradient, quotient estimated in double and corrected
+        __m256d q_lo = _mm256_floor_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(
+                        _mm256_castsi256_si128(it)), inv_n));
+        __m256d q_hi = _mm256_floor_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(
+                        _mm256_extracti128_si256(it, 1)), inv_n));
+        __m256i q = _mm256_set_m128i(_mm256_cvttpd_epi32(q_hi),
+                _mm256_cvttpd_epi32(q_lo));
+        __m256i r = _mm256_sub_epi32(it, _mm256_mullo_epi32(q, vn));
+        r = _mm256_add_epi32(r, _mm256_and_si256(
+                    _mm256_cmpgt_epi32(zero, r), vn));
+        r = _mm256_sub_epi32(r, _mm256_and_si256(
+                    _mm256_cmpgt_epi32(r, vn1), vn));
+
+        __m256 pos = _mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(r),
+                    frac), steps);
+        __m256i idx = _mm256_cvtps_epi32(_mm256_floor_ps(pos));
+        idx = _mm256_add_epi32(idx, _mm256_and_si256(
+                    _mm256_cmpgt_epi32(zero, idx), size));
+        idx = _mm256_sub_epi32(idx, _mm256_and_si256(
+                    _mm256_cmpgt_epi32(idx, size1), size));
+
+        __m256i in = _mm256_cmpeq_epi32(it, interior);
+        idx = _mm256_andnot_si256(in, idx);
+
+        __m256i col = _mm256_i32gather_epi32(
+                reinterpret_cast<const int*>(palette), idx, 4);
+        col = _mm256_blendv_epi8(col, black, in);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(argb + i), col);
+    }
+    return i;
+}
+#endif
+
+}
+
+#endif // KERNELS_IMPL_H
@@ -0,0 +1,9 @@
+#include "kernels_impl.h"
+
+// Baseline of every x86-64 CPU, built without extra flags. Double-double
+// needs FMA and is left to the perturbation engine here.
+const kernel_table& kernelTable_sse2() {
+    static const kernel_table t = {isa::sse2, "sse2", vec2d::width,
+            formulaKernels<vec2d>(), nullptr, nullptr, interpolateColor};
+    return t;
+}
@@ -1,114 +1,1435 @@
 #include "mandelbrot.h"
 
-Mandelbrot::Mandelbrot() {
+Mandelbrot::Mandelbrot(uint32_t threads) {
     max_iter = 100;
 
     dimensions.m_height = 2;
     dimensions.m_offset_y = 1;
     dimensions.m_width = 3;
     dimensions.m_offset_x = -2;
+    frame_max_iter = 0;
+    window_top = 0;
+    window_height = 0;
+    pass_block = 0;
+    preview_block = PREVIEW_BLOCK;
+    print_timing = false;
+    collect_stats = false;
+
+    mode = render_mode::full;
+    active_precision = precision::fp64;
+    perturbation = std::unique_ptr<Perturbation>(new Perturbation());
+
+    simd = &kernels();
+    fractal = formula::mandelbrot;
+    julia_re = -0.8;
+    julia_im = 0.156;
+    updateKernels();
+    frame_on_grid = false;
+    aa_samples = 0;
+    aa_refine = false;
+    aa_left = 0;
+    keep_orbits = false;
+    auto_iter = false;
 
     coloring = std::unique_ptr<Coloring>(new SmoothColoring(4, 50));
+    setThreads(threads);
 }
 
-void Mandelbrot::refreshMandelbrotTiled(std::vector<QImage>& tiles) {
-    if(tiles.size() == 0)
+void Mandelbrot::setRenderMode(render_mode m) {
+    if(m == mode)
         return;
 
+    // Filled pixels must not reach full mode frames, which the cache
+    // takes tiles of
+    mode = m;
+    frame_max_iter = 0;
+}
+
+void Mandelbrot::setColoring(std::unique_ptr<Coloring> c) {
+    coloring = std::move(c);
+}
+
+void Mandelbrot::setPrintTiming(bool p) {
+    print_timing = p;
+}
+
+void Mandelbrot::setCollectStats(bool c) {
+    // Turned on mid-frame, the stats start with the next pass
+    if(c && !collect_stats)
+        resetStats();
+    if(!c)
+        stats = frame_stats();
+    collect_stats = c;
+}
+
+const frame_stats& Mandelbrot::frameStats() const {
+    return stats;
+}
+
+const iter_buffer& Mandelbrot::frameResults() const {
+    return frame;
+}
+
+void Mandelbrot::setPreviewBlock(uint32_t block) {
+    preview_block = 1;
+    while(preview_block * 2 <= std::min(block, TILE_HEIGHT))
+        preview_block *= 2;
+}
+
+void Mandelbrot::setThreads(uint32_t t) {
+    if(pool && pool->size() == std::max<uint32_t>(t, 1))
+        return;
+
+    pool = std::unique_ptr<ThreadPool>(new ThreadPool(t));
+    worker_points.resize(pool->size());
+    worker_tiles.resize(pool->size());
+    worker_phases.resize(pool->size());
+}
+
+bool Mandelbrot::refreshMandelbrotTiled(const argb_image& image) {
+    if(image.width == 0 || image.height == 0)
+        return true;
+
+    if(frame.width != image.width || frame.height != image.height)
+        frame_max_iter = 0;
+    frame.resize(image.width, image.height);
+
+    frame_lines.resize(image.height);
+    for(uint32_t y=0; y<image.height; y++)
+        frame_lines.at(y) = image.line(y);
+
     auto start = timer::now();
+    uint32_t block;
+    if(!iterateFrame(block))
+        return false;
+    auto mid = timer::now();
+    // The final pass colorized its tiles already
+    if(block != 1)
+        colorizeFrame();
+    auto end = timer::now();
 
-    // Determine global width and height (sum of all tiles)
-    uint32_t width = tiles.at(0).width();
-    uint32_t height = 0;
+    std::chrono::duration<double> diff = end - start;
+    std::chrono::duration<double> diff_it = mid - start;
+    std::chrono::duration<double> diff_col = end - mid;
+    if(collect_stats && block != 0) {
+        mergeStats();
+        stats.passes++;
+        stats.time += diff.count();
+        stats.iterate_time += diff_it.count();
+        stats.colorize_time += diff_col.count();
+        if(pass_block == 0)
+            finishStats();
+    }
+    if(print_timing)
+        std::cout << "mandelbrot calculation time: " << diff.count()
+                  << " (iterate " << diff_it.count()
+                  << ", colorize " << diff_col.count() << ")" << std::endl;
 
-    for(uint32_t i=0; i<tiles.size(); i++) {
-        height += tiles.at(i).height();
+    return pass_block == 0 && aa_left == 0 && !canResume();
+}
+
+std::vector<m_tile> Mandelbrot::splitTiles(const m_tile& area) const {
+    std::vector<m_tile> res;
+    uint32_t right = area.x + area.width;
+    uint32_t bottom = area.y + area.height;
+    for(uint32_t y=area.y; y<bottom; y+=TILE_HEIGHT) {
+        for(uint32_t x=area.x; x<right; x+=TILE_WIDTH) {
+            res.push_back(m_tile{x, y, std::min(TILE_WIDTH, right - x),
+                    std::min(TILE_HEIGHT, bottom - y)});
+        }
     }
 
-    // Run each tile in a separate thread
-    std::vector<std::thread> workers;
-    uint32_t cur_hstart = 0;
-    uint32_t cur_hend = tiles.at(0).height();
-    for(uint32_t i=0; i<tiles.size(); i++) {
-        if(i > 0) {
-            cur_hstart = cur_hend;
-            cur_hend = cur_hstart + tiles.at(i).height();
+    return res;
+}
+
+bool Mandelbrot::frameShift(int32_t& dx, int32_t& dy) const {
+    if(frame_max_iter != max_iter
+            || frame_dimensions.m_width != dimensions.m_width
+            || frame_dimensions.m_height != dimensions.m_height)
+        return false;
+
+    // Offsets are compared exactly, a pan may be far below double
+    // resolution of the coordinates.
+    double step_x = dimensions.m_width / (frame.width - 1);
+    double step_y = dimensions.m_height / (imageHeight() - 1);
+    double sx = (exactOffsetX(dimensions)
+            - exactOffsetX(frame_dimensions)).toDouble() / step_x;
+    double sy = (exactOffsetY(frame_dimensions)
+            - exactOffsetY(dimensions)).toDouble() / step_y;
+
+    if(std::fabs(sx) >= frame.width || std::fabs(sy) >= frame.height)
+        return false;
+
+    dx = std::lround(sx);
+    dy = std::lround(sy);
+    return sx == dx && sy == dy;
+}
+
+bool Mandelbrot::iterateFrame(uint32_t& block) {
+    if(canResume()) {
+        block = 0;
+        return resumeFrame();
+    }
+
+    int32_t dx = 0;
+    int32_t dy = 0;
+    bool shifted = frameShift(dx, dy);
+    if(!shifted || dx != 0 || dy != 0) {
+        // Deeper frames leave the grid to the dd and perturbation engines.
+        // The cache only takes pixels iterated at their grid points, which
+        // the filled ones of subdivide mode are not.
+        precision p = selectPrecision(frame.width, imageHeight());
+        frame_on_grid = cache && p == precision::fp64
+                && mode == render_mode::full && window_height == 0
+                && frameOnGrid(dimensions, frame.width, frame.height,
+                        grid_level, grid_x, grid_y);
+        grid_step = frame_on_grid ? gridStep(grid_level) : 0;
+        prefetch_queue.clear();
+
+        std::vector<double> re;
+        std::vector<double> im;
+        sampleAxes(p, re, im);
+
+        // Frames the cache covers need nothing of the previous one
+        bool cached = frame_on_grid && gridCached();
+        if(shifted && !cached)
+            scrollFrame(dx, dy, re, im);
+        else if(!cached)
+            reprojectFrame(re, im);
+        sample_re.swap(re);
+        sample_im.swap(im);
+        if(frame_on_grid)
+            loadGridTiles();
+
+        frame_dimensions = dimensions;
+        frame_max_iter = max_iter;
+        preparePrecision();
+        size_t pixels = static_cast<size_t>(frame.width) * frame.height;
+        orbit_re.assign(keep_orbits ? pixels : 0, INFINITY);
+        orbit_im.assign(keep_orbits ? pixels : 0, INFINITY);
+        proven.assign(mode == render_mode::subdivide ? pixels : 0, 0);
+
+        // Mariani-Silver needs whole tiles of unknown pixels, it skips the
+        // coarse passes. So do frames entirely in the cache.
+        pass_block = mode == render_mode::subdivide || cached ? 1
+                : preview_block;
+        aa_left = 0;
+        aa_pixels.clear();
+        aa_iterations.clear();
+        aa_norms.clear();
+        if(collect_stats)
+            resetStats();
+    }
+
+    block = pass_block;
+    if(pass_block == 0) {
+        if(aa_left == 0)
+            return true;
+        if(!antialiasFrame())
+            return false;
+        aa_left--;
+        return true;
+    }
+
+    // Small tiles balanced by the pool, so expensive regions of the set do
+    // not stall a single worker. Spreading the new anchors over their
+    // blocks streams through whole rows instead.
+    std::vector<m_tile> jobs = splitTiles(
+            m_tile{0, 0, frame.width, frame.height});
+    runParallel(jobs.size(), [&](uint32_t i, uint32_t worker) {
+        if(cancelled && cancelled())
+            return;
+
+        const m_tile& tile = jobs.at(i);
+        double start = collect_stats ? statsTime() : 0;
+        bool changed = refineTile(tile, block, worker_points.at(worker));
+        if(collect_stats && changed)
+            recordTile(tile, block, worker, start, worker_points.at(worker));
+        if(block == 1) {
+            start = collect_stats ? statsTime() : 0;
+            colorizeTile(tile);
+            if(collect_stats)
+                worker_phases.at(worker).push_back(phase_stats{"colorize",
+                        worker, start, statsTime()});
+            if(changed && tile_done)
+                tile_done(tile);
         }
+    });
 
-        if(__builtin_cpu_supports("avx") || __builtin_cpu_supports("avx2"))
-            workers.push_back(std::thread(
-                        &Mandelbrot::calcMandelbrotWorkerTiled_avx, 
-                        this, cur_hstart, cur_hend, width, height, 
-                        std::ref(tiles.at(i))));
-        else
-            workers.push_back(std::thread(
-                        &Mandelbrot::calcMandelbrotWorkerTiled, 
-                        this, cur_hstart, cur_hend, width, height, 
-                        std::ref(tiles.at(i))));
+    // Tiles done so far keep their pixels, the pass is redone from there
+    if(cancelled && cancelled())
+        return false;
+
+    if(block > 1) {
+        uint32_t bands = (frame.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+        runParallel(bands, [&](uint32_t b, uint32_t worker) {
+            double start = collect_stats ? statsTime() : 0;
+            uint32_t y0 = b * TILE_HEIGHT;
+            spreadAnchors(y0, std::min(TILE_HEIGHT, frame.height - y0), block);
+            if(collect_stats)
+                worker_phases.at(worker).push_back(phase_stats{"spread",
+                        worker, start, statsTime()});
+        });
     }
 
-    for(auto& t: workers)
-        t.join();
+    pass_block = block == 1 ? 0 : std::max<uint32_t>(block / 4, 1);
+    if(pass_block == 0 && aa_samples > 0)
+        aa_left = aa_refine ? 2 : 1;
+    if(pass_block == 0 && frame_on_grid) {
+        storeGridTiles();
+        queuePrefetch();
+    }
+    if(pass_block == 0)
+        raiseIterations();
+    return true;
+}
 
-    auto end = timer::now();
+bool Mandelbrot::canResume() const {
+    return frame_max_iter != 0 && pass_block == 0 && max_iter > frame_max_iter
+            && frame_dimensions.m_width == dimensions.m_width
+            && frame_dimensions.m_height == dimensions.m_height
+            && (exactOffsetX(frame_dimensions)
+                - exactOffsetX(dimensions)).isZero()
+            && (exactOffsetY(frame_dimensions)
+                - exactOffsetY(dimensions)).isZero();
+}
 
-    std::chrono::duration<double> diff = end - start;
-    std::cout << "mandelbrot calculation time: " << diff.count() << std::endl;
+bool Mandelbrot::resumeFrame() {
+    uint32_t start = frame_max_iter;
+    preparePrecision();
+    bool kept = keepsOrbits(frame);
+
+    // Pixels that had not escaped: the ones with a known orbit first, they
+    // continue from it, the others start over
+    std::vector<m_pixel> pixels;
+    std::vector<m_pixel> restart;
+    for(uint32_t y = 0; y < frame.height; y++) {
+        const int32_t* it = frame.iterRow(y);
+        for(uint32_t x = 0; x < frame.width; x++) {
+            if(it[x] != INT32_MIN)
+                continue;
+            size_t i = static_cast<size_t>(y) * frame.width + x;
+            if(!kept || std::isinf(orbit_re[i]))
+                restart.push_back(m_pixel{x, y});
+            else if(!std::isnan(orbit_re[i]))
+                pixels.push_back(m_pixel{x, y});
+        }
+    }
+    uint32_t continued = pixels.size();
+    pixels.insert(pixels.end(), restart.begin(), restart.end());
+
+    // Results go to the frame only once every pixel has them, a cancelled
+    // resume leaves it as it was
+    size_t n = pixels.size();
+    std::vector<int32_t> iterations(n);
+    std::vector<float> norms(n);
+    std::vector<double> z_re(kept ? n : 0);
+    std::vector<double> z_im(kept ? n : 0);
+    auto store = [&](uint32_t i, const mcalc_result_simd& mb, uint32_t l) {
+        iterations[i] = mb.it[l];
+        norms[i] = mb.norm[l];
+        if(kept) {
+            z_re[i] = mb.z_re[l];
+            z_im[i] = mb.z_im[l];
+        }
+    };
+
+    const uint32_t chunk = 256;
+    uint32_t lanes = simd->lanes;
+    uint32_t chunks = (n + chunk - 1) / chunk;
+    runParallel(chunks, [&](uint32_t c, uint32_t) {
+        if(cancelled && cancelled())
+            return;
+
+        uint32_t first = c * chunk;
+        uint32_t end = std::min<size_t>(first + chunk, n);
+        // The chunk's continued pixels, then the ones starting over
+        uint32_t split = std::max(first, std::min(end, continued));
+        uint32_t k = first;
+        while(k < split) {
+            uint32_t count = std::min(lanes, split - k);
+            double real[MAX_LANES];
+            double imag[MAX_LANES];
+            mcalc_result_simd mb;
+            for(uint32_t l = 0; l < lanes; l++) {
+                // Unused tail lanes repeat the last pixel
+                const m_pixel& p = pixels[k + std::min(l, count - 1)];
+                size_t i = static_cast<size_t>(p.y) * frame.width + p.x;
+                real[l] = pixelReal(p.x, frame.width);
+                imag[l] = pixelImag(p.y, frame.height);
+                mb.z_re[l] = orbit_re[i];
+                mb.z_im[l] = orbit_im[i];
+            }
+            runKernel(kernel, lanes, PERIOD_EPS, real, imag, start, true,
+                    mb);
+            for(uint32_t l = 0; l < count; l++)
+                store(k + l, mb, l);
+            k += count;
+        }
+
+        if(k < end)
+            calcLanes(end - k, [&](uint32_t j, double& x, double& y) {
+                x = pixels[k + j].x;
+                y = pixels[k + j].y;
+            }, [&](uint32_t j, const mcalc_result_simd& mb, uint32_t l) {
+                store(k + j, mb, l);
+            });
+    });
+    if(cancelled && cancelled())
+        return false;
+
+    for(size_t i = 0; i < n; i++) {
+        const m_pixel& p = pixels[i];
+        frame.iterRow(p.y)[p.x] = iterations[i];
+        frame.normRow(p.y)[p.x] = norms[i];
+        if(kept) {
+            size_t j = static_cast<size_t>(p.y) * frame.width + p.x;
+            orbit_re[j] = z_re[i];
+            orbit_im[j] = z_im[i];
+        }
+    }
+    frame_max_iter = max_iter;
+
+    // Samples of the old limit are stale
+    aa_pixels.clear();
+    aa_iterations.clear();
+    aa_norms.clear();
+    aa_left = aa_samples == 0 ? 0 : aa_refine ? 2 : 1;
+    if(frame_on_grid) {
+        prefetch_queue.clear();
+        storeGridTiles();
+        queuePrefetch();
+    }
+    raiseIterations();
+    return true;
+}
+
+void Mandelbrot::raiseIterations() {
+    if(!auto_iter || max_iter >= AUTO_ITER_MAX)
+        return;
+
+    // A frame where nothing escaped shows no detail yet either
+    int32_t late = max_iter / 2;
+    uint64_t escaped = 0;
+    uint64_t inside = 0;
+    for(uint32_t y = 0; y < frame.height; y++) {
+        const int32_t* it = frame.iterRow(y);
+        for(uint32_t x = 0; x < frame.width; x++) {
+            escaped += it[x] >= late;
+            inside += it[x] == INT32_MIN;
+        }
+    }
+    uint64_t pixels = static_cast<uint64_t>(frame.width) * frame.height;
+    if(escaped > AUTO_ITER_ESCAPES * pixels || inside == pixels)
+        max_iter = std::min(2 * max_iter, AUTO_ITER_MAX);
 }
 
-void Mandelbrot::calcMandelbrotWorkerTiled_avx(uint32_t hstart, uint32_t hend, 
-        uint32_t width, uint32_t height, QImage& buf) {
+// Rounds towards minus infinity, for grid positions left of or above 0
+static int64_t floorDiv(int64_t a, int64_t b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
 
-    for(uint32_t y = hstart; y < hend; y++) {
-        double imag = dimensions.m_offset_y
-                - (static_cast<double>(y) / (height - 1))
-                * dimensions.m_height;
+bool Mandelbrot::gridCached() const {
+    for(int64_t ty = floorDiv(grid_y, GRID_TILE);
+            ty <= floorDiv(grid_y + frame.height - 1, GRID_TILE); ty++) {
+        for(int64_t tx = floorDiv(grid_x, GRID_TILE);
+                tx <= floorDiv(grid_x + frame.width - 1, GRID_TILE); tx++) {
+            if(!cache->contains(tile_key{grid_level, tx, ty, max_iter}))
+                return false;
+        }
+    }
+    return true;
+}
 
-        for(uint32_t x = 0; x < width; x += 2) {
-            double real1 = dimensions.m_offset_x
-                    + (static_cast<double>(x) / (width - 1))
-                    * dimensions.m_width;
-            double real2 = dimensions.m_offset_x
-                    + (static_cast<double>(x + 1) / (width - 1))
-                    * dimensions.m_width;
+void Mandelbrot::loadGridTiles() {
+    int64_t tx0 = floorDiv(grid_x, GRID_TILE);
+    int64_t ty0 = floorDiv(grid_y, GRID_TILE);
+    int64_t tx1 = floorDiv(grid_x + frame.width - 1, GRID_TILE);
+    int64_t ty1 = floorDiv(grid_y + frame.height - 1, GRID_TILE);
 
-            auto mb = calcMandelbrot_avx(imag, real1, imag, real2);
-            uint32_t yy = (y - hstart);
-            buf.setPixelColor(x, yy, coloring->getColor_avx(mb.it1, mb.abs1));
+    for(int64_t ty = ty0; ty <= ty1; ty++) {
+        for(int64_t tx = tx0; tx <= tx1; tx++) {
+            auto t = cache->find(tile_key{grid_level, tx, ty, max_iter});
+            if(!t)
+                continue;
 
-            if(x + 1 < width) {
-                buf.setPixelColor(x + 1, yy, coloring->getColor_avx(mb.it2, 
-                            mb.abs2));
+            // Part of the tile inside the frame, in frame pixels
+            int64_t left = tx * GRID_TILE - grid_x;
+            int64_t top = ty * GRID_TILE - grid_y;
+            uint32_t x0 = std::max<int64_t>(left, 0);
+            uint32_t y0 = std::max<int64_t>(top, 0);
+            uint32_t x1 = std::min<int64_t>(left + GRID_TILE, frame.width);
+            uint32_t y1 = std::min<int64_t>(top + GRID_TILE, frame.height);
+            for(uint32_t y = y0; y < y1; y++) {
+                size_t src = (y - top) * GRID_TILE + (x0 - left);
+                std::copy_n(t->iterations + src, x1 - x0,
+                        frame.iterRow(y) + x0);
+                std::copy_n(t->norms + src, x1 - x0, frame.normRow(y) + x0);
+                std::fill_n(frame.grainRow(y) + x0, x1 - x0, 1);
             }
         }
     }
 }
 
-void Mandelbrot::calcMandelbrotWorkerTiled(uint32_t hstart, uint32_t hend, 
-            uint32_t width, uint32_t height, QImage& buf) {
+void Mandelbrot::storeGridTiles() {
+    int64_t tx0 = floorDiv(grid_x + GRID_TILE - 1, GRID_TILE);
+    int64_t ty0 = floorDiv(grid_y + GRID_TILE - 1, GRID_TILE);
+    int64_t tx1 = floorDiv(grid_x + frame.width, GRID_TILE);
+    int64_t ty1 = floorDiv(grid_y + frame.height, GRID_TILE);
 
-    for(uint32_t y = hstart; y < hend; y++) {
-        double imag = dimensions.m_offset_y
-                - (static_cast<double>(y) / (height - 1))
-                * dimensions.m_height;
+    for(int64_t ty = ty0; ty < ty1; ty++) {
+        for(int64_t tx = tx0; tx < tx1; tx++) {
+            tile_key k = {grid_level, tx, ty, max_iter};
+            if(cache->contains(k))
+                continue;
 
-        for(uint32_t x = 0; x < width; x++) {
-            double real = dimensions.m_offset_x
-                    + (static_cast<double>(x) / (width - 1))
-                    * dimensions.m_width;
+            std::shared_ptr<grid_tile> t(new grid_tile());
+            uint32_t left = tx * GRID_TILE - grid_x;
+            uint32_t top = ty * GRID_TILE - grid_y;
+            for(uint32_t y = 0; y < GRID_TILE; y++) {
+                std::copy_n(frame.iterRow(top + y) + left, GRID_TILE,
+                        t->iterations + y * GRID_TILE);
+                std::copy_n(frame.normRow(top + y) + left, GRID_TILE,
+                        t->norms + y * GRID_TILE);
+            }
+            cache->insert(k, t);
+        }
+    }
+}
 
-            auto mb = calcMandelbrot(complex(real, imag));
-            uint32_t yy = (y - hstart);
-            buf.setPixelColor(x, yy, coloring->getColor(mb.second, mb.first));
+void Mandelbrot::queuePrefetch() {
+    // Tiles of level covering grid points x0 .. x1, y0 .. y1 of it
+    auto add = [&](int32_t level, int64_t x0, int64_t y0, int64_t x1,
+            int64_t y1) {
+        for(int64_t ty = floorDiv(y0, GRID_TILE);
+                ty <= floorDiv(y1, GRID_TILE); ty++) {
+            for(int64_t tx = floorDiv(x0, GRID_TILE);
+                    tx <= floorDiv(x1, GRID_TILE); tx++)
+                prefetch_queue.push_back(tile_key{level, tx, ty, max_iter});
+        }
+    };
+
+    // The frame's level one tile beyond its edges, then one level out over
+    // everything a zoom out about any pixel shows, then one level in
+    int64_t w = frame.width;
+    int64_t h = frame.height;
+    add(grid_level, grid_x - GRID_TILE, grid_y - GRID_TILE,
+            grid_x + w + GRID_TILE - 1, grid_y + h + GRID_TILE - 1);
+    if(grid_level > 0)
+        add(grid_level - 1, floorDiv(grid_x - w, 2), floorDiv(grid_y - h, 2),
+                floorDiv(grid_x + 2 * w - 1, 2),
+                floorDiv(grid_y + 2 * h - 1, 2));
+    if(grid_level < GRID_MAX_LEVEL)
+        add(grid_level + 1, 2 * grid_x, 2 * grid_y, 2 * (grid_x + w) - 1,
+                2 * (grid_y + h) - 1);
+
+    // Never more than would evict the frame's own tiles
+    prefetch_queue.resize(std::min<size_t>(prefetch_queue.size(),
+            cache->capacity() / 2));
+    std::reverse(prefetch_queue.begin(), prefetch_queue.end());
+}
+
+bool Mandelbrot::prefetchTiles() {
+    if(!frame_on_grid || pass_block != 0)
+        return false;
+
+    std::vector<tile_key> batch;
+    while(!prefetch_queue.empty() && batch.size() < 2 * pool->size()) {
+        if(!cache->contains(prefetch_queue.back()))
+            batch.push_back(prefetch_queue.back());
+        prefetch_queue.pop_back();
+    }
+    if(batch.empty())
+        return false;
+
+    pool->parallelFor(batch.size(), [&](uint32_t i, uint32_t) {
+        if(cancelled && cancelled())
+            return;
+
+        std::shared_ptr<grid_tile> t(new grid_tile());
+        iterateGridTile(batch.at(i), *t);
+        cache->insert(batch.at(i), t);
+    });
+    return !(cancelled && cancelled());
+}
+
+void Mandelbrot::iterateGridTile(const tile_key& k, grid_tile& t) const {
+    double step = gridStep(k.level);
+    uint32_t lanes = simd->lanes;
+    double real[MAX_LANES];
+    double imag[MAX_LANES];
+    for(uint32_t y = 0; y < GRID_TILE; y++) {
+        std::fill_n(imag, lanes, -(k.y * GRID_TILE + y) * step);
+        for(uint32_t x = 0; x < GRID_TILE; x += lanes) {
+            for(uint32_t l = 0; l < lanes; l++)
+                real[l] = (k.x * GRID_TILE + x + l) * step;
+
+            auto mb = calcMandelbrot_simd(real, imag);
+            for(uint32_t l = 0; l < lanes; l++) {
+                t.iterations[y * GRID_TILE + x + l] = mb.it[l];
+                t.norms[y * GRID_TILE + x + l] = mb.norm[l];
+            }
+        }
+    }
+}
+
+void Mandelbrot::preparePrecision() {
+    active_precision = selectPrecision(frame.width, imageHeight());
+    if(active_precision == precision::perturbation)
+        perturbation->prepare(dimensions, frame.width, imageHeight(),
+                max_iter, BAIL_OUT, window_top);
+
+    if(active_precision == precision::dd) {
+        bigfloat x = exactOffsetX(dimensions);
+        bigfloat y = exactOffsetY(dimensions);
+        dd_offset_x[0] = x.toDouble();
+        dd_offset_x[1] = (x - bigfloat(dd_offset_x[0])).toDouble();
+        dd_offset_y[0] = y.toDouble();
+        dd_offset_y[1] = (y - bigfloat(dd_offset_y[0])).toDouble();
+    }
+}
+
+void Mandelbrot::sampleAxes(precision p, std::vector<double>& re,
+        std::vector<double>& im) const {
+    re.assign(frame.width, NAN);
+    im.assign(frame.height, NAN);
+    if(p != precision::fp64)
+        return;
+
+    for(uint32_t x = 0; x < frame.width; x++)
+        re[x] = pixelReal(x, frame.width);
+    for(uint32_t y = 0; y < frame.height; y++)
+        im[y] = pixelImag(y, frame.height);
+}
+
+// Whether samples[i] exists and is exactly c, never for NaN
+static inline bool sameSample(const std::vector<double>& samples, int64_t i,
+        double c) {
+    return i >= 0 && i < static_cast<int64_t>(samples.size())
+            && samples[i] == c;
+}
+
+void Mandelbrot::scrollFrame(int32_t dx, int32_t dy,
+        const std::vector<double>& re, const std::vector<double>& im) {
+    frame.scroll(dx, dy);
+
+    // Off the grid, a pan by whole pixels rarely moves the samples by exact
+    // multiples of their spacing. Pixels sampled elsewhere become previews
+    // of themselves.
+    std::vector<uint8_t> col_same(frame.width);
+    for(uint32_t x = 0; x < frame.width; x++) {
+        col_same[x] = sameSample(sample_re, static_cast<int64_t>(x) + dx,
+                re[x]);
+    }
+    for(uint32_t y = 0; y < frame.height; y++) {
+        bool row_same = sameSample(sample_im,
+                static_cast<int64_t>(y) + dy, im[y]);
+        uint8_t* grain = frame.grainRow(y);
+        for(uint32_t x = 0; x < frame.width; x++) {
+            if(grain[x] == 1 && !(row_same && col_same[x]))
+                grain[x] = 2;
+        }
+    }
+}
+
+void Mandelbrot::reprojectFrame(const std::vector<double>& re,
+        const std::vector<double>& im) {
+    std::swap(frame, prev_frame);
+    frame.resize(prev_frame.width, prev_frame.height);
+    if(frame_max_iter == 0) {
+        std::fill(frame.grain.begin(), frame.grain.end(),
+                iter_buffer::GRAIN_UNKNOWN);
+        return;
+    }
+
+    // Pixel grid of the new viewport in pixels of the previous one. Both
+    // frames have the same size, so f is the ratio of the pixel spacings.
+    double old_step_x = frame_dimensions.m_width / (frame.width - 1);
+    double old_step_y = frame_dimensions.m_height / (imageHeight() - 1);
+    double ox = (exactOffsetX(dimensions)
+            - exactOffsetX(frame_dimensions)).toDouble() / old_step_x;
+    double oy = (exactOffsetY(frame_dimensions)
+            - exactOffsetY(dimensions)).toDouble() / old_step_y;
+    double fx = dimensions.m_width / frame_dimensions.m_width;
+    double fy = dimensions.m_height / frame_dimensions.m_height;
+    double f = std::min(fx, fy);
+    bool same_iter = frame_max_iter == max_iter;
+
+    uint32_t blocks = (frame.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    pool->parallelFor(blocks, [&](uint32_t b, uint32_t) {
+        uint32_t yend = std::min(frame.height, (b + 1) * TILE_HEIGHT);
+        for(uint32_t y = b * TILE_HEIGHT; y < yend; y++) {
+            int32_t* it = frame.iterRow(y);
+            float* norm = frame.normRow(y);
+            uint8_t* grain = frame.grainRow(y);
+
+            double v = oy + y * fy;
+            int64_t sy = std::llround(v);
+            if(sy < 0 || sy >= frame.height) {
+                std::fill_n(grain, frame.width, iter_buffer::GRAIN_UNKNOWN);
+                continue;
+            }
+
+            bool row_hit = sameSample(sample_im, sy, im[y]);
+            const int32_t* src_it = prev_frame.iterRow(sy);
+            const float* src_norm = prev_frame.normRow(sy);
+            const uint8_t* src_grain = prev_frame.grainRow(sy);
+
+            for(uint32_t x = 0; x < frame.width; x++) {
+                double u = ox + x * fx;
+                int64_t sx = std::llround(u);
+                if(sx < 0 || sx >= frame.width
+                        || src_grain[sx] == iter_buffer::GRAIN_UNKNOWN) {
+                    grain[x] = iter_buffer::GRAIN_UNKNOWN;
+                    continue;
+                }
+
+                it[x] = src_it[sx];
+                norm[x] = src_norm[sx];
+
+                // Samples the new frame takes again are kept, the others
+                // stand in for their spacing in new pixels.
+                if(same_iter && row_hit && src_grain[sx] == 1
+                        && sameSample(sample_re, sx, re[x]))
+                    grain[x] = 1;
+                else
+                    grain[x] = std::min(254.0, std::max(2.0,
+                                std::ceil(src_grain[sx] / f)));
+            }
+        }
+    });
+}
+
+bool Mandelbrot::refineTile(const m_tile& tile, uint32_t block,
+        std::vector<m_pixel>& points) {
+    // Blocks are anchored at multiples of the block size, which the tile
+    // origin is aligned to. Every block holding a pixel coarser than the
+    // pass needs its anchor iterated.
+    uint32_t bottom = tile.y + tile.height;
+    std::vector<uint8_t> col_grain(tile.width);
+
+    points.clear();
+    for(uint32_t by = tile.y; by < bottom; by += block) {
+        // Coarsest grain per column of the block row
+        std::copy_n(frame.grainRow(by) + tile.x, tile.width,
+                col_grain.begin());
+        for(uint32_t y = by + 1; y < std::min(by + block, bottom); y++) {
+            const uint8_t* grain = frame.grainRow(y) + tile.x;
+            for(uint32_t x = 0; x < tile.width; x++)
+                col_grain[x] = std::max(col_grain[x], grain[x]);
+        }
+
+        for(uint32_t bx = 0; bx < tile.width; bx += block) {
+            uint8_t g = 0;
+            for(uint32_t x = bx; x < std::min(bx + block, tile.width); x++)
+                g = std::max(g, col_grain[x]);
+            if(g > block && frame.grainRow(by)[tile.x + bx] != 1)
+                points.push_back(m_pixel{tile.x + bx, by});
         }
     }
+
+    if(points.empty())
+        return false;
+
+    if(points.size() == tile.width * tile.height
+            && mode == render_mode::subdivide) {
+        calcMandelbrotWorkerSubdiv(tile, frame);
+        for(uint32_t y = tile.y; y < bottom; y++)
+            std::fill_n(frame.grainRow(y) + tile.x, tile.width, 1);
+        return true;
+    }
+
+    calcPoints(points.data(), points.size(), frame);
+    for(const m_pixel& p : points)
+        frame.grainRow(p.y)[p.x] = 1;
+    return true;
+}
+
+void Mandelbrot::spreadAnchors(uint32_t y0, uint32_t h, uint32_t block) {
+    // Row by row, each coarse pixel takes the value of its block's anchor
+    uint32_t mask = ~(block - 1);
+    for(uint32_t y = y0; y < y0 + h; y++) {
+        const int32_t* a_it = frame.iterRow(y & mask);
+        const float* a_norm = frame.normRow(y & mask);
+        int32_t* it = frame.iterRow(y);
+        float* norm = frame.normRow(y);
+        uint8_t* grain = frame.grainRow(y);
+        for(uint32_t x = 0; x < frame.width; x++) {
+            if(grain[x] <= block)
+                continue;
+            it[x] = a_it[x & mask];
+            norm[x] = a_norm[x & mask];
+            grain[x] = block;
+        }
+    }
+}
+
+void Mandelbrot::colorizeFrame() {
+    uint32_t blocks = (frame.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+    runParallel(blocks, [&](uint32_t b, uint32_t worker) {
+        double start = collect_stats ? statsTime() : 0;
+        uint32_t yend = std::min(frame.height, (b + 1) * TILE_HEIGHT);
+        for(uint32_t y = b * TILE_HEIGHT; y < yend; y++)
+            coloring->getColors(frame.iterRow(y), frame.normRow(y),
+                    frame_lines.at(y), frame.width, *simd);
+        if(!aa_pixels.empty())
+            colorizeSamples(b * TILE_HEIGHT, yend);
+        if(collect_stats)
+            worker_phases.at(worker).push_back(phase_stats{"colorize",
+                    worker, start, statsTime()});
+    });
+}
+
+void Mandelbrot::colorizeTile(const m_tile& tile) {
+    for(uint32_t y = tile.y; y < tile.y + tile.height; y++)
+        coloring->getColors(frame.iterRow(y) + tile.x,
+                frame.normRow(y) + tile.x, frame_lines.at(y) + tile.x,
+                tile.width, *simd);
+}
+
+// Largest difference between the channels of two ARGB32 colors
+static uint32_t colorDelta(uint32_t a, uint32_t b) {
+    uint32_t d = 0;
+    for(uint32_t shift = 0; shift < 32; shift += 8) {
+        int32_t ca = (a >> shift) & 0xff;
+        int32_t cb = (b >> shift) & 0xff;
+        d = std::max<uint32_t>(d, std::abs(ca - cb));
+    }
+    return d;
+}
+
+// Position of sample s of pixel (x, y) relative to its center. The samples
+// of a pass cover the pixel in a grid of strata and are jittered within
+// them, the same way every time the pixel is sampled. Offsets are whole
+// multiples of 2^-24, so pixel positions plus offsets stay exact.
+static void sampleOffset(uint32_t x, uint32_t y, uint32_t s,
+        uint32_t samples, double& ox, double& oy) {
+    uint32_t k = std::ceil(std::sqrt(samples));
+    uint32_t stratum = s % samples * k * k / samples;
+
+    uint64_t h = (static_cast<uint64_t>(y) << 32 | x)
+            ^ static_cast<uint64_t>(s) * 0x9e3779b97f4a7c15ull;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    ox = std::round(((stratum % k + (h & 0xffffffff) * 0x1p-32) / k - 0.5)
+            * 0x1p24) * 0x1p-24;
+    oy = std::round(((stratum / k + (h >> 32) * 0x1p-32) / k - 0.5)
+            * 0x1p24) * 0x1p-24;
+}
+
+bool Mandelbrot::antialiasFrame() {
+    uint32_t pass = (aa_refine ? 2 : 1) - aa_left;
+    uint32_t bands = (frame.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    std::vector<std::vector<m_pixel>> found(bands);
+
+    if(pass == 0) {
+        // Edges are found on the colors of the frame, the image may hold
+        // anything
+        runParallel(bands, [&](uint32_t b, uint32_t) {
+            uint32_t y0 = b * TILE_HEIGHT;
+            uint32_t y1 = std::min(frame.height, y0 + TILE_HEIGHT);
+            uint32_t top = y0 > 0 ? y0 - 1 : 0;
+            uint32_t bottom = std::min(frame.height, y1 + 1);
+            std::vector<uint32_t> colors(
+                    static_cast<size_t>(frame.width) * (bottom - top));
+            for(uint32_t y = top; y < bottom; y++)
+                coloring->getColors(frame.iterRow(y), frame.normRow(y),
+                        colors.data() + (y - top) * frame.width,
+                        frame.width, *simd);
+
+            auto differ = [&](uint32_t x, uint32_t y, uint32_t nx,
+                    uint32_t ny) {
+                bool in = frame.iterRow(y)[x] == INT32_MIN;
+                bool n_in = frame.iterRow(ny)[nx] == INT32_MIN;
+                return in != n_in || colorDelta(
+                        colors.at((y - top) * frame.width + x),
+                        colors.at((ny - top) * frame.width + nx))
+                        > AA_COLOR_DELTA;
+            };
+            for(uint32_t y = y0; y < y1; y++) {
+                for(uint32_t x = 0; x < frame.width; x++) {
+                    if((x > 0 && differ(x, y, x - 1, y))
+                            || (x + 1 < frame.width && differ(x, y, x + 1, y))
+                            || (y > 0 && differ(x, y, x, y - 1))
+                            || (y + 1 < frame.height
+                                && differ(x, y, x, y + 1)))
+                        found.at(b).push_back(m_pixel{x, y});
+                }
+            }
+        });
+    } else {
+        // Pixels whose samples still disagree, looked at in chunks of rows
+        runParallel(bands, [&](uint32_t b, uint32_t) {
+            uint32_t y0 = b * TILE_HEIGHT;
+            uint32_t y1 = std::min(frame.height, y0 + TILE_HEIGHT);
+            auto it = std::lower_bound(aa_pixels.cbegin(), aa_pixels.cend(),
+                    y0, [](const aa_pixel& p, uint32_t y) {
+                return p.y < y;
+            });
+            std::vector<uint32_t> colors;
+            while(it != aa_pixels.cend() && it->y < y1) {
+                m_pixel p{it->x, it->y};
+                sampleColors(it, colors);
+                uint32_t spread = 0;
+                for(uint32_t c : colors)
+                    spread = std::max(spread, colorDelta(c, colors.front()));
+                if(spread > AA_COLOR_DELTA)
+                    found.at(b).push_back(p);
+            }
+        });
+    }
+
+    std::vector<m_pixel> pixels;
+    for(const std::vector<m_pixel>& f : found)
+        pixels.insert(pixels.end(), f.begin(), f.end());
+    return samplePixels(pixels, pass);
+}
+
+bool Mandelbrot::samplePixels(const std::vector<m_pixel>& pixels,
+        uint32_t pass) {
+    // Chunks of pixels balanced by the pool
+    const uint32_t chunk = 256;
+    uint32_t samples = aa_samples;
+    size_t n = pixels.size() * samples;
+    std::vector<int32_t> iterations(n);
+    std::vector<float> norms(n);
+
+    uint32_t chunks = (pixels.size() + chunk - 1) / chunk;
+    runParallel(chunks, [&](uint32_t c, uint32_t) {
+        if(cancelled && cancelled())
+            return;
+
+        uint32_t first = c * chunk;
+        uint32_t count = std::min<size_t>(chunk, pixels.size() - first)
+                * samples;
+        auto point = [&](uint32_t k, double& x, double& y) {
+            const m_pixel& p = pixels.at(first + k / samples);
+            double ox;
+            double oy;
+            sampleOffset(p.x, window_top + p.y, pass * samples
+                    + k % samples, samples, ox, oy);
+            x = p.x + ox;
+            y = p.y + oy;
+        };
+        auto store = [&](uint32_t k, const mcalc_result_simd& mb,
+                uint32_t l) {
+            iterations.at(first * samples + k) = mb.it[l];
+            norms.at(first * samples + k) = mb.norm[l];
+        };
+        calcLanes(count, point, store);
+    });
+    if(cancelled && cancelled())
+        return false;
+
+    uint32_t base = aa_iterations.size();
+    aa_iterations.insert(aa_iterations.end(), iterations.begin(),
+            iterations.end());
+    aa_norms.insert(aa_norms.end(), norms.begin(), norms.end());
+    for(uint32_t i = 0; i < pixels.size(); i++)
+        aa_pixels.push_back(aa_pixel{pixels.at(i).x, pixels.at(i).y,
+                base + i * samples, samples});
+    // Entries of earlier passes stay in front of the new ones
+    std::stable_sort(aa_pixels.begin(), aa_pixels.end(),
+            [](const aa_pixel& a, const aa_pixel& b) {
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
+    });
+    return true;
+}
+
+void Mandelbrot::sampleColors(std::vector<aa_pixel>::const_iterator& it,
+        std::vector<uint32_t>& colors) const {
+    uint32_t x = it->x;
+    uint32_t y = it->y;
+    size_t i = static_cast<size_t>(y) * frame.width + x;
+    colors.resize(1);
+    coloring->getColors(frame.iterations.data() + i, frame.norms.data() + i,
+            colors.data(), 1, *simd);
+    for(; it != aa_pixels.cend() && it->x == x && it->y == y; ++it) {
+        colors.resize(colors.size() + it->count);
+        coloring->getColors(aa_iterations.data() + it->first,
+                aa_norms.data() + it->first,
+                colors.data() + colors.size() - it->count, it->count,
+                *simd);
+    }
+}
+
+void Mandelbrot::colorizeSamples(uint32_t y0, uint32_t y1) {
+    auto it = std::lower_bound(aa_pixels.cbegin(), aa_pixels.cend(), y0,
+            [](const aa_pixel& p, uint32_t y) {
+        return p.y < y;
+    });
+    std::vector<uint32_t> colors;
+    while(it != aa_pixels.cend() && it->y < y1) {
+        uint32_t& pixel = frame_lines.at(it->y)[it->x];
+        sampleColors(it, colors);
+
+        uint32_t sum[4] = {0, 0, 0, 0};
+        for(uint32_t c : colors) {
+            for(uint32_t i = 0; i < 4; i++)
+                sum[i] += (c >> (8 * i)) & 0xff;
+        }
+        uint32_t n = colors.size();
+        pixel = 0;
+        for(uint32_t i = 0; i < 4; i++)
+            pixel |= (sum[i] + n / 2) / n << (8 * i);
+    }
+}
+
+void Mandelbrot::runParallel(uint32_t n,
+        const std::function<void(uint32_t, uint32_t)>& fn) {
+    if(!collect_stats) {
+        pool->parallelFor(n, fn);
+        return;
+    }
+
+    // Each worker only touches its own entry
+    std::vector<double> busy(pool->size(), 0.0);
+    double start = statsTime();
+    pool->parallelFor(n, [&](uint32_t i, uint32_t worker) {
+        double t = statsTime();
+        fn(i, worker);
+        busy.at(worker) += statsTime() - t;
+    });
+    double wall = statsTime() - start;
+
+    stats.busy.resize(pool->size(), 0.0);
+    stats.idle.resize(pool->size(), 0.0);
+    for(uint32_t w=0; w<busy.size(); w++) {
+        stats.busy.at(w) += busy.at(w);
+        stats.idle.at(w) += std::max(0.0, wall - busy.at(w));
+    }
+}
+
+double Mandelbrot::statsTime() const {
+    std::chrono::duration<double> diff = timer::now() - stats_start;
+    return diff.count();
+}
+
+void Mandelbrot::resetStats() {
+    static const char* const names[] = {"fp64", "dd", "perturbation"};
+
+    stats = frame_stats();
+    stats_start = timer::now();
+    stats.start = std::chrono::duration<double>(
+            stats_start.time_since_epoch()).count();
+    stats.width = frame.width;
+    stats.height = frame.height;
+    stats.max_iter = max_iter;
+    stats.threads = pool->size();
+    stats.precision = names[static_cast<uint32_t>(active_precision)];
+    for(uint32_t w=0; w<pool->size(); w++) {
+        worker_tiles.at(w).clear();
+        worker_phases.at(w).clear();
+    }
+}
+
+void Mandelbrot::recordTile(const m_tile& tile, uint32_t block,
+        uint32_t worker, double start, const std::vector<m_pixel>& points) {
+    tile_stats t = {tile, block, worker, start, statsTime(), 0, 0, 0, 0, 0};
+    for(const m_pixel& p : points) {
+        int32_t it = frame.iterRow(p.y)[p.x];
+        uint32_t n = it == INT32_MIN ? max_iter : it + 1;
+        t.pixels++;
+        if(it == INT32_MIN)
+            t.interior++;
+        else
+            t.escaped++;
+        t.iterations += n;
+        t.max_iterations = std::max(t.max_iterations, n);
+    }
+    worker_tiles.at(worker).push_back(t);
+}
+
+void Mandelbrot::mergeStats() {
+    for(uint32_t w=0; w<pool->size(); w++) {
+        for(const tile_stats& t : worker_tiles.at(w)) {
+            stats.pixels += t.pixels;
+            stats.escaped += t.escaped;
+            stats.interior += t.interior;
+            stats.iterations += t.iterations;
+            stats.max_iterations = std::max(stats.max_iterations,
+                    t.max_iterations);
+        }
+        stats.tiles.insert(stats.tiles.end(), worker_tiles.at(w).begin(),
+                worker_tiles.at(w).end());
+        stats.phases.insert(stats.phases.end(), worker_phases.at(w).begin(),
+                worker_phases.at(w).end());
+        worker_tiles.at(w).clear();
+        worker_phases.at(w).clear();
+    }
+}
+
+void Mandelbrot::finishStats() {
+    stats.histogram.fill(0);
+    for(int32_t it : frame.iterations) {
+        if(it == INT32_MIN)
+            continue;
+        uint32_t b = 0;
+        for(uint32_t n = it + 1; n > 1; n >>= 1)
+            b++;
+        stats.histogram.at(std::min(b, frame_stats::HISTOGRAM_BUCKETS - 1))++;
+    }
+}
+
+bool Mandelbrot::setIsa(isa level) {
+    const kernel_table* k = kernelsFor(level);
+    if(!k)
+        return false;
+
+    simd = k;
+    updateKernels();
+    if(cache)
+    // Tables without FMA have no dd kernel, deep frames may change
+    // Frames computed with other kernels may differ in the last bits
+    frame_max_iter = 0;
+    return true;
+}
+
+const kernel_table& Mandelbrot::kernelTable() const {
+    return *simd;
+}
+
+void Mandelbrot::updateKernels() {
+    uint32_t f = static_cast<uint32_t>(fractal);
+    kernel = simd->escape_time[f];
+}
+
+void Mandelbrot::setFormula(formula f) {
+    if(f == fractal)
+        return;
+
+    fractal = f;
+    updateKernels();
+    frame_max_iter = 0;
+    if(cache)
+        cache->clear();
+}
+
+formula Mandelbrot::getFormula() const {
+    return fractal;
+}
+
+void Mandelbrot::setJuliaConstant(double re, double im) {
+    if(re == julia_re && im == julia_im)
+        return;
+
+    julia_re = re;
+    julia_im = im;
+    if(formulaInfo(fractal).julia) {
+        frame_max_iter = 0;
+        if(cache)
+            cache->clear();
+    }
+}
+
+void Mandelbrot::setTileCache(uint32_t tiles) {
+    if(tiles == 0) {
+        // The frame's pixels move off the grid points, it starts over
+        cache.reset();
+        frame_on_grid = false;
+        frame_max_iter = 0;
+    } else if(!cache || cache->capacity() != tiles) {
+        cache = std::unique_ptr<TileCache>(new TileCache(tiles));
+    }
+}
+
+void Mandelbrot::setAntialiasing(uint32_t samples, bool refine) {
+    aa_samples = samples;
+    aa_refine = refine;
+    aa_pixels.clear();
+    aa_iterations.clear();
+    aa_norms.clear();
+    // A complete frame is antialiased by the next calls
+    bool complete = frame_max_iter != 0 && pass_block == 0;
+    aa_left = complete && samples > 0 ? (refine ? 2 : 1) : 0;
+}
+
+uint32_t Mandelbrot::getAntialiasing() const {
+    return aa_samples;
+}
+
+void Mandelbrot::setKeepOrbits(bool on) {
+    keep_orbits = on;
+    // Pixels iterated so far have no orbit
+    size_t pixels = on ? static_cast<size_t>(frame.width) * frame.height : 0;
+    if(orbit_re.size() != pixels) {
+        orbit_re.assign(pixels, INFINITY);
+        orbit_im.assign(pixels, INFINITY);
+        orbit_re.shrink_to_fit();
+        orbit_im.shrink_to_fit();
+    }
+}
+
+void Mandelbrot::setAutoIterations(bool on) {
+    auto_iter = on;
+}
+
+void Mandelbrot::setCancelCheck(const std::function<bool()>& c) {
+    cancelled = c;
+}
+
+void Mandelbrot::setTileCallback(const std::function<void(const m_tile&)>& cb) {
+    tile_done = cb;
+}
+
+// store of calcLanes_* for the pixels of tile in row-major order. Orbits
+// go to z_re and z_im, and whether the pixel is proven inside the set to
+// proven, laid out like buf, unless they are null.
+static auto tileStore(const m_tile& tile, iter_buffer& buf, double* z_re,
+        double* z_im, uint8_t* proven = nullptr) {
+    return [&tile, &buf, z_re, z_im, proven](uint32_t k,
+            const mcalc_result_simd& mb, uint32_t l) {
+        uint32_t x = tile.x + k % tile.width;
+        uint32_t y = tile.y + k / tile.width;
+        buf.iterRow(y)[x] = mb.it[l];
+        buf.normRow(y)[x] = mb.norm[l];
+        size_t i = static_cast<size_t>(y) * buf.width + x;
+        if(z_re) {
+            z_re[i] = mb.z_re[l];
+            z_im[i] = mb.z_im[l];
+        }
+        if(proven)
+            proven[i] = mb.it[l] == INT32_MIN && std::isnan(mb.z_re[l]);
+    };
+}
+
+template<class P, class S>
+void Mandelbrot::calcLanes(uint32_t n, P point, S store) {
+    if(active_precision == precision::perturbation) {
+        // The engine keeps no orbits
+        mcalc_result_simd mb;
+        mb.z_re[0] = INFINITY;
+        mb.z_im[0] = INFINITY;
+        for(uint32_t k = 0; k < n; k++) {
+            double x;
+            double y;
+            point(k, x, y);
+            auto r = perturbation->calcPoint(x, y);
+            mb.it[0] = r.second;
+            mb.norm[0] = r.first;
+            store(k, mb, 0);
+        }
+    } else if(active_precision == precision::dd) {
+        calcLanes_dd(n, frame.width, frame.height, point, store);
+    } else {
+        calcLanes_simd(n, frame.width, frame.height, point, store);
+    }
+}
+
+template<class P, class S>
+void Mandelbrot::calcLanes_simd(uint32_t n, uint32_t frame_width,
+        uint32_t frame_height, P point, S store) {
+    double real[MAX_LANES];
+    double imag[MAX_LANES];
+    uint32_t width = simd->lanes;
+    bool orbits = !orbit_re.empty() || !proven.empty();
+
+    for(uint32_t k = 0; k < n; k += width) {
+        uint32_t lanes = std::min(width, n - k);
+        for(uint32_t l = 0; l < width; l++) {
+            // Unused tail lanes repeat the last pixel
+            double x;
+            double y;
+            point(k + std::min(l, lanes - 1), x, y);
+            real[l] = pixelReal(x, frame_width);
+            imag[l] = pixelImag(y, frame_height);
+        }
+
+        mcalc_result_simd mb;
+        runKernel(kernel, width, PERIOD_EPS, real, imag, 0, orbits, mb);
+        for(uint32_t l = 0; l < lanes; l++)
+            store(k + l, mb, l);
+    }
+}
+
+void Mandelbrot::calcMandelbrotWorkerTiled_simd(const m_tile& tile,
+        iter_buffer& buf) {
+    // Lanes are filled in row-major order across row ends, so narrow tiles
+    // (down to single columns) still use every lane.
+    calcLanes_simd(tile.width * tile.height, buf.width, buf.height,
+            [&](uint32_t k, double& x, double& y) {
+                x = tile.x + k % tile.width;
+                y = tile.y + k / tile.width;
+            }, tileStore(tile, buf, orbitsRe(buf), orbitsIm(buf),
+                provenInside(buf)));
+}
+
+void Mandelbrot::calcMandelbrotWorkerTiled(const m_tile& tile,
+        iter_buffer& buf) {
+
+    for(uint32_t y = tile.y; y < tile.y + tile.height; y++) {
+        double imag = pixelImag(y, buf.height);
+
+        int32_t* it = buf.iterRow(y);
+        float* norm = buf.normRow(y);
+
+        for(uint32_t x = tile.x; x < tile.x + tile.width; x++) {
+            auto mb = calcMandelbrot(complex(pixelReal(x, buf.width), imag));
+            it[x] = mb.second;
+            norm[x] = mb.first;
+        }
+    }
+}
+
+void Mandelbrot::calcPixels(const m_tile& tile, iter_buffer& buf) {
+    if(active_precision == precision::perturbation) {
+        perturbation->calcTile(tile, buf);
+        return;
+    }
+
+    if(active_precision == precision::dd) {
+        calcMandelbrotWorkerTiled_dd(tile, buf);
+        return;
+    }
+
+    calcMandelbrotWorkerTiled_simd(tile, buf);
+}
+
+void Mandelbrot::calcPoints(const m_pixel* points, uint32_t n,
+        iter_buffer& buf) {
+    if(active_precision == precision::perturbation) {
+        perturbation->calcPoints(points, n, buf);
+        return;
+    }
+
+    auto point = [&](uint32_t k, double& x, double& y) {
+        x = points[k].x;
+        y = points[k].y;
+    };
+    double* z_re = orbitsRe(buf);
+    double* z_im = orbitsIm(buf);
+    auto store = [&](uint32_t k, const mcalc_result_simd& mb, uint32_t l) {
+        const m_pixel& p = points[k];
+        buf.iterRow(p.y)[p.x] = mb.it[l];
+        buf.normRow(p.y)[p.x] = mb.norm[l];
+        if(z_re) {
+            size_t i = static_cast<size_t>(p.y) * buf.width + p.x;
+            z_re[i] = mb.z_re[l];
+            z_im[i] = mb.z_im[l];
+        }
+    };
+
+    if(active_precision == precision::dd) {
+        calcLanes_dd(n, buf.width, buf.height, point, store);
+        return;
+    }
+
+    calcLanes_simd(n, buf.width, buf.height, point, store);
+}
+
+void Mandelbrot::calcMandelbrotWorkerSubdiv(const m_tile& tile,
+        iter_buffer& buf) {
+    if(tile.width <= 2 || tile.height <= 2) {
+        calcPixels(tile, buf);
+        return;
+    }
+
+    // Border of the tile: top and bottom rows, then the columns in between
+    uint32_t right = tile.x + tile.width - 1;
+    uint32_t bottom = tile.y + tile.height - 1;
+    calcPixels(m_tile{tile.x, tile.y, tile.width, 1}, buf);
+    calcPixels(m_tile{tile.x, bottom, tile.width, 1}, buf);
+    calcPixels(m_tile{tile.x, tile.y + 1, 1, tile.height - 2}, buf);
+    calcPixels(m_tile{right, tile.y + 1, 1, tile.height - 2}, buf);
+
+    subdivide(tile, buf);
+}
+
+bool Mandelbrot::borderInside(const m_tile& r, iter_buffer& buf) {
+    // A pixel that reached max_iter may still escape, and so may the
+    // filaments between such pixels
+    const uint8_t* p = provenInside(buf);
+    if(!p)
+        return false;
+    auto inside = [&](uint32_t x, uint32_t y) {
+        return p[static_cast<size_t>(y) * buf.width + x] != 0;
+    };
+
+    uint32_t right = r.x + r.width - 1;
+    uint32_t bottom = r.y + r.height - 1;
+    for(uint32_t x = r.x; x <= right; x++) {
+        if(!inside(x, r.y) || !inside(x, bottom))
+            return false;
+    }
+
+    for(uint32_t y = r.y + 1; y < bottom; y++) {
+        if(!inside(r.x, y) || !inside(right, y))
+            return false;
+    }
+
+    return true;
+}
+
+void Mandelbrot::subdivide(const m_tile& r, iter_buffer& buf) {
+    // The border of r is known, only its inner pixels are left.
+    if(r.width <= 2 || r.height <= 2)
+        return;
+
+    m_tile inner{r.x + 1, r.y + 1, r.width - 2, r.height - 2};
+
+    // The set is full, a closed curve inside it encloses nothing but the
+    // set. The border only samples such a curve, a filament may slip
+    // between two of its pixels; see setRenderMode. Escaping borders are
+    // never filled since their smooth colors differ per pixel.
+    if(borderInside(r, buf)) {
+        for(uint32_t y = inner.y; y < inner.y + inner.height; y++) {
+            std::fill_n(buf.iterRow(y) + inner.x, inner.width, INT32_MIN);
+            std::fill_n(buf.normRow(y) + inner.x, inner.width, 0.0f);
+        }
+        return;
+    }
+
+    if(inner.width * inner.height <= SUBDIV_MIN_PIXELS) {
+        calcPixels(inner, buf);
+        return;
+    }
+
+    // Split along a cross through the middle, which becomes the shared
+    // border of the four quadrants.
+    uint32_t xm = r.x + r.width / 2;
+    uint32_t ym = r.y + r.height / 2;
+    calcPixels(m_tile{inner.x, ym, inner.width, 1}, buf);
+    calcPixels(m_tile{xm, inner.y, 1, ym - inner.y}, buf);
+    calcPixels(m_tile{xm, ym + 1, 1, inner.y + inner.height - ym - 1}, buf);
+
+    uint32_t w1 = xm - r.x + 1;
+    uint32_t h1 = ym - r.y + 1;
+    uint32_t w2 = r.x + r.width - xm;
+    uint32_t h2 = r.y + r.height - ym;
+    subdivide(m_tile{r.x, r.y, w1, h1}, buf);
+    subdivide(m_tile{xm, r.y, w2, h1}, buf);
+    subdivide(m_tile{r.x, ym, w1, h2}, buf);
+    subdivide(m_tile{xm, ym, w2, h2}, buf);
+}
+
+// Analytic test for the main cardioid and the period-2 bulb, which hold
+// most of the interior of the set.
+static inline bool insideMainBulbs(double real, double imag) {
+    double xq = real - 0.25;
+    double y2 = imag * imag;
+    double q = xq * xq + y2;
+    if(q * (q + xq) <= 0.25 * y2)
+        return true;
+
+    double xb = real + 1;
+    return xb * xb + y2 <= 0.0625;
 }
 
 std::pair<double, int32_t> Mandelbrot::calcMandelbrot(const complex& c) const {
+    if(insideMainBulbs(c.getReal(), c.getImag()))
+        return std::make_pair(0.0, INT32_MIN);
+
     complex z0(0, 0);
     complex z1(c);
     int32_t cur_it = INT32_MIN;
 
+    // Brent-style cycle detection: compare against a point saved at
+    // iterations 1, 2, 4, 8, ...
+    complex saved(c);
+    uint32_t check = 1;
+
     for(uint32_t i=0; i<max_iter && z1.getAbs() < BAIL_OUT; i++) {
         z0.copy(z1);
         z1.mul(z0);
@@ -118,71 +1439,143 @@ std::pair<double, int32_t> Mandelbrot::calcMandelbrot(const complex& c) const {
             cur_it = i;
             break;
         }
+
+        if(std::abs(z1.getReal() - saved.getReal()) < PERIOD_EPS
+                && std::abs(z1.getImag() - saved.getImag()) < PERIOD_EPS)
+            break;
+
+        if(i == check) {
+            saved.copy(z1);
+            check *= 2;
+        }
     }
 
-    return std::make_pair(z1.getAbs(), cur_it);
+    return std::make_pair(cur_it == INT32_MIN ? 0.0 : z1.getAbs(), cur_it);
 }
 
-mcalc_result_avx Mandelbrot::calcMandelbrot_avx(double imag1,
-                                                double real1,
-                                                double imag2,
-                                                double real2) const {
-    double zreal1 = real1;
-    double zimag1 = imag1;
-    double zreal2 = real2;
-    double zimag2 = imag2;
-    double znorm1 = 0.0;
-    double znorm2 = 0.0;
-    int32_t it1 = INT32_MIN;
-    int32_t it2 = INT32_MIN;
+void Mandelbrot::runKernel(escape_kernel k, uint32_t lanes, double eps,
+        const double* real, const double* imag, uint32_t start, bool orbits,
+        mcalc_result_simd& res) const {
+    escape_params p = {max_iter, static_cast<double>(BAIL_OUT), eps,
+            julia_re, julia_im, orbits ? res.z_re : nullptr,
+            orbits ? res.z_im : nullptr, start};
+    k(real, imag, p, res.it, res.norm);
 
-    __m256d zc = _mm256_setr_pd(real1, imag1, real2, imag2);
-    __m256d neg = _mm256_setr_pd(1.0, -1.0, 1.0, -1.0);
-    __m256d zero = _mm256_setzero_pd();
+    uint32_t power = formulaInfo(fractal).power;
+    if(power != 2) {
+        for(uint32_t l = 0; l < lanes; l++) {
+            if(res.it[l] >= 0)
+                res.norm[l] = quadraticNorm(res.norm[l], power);
+        }
+    }
+}
 
-    for(uint32_t i=0; i<max_iter && (znorm1 < BAIL_OUT || znorm2 < BAIL_OUT);
-        i++) {
-        __m256d zx = _mm256_setr_pd(zreal1, zimag1, zreal2, zimag2);
-        __m256d zy = zx;
+mcalc_result_simd Mandelbrot::calcMandelbrot_simd(const double* real,
+                                                  const double* imag) const {
+    mcalc_result_simd res;
+    runKernel(kernel, simd->lanes, PERIOD_EPS, real, imag, 0, false, res);
+    return res;
+}
 
-        // z_n = z_(n-1)^2
-        __m256d zz = _mm256_mul_pd(zx, zy);
-        zy = _mm256_permute_pd(zy, 0x5);
-        zy = _mm256_mul_pd(zy, neg);
-        __m256d zw = _mm256_mul_pd(zx, zy);
-        zx = _mm256_hsub_pd(zz, zw);
+mcalc_result_simd Mandelbrot::calcMandelbrot_dd(const double* real_hi,
+        const double* real_lo, const double* imag_hi,
+        const double* imag_lo) const {
+    mcalc_result_simd res;
+    simd->escape_time_dd(real_hi, real_lo, imag_hi, imag_lo, max_iter,
+            BAIL_OUT, res.it, res.norm);
+    return res;
+}
 
-        // z_n = z_(n-1)^2 + c
-        zx = _mm256_add_pd(zx, zc);
+// off + x * step as double-double hi + lo
+static inline void ddPixel(const double* off, double x, double step,
+        double& hi, double& lo) {
+    double p = x * step;
+    double pe = std::fma(x, step, -p);
 
-        // |z_n|
-        __m256d zd = _mm256_mul_pd(zx, zx);
-        zd = _mm256_hadd_pd(zd, zero);
+    double s = off[0] + p;
+    double bb = s - off[0];
+    double e = (off[0] - (s - bb)) + (p - bb) + off[1] + pe;
 
-        if(znorm1 < BAIL_OUT) {
-            zreal1 = zx[0];
-            zimag1 = zx[1];
-            znorm1 = zd[0];
-        }
+    hi = s + e;
+    lo = e - (hi - s);
+}
+
+template<class P, class S>
+void Mandelbrot::calcLanes_dd(uint32_t n, uint32_t frame_width,
+        uint32_t frame_height, P point, S store) {
+    double real_hi[MAX_LANES];
+    double real_lo[MAX_LANES];
+    double imag_hi[MAX_LANES];
+    double imag_lo[MAX_LANES];
+    uint32_t width = simd->lanes;
 
-        if(znorm2 < BAIL_OUT) {
-            zreal2 = zx[2];
-            zimag2 = zx[3];
-            znorm2 = zd[2];
+    // Bands keep the rows of the whole image, as in pixelImag
+    uint32_t rows = window_height != 0 ? window_height : frame_height;
+    double step_x = dimensions.m_width / (frame_width - 1);
+    double step_y = dimensions.m_height / (rows - 1);
+
+    for(uint32_t k = 0; k < n; k += width) {
+        uint32_t lanes = std::min(width, n - k);
+        for(uint32_t l = 0; l < width; l++) {
+            double x;
+            double y;
+            point(k + std::min(l, lanes - 1), x, y);
+            ddPixel(dd_offset_x, x, step_x, real_hi[l], real_lo[l]);
+            ddPixel(dd_offset_y, -(window_top + y), step_y, imag_hi[l],
+                    imag_lo[l]);
         }
 
-        if(znorm1 >= BAIL_OUT && it1 == INT32_MIN)
-            it1 = i;
-        if(znorm2 >= BAIL_OUT && it2 == INT32_MIN)
-            it2 = i;
+        auto mb = calcMandelbrot_dd(real_hi, real_lo, imag_hi, imag_lo);
+        for(uint32_t l = 0; l < lanes; l++)
+            store(k + l, mb, l);
     }
+}
 
-    return mcalc_result_avx{znorm1, znorm2, it1, it2};
+void Mandelbrot::calcMandelbrotWorkerTiled_dd(const m_tile& tile,
+        iter_buffer& buf) {
+    calcLanes_dd(tile.width * tile.height, buf.width, buf.height,
+            [&](uint32_t k, double& x, double& y) {
+                x = tile.x + k % tile.width;
+                y = tile.y + k / tile.width;
+            }, tileStore(tile, buf, nullptr, nullptr));
 }
 
 void Mandelbrot::updateComplexDimensions(const m_dimension& d) {
-    dimensions.m_height = d.m_height;
-    dimensions.m_width = d.m_width;
-    dimensions.m_offset_x = d.m_offset_x;
-    dimensions.m_offset_y = d.m_offset_y;
+    dimensions = d;
+}
+
+void Mandelbrot::setFrameWindow(uint32_t top, uint32_t height) {
+    if(top == window_top && height == window_height)
+        return;
+
+    window_top = height != 0 ? top : 0;
+    window_height = height;
+    frame_max_iter = 0;
+}
+
+void Mandelbrot::setMaxIter(uint32_t it) {
+    max_iter = std::max<uint32_t>(it, 1);
+}
+
+uint32_t Mandelbrot::getMaxIter() const {
+    return max_iter;
+}
+
+precision Mandelbrot::selectPrecision(uint32_t width, uint32_t height) const {
+    // Pixels closer than this relative to the coordinates no longer get
+    // distinct double values after the orbit amplifies rounding errors.
+    double step = std::min(dimensions.m_width / (width - 1),
+            dimensions.m_height / (height - 1));
+    double scale = std::max({std::abs(dimensions.m_offset_x),
+            std::abs(dimensions.m_offset_y),
+            std::abs(dimensions.m_offset_x + dimensions.m_width),
+            std::abs(dimensions.m_offset_y - dimensions.m_height), 1.0});
+
+    if(fractal != formula::mandelbrot || step >= scale * DD_ZOOM_STEP)
+        return precision::fp64;
+
+    if(simd->escape_time_dd && step >= scale * DEEP_ZOOM_STEP)
+        return precision::dd;
+
+    return precision::perturbation;
 }
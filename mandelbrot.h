@@ -9,56 +9,451 @@
 #include <math.h>
 #include <iostream>
 #include <immintrin.h>
+#include <functional>
+#include <memory>
 #include <utility>
-#include <QPainter>
+#include "argb_image.h"
 #include "complex.h"
+#include "dimension.h"
+#include "iter_buffer.h"
+#include "kernels.h"
+#include "perturbation.h"
+#include "render_stats.h"
 #include "smooth_color.h"
+#include "tile_cache.h"
+#include "thread_pool.h"
 
 using timer = std::chrono::high_resolution_clock;
 
-struct m_dimension {
-    double m_offset_x;
-    double m_offset_y;
-    double m_width;
-    double m_height;
+enum class render_mode {
+    // Iterate every pixel
+    full,
+    // Mariani-Silver: fill rectangles whose border is known to lie inside
+    // the set, subdivide the others
+    subdivide
 };
 
-struct mcalc_result_avx {
-    double abs1;
-    double abs2;
-    int32_t it1;
-    int32_t it2;
+// Arithmetic used for the escape-time iteration, chosen per frame from the
+// pixel spacing.
+enum class precision {
+    fp64,
+    // Double-double SIMD kernel
+    dd,
+    perturbation
+};
+
+// Results of one call of the vectorized kernels, the first lanes of the
+// kernel table are used
+struct mcalc_result_simd {
+    double norm[MAX_LANES];
+    int32_t it[MAX_LANES];
+    // z of the lanes still iterating at the limit, NaN for the others.
+    // Only filled in where runKernel is asked for orbits.
+    double z_re[MAX_LANES];
+    double z_im[MAX_LANES];
+};
+
+// Extra samples of a pixel, held at aa_iterations[first] and on
+struct aa_pixel {
+    uint32_t x;
+    uint32_t y;
+    uint32_t first;
+    uint32_t count;
 };
 
 class Mandelbrot
 {
 private:
     std::unique_ptr<Coloring> coloring;
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<Perturbation> perturbation;
     uint32_t max_iter;
     m_dimension dimensions;
+    iter_buffer frame;
+    // Previous contents of frame while they are reprojected
+    iter_buffer prev_frame;
+    // Viewport and iteration limit frame was computed for, a limit of 0
+    // marks it as empty
+    m_dimension frame_dimensions;
+    uint32_t frame_max_iter;
+    // Rows of the image the frame is a band of, see setFrameWindow. A
+    // height of 0 makes the frame the whole image.
+    uint32_t window_top;
+    uint32_t window_height;
+    // Block size of the next refinement pass, 0 once the frame is complete
+    uint32_t pass_block;
+    // Block size new frames start at
+    uint32_t preview_block;
+    // Scratch list of pixels to iterate, per pool worker
+    std::vector<std::vector<m_pixel>> worker_points;
+    // ARGB32 scanlines of the frame being refreshed
+    std::vector<uint32_t*> frame_lines;
+    std::function<bool()> cancelled;
+    std::function<void(const m_tile&)> tile_done;
+    bool print_timing;
+    // Instrumentation of the frame being refined, see setCollectStats
+    bool collect_stats;
+    frame_stats stats;
+    timer::time_point stats_start;
+    // Tiles and phases recorded per pool worker, merged into stats after
+    // each parallel section
+    std::vector<std::vector<tile_stats>> worker_tiles;
+    std::vector<std::vector<phase_stats>> worker_phases;
+    render_mode mode;
+    precision active_precision;
+    // Vectorized kernels of the CPU's instruction set
+    const kernel_table* simd;
+    formula fractal;
+    double julia_re;
+    double julia_im;
+    // Kernels of fractal in simd
+    escape_kernel kernel;
+    // Exact frame offset as double-double for the dd kernel
+    double dd_offset_x[2];
+    double dd_offset_y[2];
+    // Results on the quadtree grid, null while off
+    std::unique_ptr<TileCache> cache;
+    // Whether the frame's pixels lie on the grid of a cached level. Its
+    // pixel (0, 0) is then grid point (grid_x, grid_y) of grid_level.
+    bool frame_on_grid;
+    int32_t grid_level;
+    int64_t grid_x;
+    int64_t grid_y;
+    double grid_step;
+    // Grid tiles around the complete frame left to prefetch, the most
+    // likely needed last
+    std::vector<tile_key> prefetch_queue;
+    // Antialiasing, see setAntialiasing
+    uint32_t aa_samples;
+    bool aa_refine;
+    // Antialiasing passes left to run on the complete frame
+    uint32_t aa_left;
+    // Pixels given samples, by row and column. A pixel refined twice has
+    // an entry per pass, one after the other.
+    std::vector<aa_pixel> aa_pixels;
+    std::vector<int32_t> aa_iterations;
+    std::vector<float> aa_norms;
+    // Orbits kept for resuming frames, see setKeepOrbits: z of every pixel
+    // at frame_max_iter in row-major order. NaN where the pixel escaped or
+    // its orbit was found periodic, infinity where it is not known.
+    std::vector<double> orbit_re;
+    std::vector<double> orbit_im;
+    bool keep_orbits;
+    // Subdivide mode only: 1 for pixels of the frame proven inside the set
+    // by the main bulb test or a detected cycle, rather than by reaching
+    // max_iter. Only fp64 frames prove any.
+    std::vector<uint8_t> proven;
+    // Coordinates the frame's columns and rows were sampled at, NaN where
+    // the kernel does not take them as plain doubles. Pixels only carry
+    // over to a new frame where these match bit for bit.
+    std::vector<double> sample_re;
+    std::vector<double> sample_im;
+    // Raises max_iter after complete frames, see setAutoIterations
+    bool auto_iter;
+
+    std::vector<m_tile> splitTiles(const m_tile& area) const;
+    // Whole pixel offset (dx, dy) from the viewport of the previous frame
+    // to the current one, if that frame can be reused
+    bool frameShift(int32_t& dx, int32_t& dy) const;
+    // Runs the next refinement pass of the frame and sets block to its
+    // block size, 0 if the frame was complete already. Returns false if the
+    // pass was cancelled before all of its tiles were done.
+    bool iterateFrame(uint32_t& block);
+    // Whether the complete frame only lacks the iterations from
+    // frame_max_iter up to max_iter
+    bool canResume() const;
+    // Iterates the pixels of the complete frame that had not escaped on
+    // to max_iter, false if cancelled
+    bool resumeFrame();
+    // Doubles max_iter if the last iterations added to the complete frame
+    // let enough of its pixels escape
+    void raiseIterations();
+    // orbit_re and orbit_im if buf is the frame and its orbits are kept,
+    // else null
+    double* orbitsRe(const iter_buffer& buf) {
+        return keepsOrbits(buf) ? orbit_re.data() : nullptr;
+    }
+    double* orbitsIm(const iter_buffer& buf) {
+        return keepsOrbits(buf) ? orbit_im.data() : nullptr;
+    }
+    bool keepsOrbits(const iter_buffer& buf) const {
+        return &buf == &frame && !orbit_re.empty()
+                && active_precision == precision::fp64;
+    }
+    // proven if buf is the frame and its pixels are told apart, else null
+    uint8_t* provenInside(const iter_buffer& buf) {
+        return &buf == &frame && proven.size() == buf.iterations.size()
+                && active_precision == precision::fp64
+                ? proven.data() : nullptr;
+    }
+    void preparePrecision();
+    // Sample coordinates of the current viewport's columns and rows at
+    // precision p, as sample_re and sample_im
+    void sampleAxes(precision p, std::vector<double>& re,
+            std::vector<double>& im) const;
+    // Looks the kernels of fractal up in simd
+    void updateKernels();
+    // Moves the frame by whole pixels, see iter_buffer::scroll
+    void scrollFrame(int32_t dx, int32_t dy, const std::vector<double>& re,
+            const std::vector<double>& im);
+    // Resamples the previous frame into the current viewport
+    void reprojectFrame(const std::vector<double>& re,
+            const std::vector<double>& im);
+    // Whether the cache holds every grid tile the frame overlaps
+    bool gridCached() const;
+    // Copies the cached grid tiles over the frame
+    void loadGridTiles();
+    // Caches the grid tiles lying wholly inside the complete frame
+    void storeGridTiles();
+    // Queues the tiles a pan or a zoom by one level may show next
+    void queuePrefetch();
+    void iterateGridTile(const tile_key& k, grid_tile& t) const;
+    // Refinement pass with the given block size: iterates the anchors of
+    // the tile's coarse blocks, spreadAnchors then copies them over the
+    // coarse pixels of the rows y0 .. y0 + h. Returns whether any pixel of
+    // the tile was iterated.
+    bool refineTile(const m_tile& tile, uint32_t block,
+            std::vector<m_pixel>& points);
+    void spreadAnchors(uint32_t y0, uint32_t h, uint32_t block);
+    void colorizeFrame();
+    void colorizeTile(const m_tile& tile);
+    // Runs the next antialiasing pass, false if it was cancelled
+    bool antialiasFrame();
+    // Iterates the samples of pass for pixels and adds them to aa_pixels
+    bool samplePixels(const std::vector<m_pixel>& pixels, uint32_t pass);
+    // Colors of the samples of the pixel whose entries start at it, which
+    // is moved past them
+    void sampleColors(std::vector<aa_pixel>::const_iterator& it,
+            std::vector<uint32_t>& colors) const;
+    // Averages the samples of the pixels in rows y0 ... y1 - 1 into them
+    void colorizeSamples(uint32_t y0, uint32_t y1);
+
+    // pool->parallelFor that, while stats are collected, also accounts the
+    // time of every task as busy for its worker and the rest of the section
+    // as idle
+    void runParallel(uint32_t n,
+            const std::function<void(uint32_t, uint32_t)>& fn);
+    // Seconds since the frame started
+    double statsTime() const;
+    void resetStats();
+    // Records the tile whose pixels refineTile just iterated
+    void recordTile(const m_tile& tile, uint32_t block, uint32_t worker,
+            double start, const std::vector<m_pixel>& points);
+    void mergeStats();
+    // Escape iteration histogram of the finished frame
+    void finishStats();
+
+    // Complex coordinates of a pixel in a width x height frame. Frames on
+    // the grid use the grid points, to the last bit.
+    double pixelReal(double x, uint32_t width) const {
+        if(frame_on_grid)
+            return (grid_x + x) * grid_step;
+        return dimensions.m_offset_x + (x / (width - 1)) * dimensions.m_width;
+    }
+    double pixelImag(double y, uint32_t height) const {
+        if(frame_on_grid)
+            return -(grid_y + y) * grid_step;
+        if(window_height != 0) {
+            y += window_top;
+            height = window_height;
+        }
+        return dimensions.m_offset_y - (y / (height - 1)) * dimensions.m_height;
+    }
+    // Rows of the image the viewport spans
+    uint32_t imageHeight() const {
+        return window_height != 0 ? window_height : frame.height;
+    }
+
+    // Iterates every pixel of the tile with the best available kernel
+    void calcPixels(const m_tile& tile, iter_buffer& buf);
+    // Same for a list of pixels
+    void calcPoints(const m_pixel* points, uint32_t n, iter_buffer& buf);
+
+    // Runs k, a kernel of lanes pixels, into res and maps its norms for
+    // the coloring. Orbits from start on continue from res.z_re and
+    // res.z_im; with orbits the kernel leaves the final z there.
+    void runKernel(escape_kernel k, uint32_t lanes, double eps,
+            const double* real, const double* imag, uint32_t start,
+            bool orbits, mcalc_result_simd& res) const;
+
+    // calcLanes_* of the frame's precision, or the perturbation engine one
+    // point at a time, on positions in the frame
+    template<class P, class S>
+    void calcLanes(uint32_t n, P point, S store);
+    // Iterates n points a vector of lanes at a time. point(k, x, y) yields
+    // the position of the k-th one in pixels of a frame_width x
+    // frame_height frame, which need not be whole, store(k, mb, l) takes
+    // its result from lane l of mb.
+    template<class P, class S>
+    void calcLanes_simd(uint32_t n, uint32_t frame_width,
+            uint32_t frame_height, P point, S store);
+    template<class P, class S>
+    void calcLanes_dd(uint32_t n, uint32_t frame_width,
+            uint32_t frame_height, P point, S store);
+    bool borderInside(const m_tile& r, iter_buffer& buf);
+    void subdivide(const m_tile& r, iter_buffer& buf);
 
 public:
     const uint32_t BAIL_OUT = 32;
+    // Orbits returning this close to an earlier point are taken as periodic
+    // and thus inside the set.
+    const double PERIOD_EPS = 1e-13;
+    const uint32_t TILE_WIDTH = 64;
+    const uint32_t TILE_HEIGHT = 32;
+    // Rectangles up to this many inner pixels are iterated directly
+    const uint32_t SUBDIV_MIN_PIXELS = 64;
+    // Pixel spacing, relative to the coordinates, below which frames switch
+    // to the double-double kernel and then to the perturbation engine
+    const double DD_ZOOM_STEP = 1e-13;
+    const double DEEP_ZOOM_STEP = 1e-28;
+    // Default block size of the first refinement pass, a power of two
+    // dividing the tile size
+    const uint32_t PREVIEW_BLOCK = 16;
+    // Difference in a color channel between neighbouring pixels above which
+    // antialiasing samples them
+    const uint32_t AA_COLOR_DELTA = 24;
+    // Automatic iteration limits double while more than this fraction of
+    // the frame escapes in the upper half of the limit, up to
+    // AUTO_ITER_MAX
+    const double AUTO_ITER_ESCAPES = 1e-3;
+    const uint32_t AUTO_ITER_MAX = 1 << 20;
+
+    explicit Mandelbrot(
+            uint32_t threads = std::thread::hardware_concurrency());
 
-    Mandelbrot();
+    void setThreads(uint32_t t);
+    // Subdivide mode only fills rectangles whose border pixels are all
+    // proven inside the set, by the main bulb test or a detected cycle;
+    // pixels that merely reach the iteration limit do not count. The fill
+    // relies on the set being full, but the border is only sampled at
+    // pixels: a filament thinner than a pixel may still pass between two
+    // border samples and be filled over, so the mode may rarely differ
+    // from full mode. fp64 frames only, the others are iterated in full.
+    // Costs a byte per pixel.
+    void setRenderMode(render_mode m);
+    void setColoring(std::unique_ptr<Coloring> c);
+    // Prints the time of every pass to stdout, off by default
+    void setPrintTiming(bool p);
+    // Records per-tile timings, iteration counts and worker idle time of
+    // every frame, off by default
+    void setCollectStats(bool c);
+    // Statistics of the frame being refined, complete once
+    // refreshMandelbrotTiled returned true. Empty unless collected.
+    const frame_stats& frameStats() const;
+    // Iteration counts and norms of the frame, complete once
+    // refreshMandelbrotTiled returned true
+    const iter_buffer& frameResults() const;
+    // Block size of the first pass of new frames, rounded down to a power
+    // of two dividing the tile size
+    void setPreviewBlock(uint32_t block);
+    // Renders a frame into image. The escape-time pass fills the iteration
+    // buffer first, a second pass colorizes it straight into the image's
+    // ARGB32 rows.
+    //
+    // Frames are refined progressively, one pass per call. A new viewport
+    // starts from the previous frame: scrolled if it was only panned by
+    // whole pixels, resampled otherwise. Passes then iterate one pixel per
+    // block of the preview size, a quarter of that, ... 1 pixels wherever
+    // the frame is coarser, reusing every pixel already iterated. A higher
+    // iteration limit on a complete frame is added in a single pass, see
+    // setKeepOrbits. Returns true once the frame is complete.
+    //
+    // The final pass colorizes each tile as soon as it is iterated and hands
+    // the ones that changed to the tile callback.
+    bool refreshMandelbrotTiled(const argb_image& image);
 
-    void refreshMandelbrotTiled(std::vector<QImage>& tiles);
-    mcalc_result_avx calcMandelbrotTiled_avx(double real1,
-            double imag1, double real2, double imag2) const;
-    void calcMandelbrotWorkerTiled_avx(uint32_t hstart, uint32_t hend, 
-            uint32_t width, uint32_t height, QImage& time);
+    // Polled by the workers between tiles. Once it returns true the running
+    // pass is abandoned and refreshMandelbrotTiled returns without
+    // colorizing; the next call resumes the frame where it stopped.
+    void setCancelCheck(const std::function<bool()>& c);
+    // Called from the pool workers with each tile the final pass completed
+    void setTileCallback(const std::function<void(const m_tile&)>& cb);
 
-    mcalc_result_avx calcMandelbrot_avx(double real1,
-                                        double imag1,
-                                        double real2,
-                                        double imag2) const;
+    // Kernels of the given instruction set instead of the detected one, for
+    // the escape time and the coloring alike. False if the CPU does not
+    // support it.
+    bool setIsa(isa level);
+    const kernel_table& kernelTable() const;
 
-    void calcMandelbrotWorkerTiled(uint32_t hstart, uint32_t hend, 
-            uint32_t width, uint32_t height, QImage& buf);
+    // Formula to iterate, mandelbrot by default. The others never switch
+    // past fp64, deep zooms into them run out of precision.
+    void setFormula(formula f);
+    formula getFormula() const;
+    // c of the Julia formulas, -0.8 + 0.156i by default
+    void setJuliaConstant(double re, double im);
+    // Antialiases the edges of complete frames, off (0 samples) by default.
+    // Pixels whose color differs from a neighbour's by more than
+    // AA_COLOR_DELTA in a channel, or that lie inside the set next to one
+    // outside, get samples jittered samples and show their average. With
+    // refine a second pass samples the pixels whose samples still differ
+    // that much as often again. Each pass is one more call of
+    // refreshMandelbrotTiled.
+    void setAntialiasing(uint32_t samples, bool refine);
+    // Samples of antialiased pixels, 0 while off
+    uint32_t getAntialiasing() const;
+    // Raising the iteration limit of a complete frame without changing the
+    // viewport only iterates the pixels that had not escaped, in a single
+    // pass; the others keep their results. With orbits kept, fp64 frames
+    // continue those pixels from their last z at the cost of 16 bytes per
+    // pixel. Otherwise, and for pixels taken from an earlier frame or the
+    // tile cache, they start over. Off by default.
+    void setKeepOrbits(bool on);
+    // Doubles the iteration limit after each complete frame while more
+    // than AUTO_ITER_ESCAPES of its pixels escaped in the upper half of
+    // the limit, or none escaped at all, so every such frame is followed
+    // by a resumed one. Only ever raises the limit. Off by default.
+    void setAutoIterations(bool on);
+
+    // Keeps the results of up to tiles tiles of the quadtree grid of
+    // tile_cache.h, 0 turns the cache off. Frames whose pixels lie on the
+    // grid start from the cached tiles and add theirs once complete, so
+    // returning to a view only iterates what was never seen. Subdivide
+    // mode frames neither use nor fill the cache.
+    void setTileCache(uint32_t tiles);
+    // Iterates a batch of the grid tiles around the complete frame, at its
+    // level and one level in and out, that are not cached yet. Returns
+    // false once none are left or the batch was cancelled.
+    bool prefetchTiles();
+
+    // Workers iterate one tile of buf, sized to the whole frame.
+    void calcMandelbrotWorkerTiled_simd(const m_tile& tile, iter_buffer& buf);
+
+    // Iterates kernelTable().lanes pixels at once with the kernel of the
+    // formula. real and imag hold one coordinate per lane (structure of
+    // arrays).
+    mcalc_result_simd calcMandelbrot_simd(const double* real,
+                                          const double* imag) const;
+
+
+    // Needs a table with a double-double kernel, mandelbrot formula only
+    void calcMandelbrotWorkerTiled_dd(const m_tile& tile, iter_buffer& buf);
+
+    // calcMandelbrot_simd on double-double coordinates hi + lo
+    mcalc_result_simd calcMandelbrot_dd(const double* real_hi,
+            const double* real_lo, const double* imag_hi,
+            const double* imag_lo) const;
+
+    // Plain scalar z^2 + c whatever the formula, the reference for the
+    // kernels
+    void calcMandelbrotWorkerTiled(const m_tile& tile, iter_buffer& buf);
+
+    // Computes the tile's border and recursively subdivides it
+    void calcMandelbrotWorkerSubdiv(const m_tile& tile, iter_buffer& buf);
 
     std::pair<double, int32_t> calcMandelbrot(const complex& c) const;
 
     void updateComplexDimensions(const m_dimension& d);
+    // Makes frames the rows top ... top + image height - 1 of an image of
+    // the viewport that is height rows high, so an image rendered band by
+    // band gets the very samples a single frame of it would. A height of
+    // 0, the default, makes frames the whole image. Such bands never use
+    // the tile cache.
+    void setFrameWindow(uint32_t top, uint32_t height);
+
+    void setMaxIter(uint32_t it);
+    uint32_t getMaxIter() const;
+
+    precision selectPrecision(uint32_t width, uint32_t height) const;
 };
 
 
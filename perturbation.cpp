@@ -0,0 +1,177 @@
+#include <cmath>
+#include <algorithm>
+#include "perturbation.h"
+
+Perturbation::Perturbation(): skip(0), max_iter(0), bail_out(0), ref_x(0),
+    ref_y(0), step_x(0), step_y(0) {
+}
+
+void Perturbation::prepare(const m_dimension& d, uint32_t width,
+        uint32_t height, uint32_t max_iter, double bail_out, uint32_t top) {
+    this->max_iter = max_iter;
+    this->bail_out = bail_out;
+
+    step_x = d.m_width / (width - 1);
+    step_y = d.m_height / (height - 1);
+    ref_x = (width - 1) / 2.0;
+    ref_y = (height - 1) / 2.0 - top;
+
+    // The reference needs the bits down to the pixel spacing plus guard
+    // bits, anything below is noise to the double deltas.
+    double step = std::min(step_x, step_y);
+    uint32_t bits = static_cast<uint32_t>(std::max(0.0, -std::log2(step)))
+            + 64;
+
+    bigfloat cr = exactOffsetX(d) + bigfloat(d.m_width / 2);
+    bigfloat ci = exactOffsetY(d) - bigfloat(d.m_height / 2);
+
+    calcReferenceOrbit(cr.truncated(bits), ci.truncated(bits));
+    calcSeriesApproximation(std::hypot(d.m_width / 2, d.m_height / 2));
+}
+
+void Perturbation::calcReferenceOrbit(const bigfloat& cr,
+        const bigfloat& ci) {
+    ref_real.assign(1, 0.0);
+    ref_imag.assign(1, 0.0);
+
+    // Products truncate to the precision of c, so z never grows beyond it
+    bigfloat zr;
+    bigfloat zi;
+    for(uint32_t n=0; n<=max_iter; n++) {
+        bigfloat zr2 = zr * zr;
+        bigfloat zi2 = zi * zi;
+        bigfloat zri = zr * zi;
+        zr = zr2 - zi2 + cr;
+        zi = zri + zri + ci;
+
+        double r = zr.toDouble();
+        double i = zi.toDouble();
+        ref_real.push_back(r);
+        ref_imag.push_back(i);
+
+        if(r * r + i * i >= bail_out)
+            break;
+    }
+}
+
+void Perturbation::calcSeriesApproximation(double delta_max) {
+    complex a;
+    complex b;
+    complex c;
+    complex one(1, 0);
+    complex two(2, 0);
+    double d2 = delta_max * delta_max;
+    double d3 = d2 * delta_max;
+
+    // A_(n+1) = 2 Z_n A_n + 1
+    // B_(n+1) = 2 Z_n B_n + A_n^2
+    // C_(n+1) = 2 Z_n C_n + 2 A_n B_n
+    // Stop once the cubic term is no longer negligible against the
+    // quadratic one. At least one reference step is left to the pixels.
+    skip = 0;
+    for(uint32_t n=0; n + 2 < ref_real.size(); n++) {
+        complex two_z(2 * ref_real.at(n), 2 * ref_imag.at(n));
+        complex na = two_z * a + one;
+        complex nb = two_z * b + a * a;
+        complex nc = two_z * c + a * b * two;
+
+        if(std::sqrt(nc.getAbs()) * d3 > SA_EPS * std::sqrt(nb.getAbs()) * d2)
+            break;
+
+        a.copy(na);
+        b.copy(nb);
+        c.copy(nc);
+        skip = n + 1;
+    }
+
+    sa_a.copy(a);
+    sa_b.copy(b);
+    sa_c.copy(c);
+}
+
+std::pair<double, int32_t> Perturbation::calcPixel(double dcr,
+        double dci) const {
+    // d_skip from the series approximation
+    double dc2r = dcr * dcr - dci * dci;
+    double dc2i = 2 * dcr * dci;
+    double dc3r = dc2r * dcr - dc2i * dci;
+    double dc3i = dc2r * dci + dc2i * dcr;
+
+    double dr = sa_a.getReal() * dcr - sa_a.getImag() * dci
+            + sa_b.getReal() * dc2r - sa_b.getImag() * dc2i
+            + sa_c.getReal() * dc3r - sa_c.getImag() * dc3i;
+    double di = sa_a.getReal() * dci + sa_a.getImag() * dcr
+            + sa_b.getReal() * dc2i + sa_b.getImag() * dc2r
+            + sa_c.getReal() * dc3i + sa_c.getImag() * dc3r;
+
+    uint32_t last = ref_real.size() - 1;
+    uint32_t m = skip;
+    double zn = 0;
+
+    // n counts iterations of z as the other kernels do: z_1 = c, and the
+    // first escape they can report is z_2 as iteration 0.
+    for(uint32_t n=skip; n<=max_iter;) {
+        double tr = 2 * ref_real[m] + dr;
+        double ti = 2 * ref_imag[m] + di;
+        double ndr = tr * dr - ti * di + dcr;
+        double ndi = tr * di + ti * dr + dci;
+        dr = ndr;
+        di = ndi;
+        n++;
+        m++;
+
+        double zr = ref_real[m] + dr;
+        double zi = ref_imag[m] + di;
+        zn = zr * zr + zi * zi;
+
+        if(zn >= bail_out)
+            return std::make_pair(zn, static_cast<int32_t>(n >= 2 ? n - 2 : 0));
+
+        // Rebase onto Z_0 = 0 when the delta dominates z (glitch) or the
+        // reference orbit ends.
+        if(zn < dr * dr + di * di || m == last) {
+            dr = zr;
+            di = zi;
+            m = 0;
+        }
+    }
+
+    return std::make_pair(0.0, INT32_MIN);
+}
+
+void Perturbation::calcTile(const m_tile& tile, iter_buffer& buf) const {
+    for(uint32_t y = tile.y; y < tile.y + tile.height; y++) {
+        double dci = -(y - ref_y) * step_y;
+        int32_t* it = buf.iterRow(y);
+        float* norm = buf.normRow(y);
+
+        for(uint32_t x = tile.x; x < tile.x + tile.width; x++) {
+            auto mb = calcPixel((x - ref_x) * step_x, dci);
+            it[x] = mb.second;
+            norm[x] = mb.first;
+        }
+    }
+}
+
+void Perturbation::calcPoints(const m_pixel* points, uint32_t n,
+        iter_buffer& buf) const {
+    for(uint32_t k = 0; k < n; k++) {
+        const m_pixel& p = points[k];
+        auto mb = calcPoint(p.x, p.y);
+        buf.iterRow(p.y)[p.x] = mb.second;
+        buf.normRow(p.y)[p.x] = mb.first;
+    }
+}
+
+std::pair<double, int32_t> Perturbation::calcPoint(double x, double y)
+        const {
+    return calcPixel((x - ref_x) * step_x, -(y - ref_y) * step_y);
+}
+
+uint32_t Perturbation::referenceLength() const {
+    return ref_real.size();
+}
+
+uint32_t Perturbation::skippedIterations() const {
+    return skip;
+}
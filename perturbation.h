@@ -0,0 +1,74 @@
+#ifndef PERTURBATION_H
+#define PERTURBATION_H
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include "complex.h"
+#include "dimension.h"
+#include "iter_buffer.h"
+
+// Deep-zoom engine. One reference orbit Z_n is computed in arbitrary
+// precision at the center of the viewport, every pixel then iterates only
+// its difference d_n = z_n - Z_n in double:
+//
+//     d_(n+1) = (2 Z_n + d_n) d_n + dc
+//
+// A series approximation d_n = A_n dc + B_n dc^2 + C_n dc^3 skips the
+// first iterations for all pixels at once. Whenever |z_n| < |d_n| the
+// delta has lost its precision against the reference (a glitch); the
+// pixel then rebases onto the start of the reference orbit.
+class Perturbation
+{
+private:
+    // Reference orbit Z_0 = 0, Z_1 = c, ... rounded to double
+    std::vector<double> ref_real;
+    std::vector<double> ref_imag;
+
+    // Series approximation coefficients at iteration skip
+    uint32_t skip;
+    complex sa_a;
+    complex sa_b;
+    complex sa_c;
+
+    uint32_t max_iter;
+    double bail_out;
+
+    // Pixel position of the reference and pixel spacing
+    double ref_x;
+    double ref_y;
+    double step_x;
+    double step_y;
+
+    void calcReferenceOrbit(const bigfloat& cr, const bigfloat& ci);
+    void calcSeriesApproximation(double delta_max);
+
+public:
+    // Truncation error bound of the series approximation, relative to the
+    // previous term
+    const double SA_EPS = 1e-4;
+
+    Perturbation();
+
+    // Computes the reference orbit and series approximation for a
+    // width x height frame of the viewport. Frames of only some of its
+    // rows pass the first one as top, see Mandelbrot::setFrameWindow.
+    void prepare(const m_dimension& d, uint32_t width, uint32_t height,
+            uint32_t max_iter, double bail_out, uint32_t top = 0);
+
+    void calcTile(const m_tile& tile, iter_buffer& buf) const;
+    void calcPoints(const m_pixel* points, uint32_t n,
+            iter_buffer& buf) const;
+
+    // Iterates the pixel at offset (dcr, dci) from the reference. Returns
+    // |z|^2 and the escape iteration as calcMandelbrot does.
+    std::pair<double, int32_t> calcPixel(double dcr, double dci) const;
+    // calcPixel of the point at (x, y) in pixels of the frame, which need
+    // not be whole
+    std::pair<double, int32_t> calcPoint(double x, double y) const;
+
+    uint32_t referenceLength() const;
+    uint32_t skippedIterations() const;
+};
+
+#endif // PERTURBATION_H
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <algorithm>
+#include "render_stats.h"
+
+template<class... A>
+static std::string format(const char* f, A... args) {
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), f, args...);
+    return buf;
+}
+
+std::vector<std::string> summarizeStats(const frame_stats& s) {
+    std::vector<std::string> res;
+    res.push_back(format("%ux%u %s, %u iterations, %u threads", s.width,
+            s.height, s.precision.c_str(), s.max_iter, s.threads));
+    res.push_back(format("%u passes %.1f ms: iterate %.1f, colorize %.1f",
+            s.passes, s.time * 1e3, s.iterate_time * 1e3,
+            s.colorize_time * 1e3));
+    res.push_back(format("%llu pixels iterated: %llu escaped, %llu interior",
+            static_cast<unsigned long long>(s.pixels),
+            static_cast<unsigned long long>(s.escaped),
+            static_cast<unsigned long long>(s.interior)));
+    res.push_back(format("%.3g iterations, %.1f per pixel, max %u",
+            static_cast<double>(s.iterations),
+            s.pixels > 0 ? static_cast<double>(s.iterations) / s.pixels : 0.0,
+            s.max_iterations));
+
+    if(!s.tiles.empty()) {
+        std::vector<double> times;
+        for(const tile_stats& t : s.tiles)
+            times.push_back(t.end - t.start);
+        std::sort(times.begin(), times.end());
+        res.push_back(format("%zu tiles: median %.2f ms, slowest %.2f ms",
+                times.size(), times.at(times.size() / 2) * 1e3,
+                times.back() * 1e3));
+    }
+
+    for(uint32_t w=0; w<s.busy.size(); w++)
+        res.push_back(format("worker %u: busy %.1f ms, idle %.1f ms", w,
+                s.busy.at(w) * 1e3, s.idle.at(w) * 1e3));
+    return res;
+}
+
+// Complete event of the trace, times in seconds
+static void traceEvent(std::ostream& out, bool& first, const char* name,
+        const std::string& cat, uint32_t pid, uint32_t tid, double start,
+        double end, const std::string& args) {
+    out << (first ? "\n" : ",\n") << format("{\"name\": \"%s\", "
+            "\"cat\": \"%s\", \"ph\": \"X\", \"pid\": %u, \"tid\": %u, "
+            "\"ts\": %.3f, \"dur\": %.3f, ", name, cat.c_str(), pid, tid,
+            start * 1e6, (end - start) * 1e6)
+        << "\"args\": {" << args << "}}";
+    first = false;
+}
+
+static void traceName(std::ostream& out, bool& first, uint32_t pid,
+        uint32_t tid, const std::string& name) {
+    out << (first ? "\n" : ",\n") << format("{\"name\": \"thread_name\", "
+            "\"ph\": \"M\", \"pid\": %u, \"tid\": %u, "
+            "\"args\": {\"name\": \"%s\"}}", pid, tid, name.c_str());
+    first = false;
+}
+
+bool writeChromeTrace(const std::vector<frame_stats>& frames,
+        std::ostream& out) {
+    // Frames go on a track of their own, workers on one each
+    const uint32_t FRAME_PID = 0;
+    const uint32_t WORKER_PID = 1;
+
+    double origin = frames.empty() ? 0 : frames.front().start;
+    uint32_t workers = 0;
+    bool first = true;
+    out << "{\"traceEvents\": [";
+
+    for(const frame_stats& s : frames) {
+        double t0 = s.start - origin;
+        double end = 0;
+        for(const tile_stats& t : s.tiles) {
+            end = std::max(end, t.end);
+            traceEvent(out, first, "tile", format("pass %u", t.block),
+                    WORKER_PID, t.worker, t0 + t.start, t0 + t.end,
+                    format("\"x\": %u, \"y\": %u, \"width\": %u, "
+                        "\"height\": %u, \"pixels\": %u, \"escaped\": %u, "
+                        "\"interior\": %u, \"iterations\": %llu, "
+                        "\"max_iterations\": %u", t.tile.x, t.tile.y,
+                        t.tile.width, t.tile.height, t.pixels, t.escaped,
+                        t.interior,
+                        static_cast<unsigned long long>(t.iterations),
+                        t.max_iterations));
+            workers = std::max(workers, t.worker + 1);
+        }
+        for(const phase_stats& p : s.phases) {
+            end = std::max(end, p.end);
+            traceEvent(out, first, p.name, p.name, WORKER_PID, p.worker,
+                    t0 + p.start, t0 + p.end, "");
+            workers = std::max(workers, p.worker + 1);
+        }
+
+        traceEvent(out, first, "frame", "frame", FRAME_PID, 0, t0, t0 + end,
+                format("\"width\": %u, \"height\": %u, \"precision\": "
+                    "\"%s\", \"max_iter\": %u, \"passes\": %u, "
+                    "\"pixels\": %llu, \"iterations\": %llu", s.width,
+                    s.height, s.precision.c_str(), s.max_iter, s.passes,
+                    static_cast<unsigned long long>(s.pixels),
+                    static_cast<unsigned long long>(s.iterations)));
+    }
+
+    traceName(out, first, FRAME_PID, 0, "frames");
+    for(uint32_t w=0; w<workers; w++)
+        traceName(out, first, WORKER_PID, w, format("worker %u", w));
+
+    out << "\n]}\n";
+    return !out.fail();
+}
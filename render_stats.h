@@ -0,0 +1,84 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "dimension.h"
+
+// Instrumentation of a frame, recorded by the Mandelbrot while stats
+// collection is on. Times are in seconds since the frame started.
+
+// One tile of a refinement pass
+struct tile_stats {
+    m_tile tile;
+    // Block size of the pass
+    uint32_t block;
+    uint32_t worker;
+    double start;
+    double end;
+    // Pixels iterated, split into those that escaped and those that did not
+    uint32_t pixels;
+    uint32_t escaped;
+    uint32_t interior;
+    // Iterations of those pixels, interior ones count the iteration limit
+    uint64_t iterations;
+    uint32_t max_iterations;
+};
+
+// Work besides iterating tiles, e.g. colorizing or spreading a band
+struct phase_stats {
+    const char* name;
+    uint32_t worker;
+    double start;
+    double end;
+};
+
+struct frame_stats {
+    // Buckets of the escape iteration histogram, bucket k counts the
+    // pixels escaping after 2^k .. 2^(k+1) - 1 iterations
+    static constexpr uint32_t HISTOGRAM_BUCKETS = 32;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t max_iter = 0;
+    uint32_t threads = 0;
+    std::string precision;
+    // Start of the frame in seconds of the engine's clock
+    double start = 0;
+    // Passes run so far and their wall time, split into iterating and
+    // colorizing the whole frame
+    uint32_t passes = 0;
+    double time = 0;
+    double iterate_time = 0;
+    double colorize_time = 0;
+
+    std::vector<tile_stats> tiles;
+    std::vector<phase_stats> phases;
+    // Per worker, time spent on tasks and time spent waiting for the other
+    // workers to finish theirs
+    std::vector<double> busy;
+    std::vector<double> idle;
+
+    // Totals over the tiles
+    uint64_t pixels = 0;
+    uint64_t escaped = 0;
+    uint64_t interior = 0;
+    uint64_t iterations = 0;
+    uint32_t max_iterations = 0;
+    // Of the finished frame
+    std::array<uint64_t, HISTOGRAM_BUCKETS> histogram{};
+};
+
+// Human readable summary, one line per entry
+std::vector<std::string> summarizeStats(const frame_stats& s);
+
+// Writes the frames as Chrome trace event JSON, as chrome://tracing and
+// Perfetto read it: tiles and phases are complete events on one track per
+// worker, placed relative to the start of the first frame.
+bool writeChromeTrace(const std::vector<frame_stats>& frames,
+        std::ostream& out);
+
+#endif // RENDER_STATS_H
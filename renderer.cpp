@@ -0,0 +1,151 @@
+#include "renderer.h"
+
+Renderer::Renderer(const callback& cb, const stats_callback& stats_cb):
+    post(cb), post_stats(stats_cb), has_pending(false), threads(0),
+    collect_stats(false), stop(false), latest(0), current(0) {
+    mandelbrot = std::unique_ptr<Mandelbrot>(new Mandelbrot());
+    max_iter = mandelbrot->getMaxIter();
+    mandelbrot->setPrintTiming(true);
+    mandelbrot->setTileCache(CACHE_TILES);
+    // Interactive frames run with capped iterations, the final frame of the
+    // same view continues their orbits
+    mandelbrot->setKeepOrbits(true);
+    budget.setMaxIter(max_iter);
+
+    mandelbrot->setCancelCheck([this]() {
+        return latest.load() != current;
+    });
+    mandelbrot->setTileCallback([this](const m_tile& t) {
+        post(current, image->view(t.x, t.y, t.width, t.height),
+                QRect(t.x, t.y, t.width, t.height));
+    });
+
+    thread = std::thread(&Renderer::renderLoop, this);
+}
+
+Renderer::~Renderer() {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stop = true;
+    }
+    // Also cancels the frame in progress
+    latest++;
+    wake.notify_one();
+    thread.join();
+}
+
+uint64_t Renderer::request(const m_dimension& d, uint32_t width,
+        uint32_t height, bool interactive) {
+    uint64_t gen;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        gen = latest.load() + 1;
+        pending = render_job{gen, d, width, height, interactive};
+        has_pending = true;
+        latest.store(gen);
+    }
+    wake.notify_one();
+    return gen;
+}
+
+void Renderer::setThreads(uint32_t t) {
+    std::lock_guard<std::mutex> l(lock);
+    threads = t;
+}
+
+void Renderer::setTargetFrameRate(double fps) {
+    std::lock_guard<std::mutex> l(lock);
+    budget.setTargetFrameRate(fps);
+}
+
+void Renderer::setCollectStats(bool c) {
+    std::lock_guard<std::mutex> l(lock);
+    collect_stats = c;
+}
+
+void Renderer::renderLoop() {
+    render_job job;
+    bool done = true;
+    bool repost = false;
+    bool stats = false;
+    bool prefetch = false;
+
+    for(;;) {
+        uint32_t t;
+        bool s;
+        uint32_t block = mandelbrot->PREVIEW_BLOCK;
+        uint32_t iter = max_iter;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            wake.wait(l, [&]() {
+                return stop || has_pending || !done || prefetch;
+            });
+            if(stop)
+                return;
+
+            if(has_pending) {
+                job = pending;
+                has_pending = false;
+                current = job.generation;
+                done = false;
+                // Tiles a cancelled job already posted were dropped, the
+                // first pass posts the whole frame again
+                repost = true;
+
+                if(job.interactive) {
+                    block = budget.previewBlock();
+                    iter = budget.iterationCap();
+                }
+            }
+            t = threads;
+            threads = 0;
+            s = collect_stats;
+        }
+
+        if(t != 0)
+            mandelbrot->setThreads(t);
+        if(s != stats) {
+            mandelbrot->setCollectStats(s);
+            stats = s;
+        }
+
+        // Idle otherwise, a new request cancels the batch
+        if(done && !repost) {
+            prefetch = mandelbrot->prefetchTiles();
+            continue;
+        }
+
+        if(repost) {
+            if(!image || image->width() != job.width
+                    || image->height() != job.height) {
+                frames.give(std::move(image));
+                image = frames.take(job.width, job.height);
+            }
+            mandelbrot->updateComplexDimensions(job.dimensions);
+            mandelbrot->setPreviewBlock(block);
+            mandelbrot->setMaxIter(iter);
+        }
+
+        auto start = timer::now();
+        done = mandelbrot->refreshMandelbrotTiled(image->image());
+        if(latest.load() != current)
+            continue;
+
+        if(repost && job.interactive) {
+            std::chrono::duration<double> diff = timer::now() - start;
+            std::lock_guard<std::mutex> l(lock);
+            budget.update(diff.count());
+        }
+
+        // Coarse passes rewrite the whole frame
+        if(repost || !done)
+            post(current, image->image(), QRect(0, 0, job.width, job.height));
+        repost = false;
+
+        if(done && stats && post_stats)
+            post_stats(current, mandelbrot->frameStats());
+        // Interactive frames run with capped iterations, their neighbours
+        // would be of no use
+        prefetch = done && !job.interactive;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <QRect>
+#include "frame_buffer.h"
+#include "frame_budget.h"
+#include "mandelbrot.h"
+
+// Runs the Mandelbrot off the GUI thread. Every viewport request is tagged
+// with a generation number; a newer request cancels the frame in progress
+// between two tiles, and requests arriving while one is rendered collapse
+// into the latest. Rendered parts of the frame are handed to the callback
+// as soon as they are done.
+//
+// Interactive requests, made while the user drags or zooms, have their
+// first pass held to the target frame rate by a FrameBudget. The next
+// request that is not interactive restores the full settings.
+//
+// With stats collection on, the frame_stats of every finished frame go to
+// the stats callback.
+//
+// Frames share their results through the Mandelbrot's tile cache. Once a
+// frame is done and no request is waiting, the workers prefetch the tiles
+// a pan or a zoom by one level shows next.
+class Renderer
+{
+public:
+    // Grid tiles cached, 32 KiB each
+    const uint32_t CACHE_TILES = 2048;
+
+    // Receives a view of the frame's pixels in rect, valid only during the
+    // call. Called on the render thread and its pool workers.
+    using callback = std::function<void(uint64_t generation,
+            const argb_image& part, const QRect& rect)>;
+    // Receives the statistics of a finished frame, on the render thread
+    using stats_callback = std::function<void(uint64_t generation,
+            const frame_stats& stats)>;
+
+    explicit Renderer(const callback& cb,
+            const stats_callback& stats_cb = nullptr);
+    ~Renderer();
+
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    // Queues a width x height frame of the viewport, returns its generation
+    uint64_t request(const m_dimension& d, uint32_t width, uint32_t height,
+            bool interactive = false);
+    void setThreads(uint32_t t);
+    void setTargetFrameRate(double fps);
+    void setCollectStats(bool c);
+
+private:
+    struct render_job {
+        uint64_t generation;
+        m_dimension dimensions;
+        uint32_t width;
+        uint32_t height;
+        bool interactive;
+    };
+
+    std::unique_ptr<Mandelbrot> mandelbrot;
+    callback post;
+    stats_callback post_stats;
+    // Frame rendered into, taken from frames for each new size
+    FramePool frames;
+    std::unique_ptr<FrameBuffer> image;
+    FrameBudget budget;
+    uint32_t max_iter;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    render_job pending;
+    bool has_pending;
+    uint32_t threads;
+    bool collect_stats;
+    bool stop;
+    // Generation of the latest request, the render thread compares it to
+    // the job it works on
+    std::atomic<uint64_t> latest;
+    uint64_t current;
+    std::thread thread;
+
+    void renderLoop();
+};
+
+#endif // RENDERER_H
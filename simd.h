@@ -0,0 +1,200 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+#include <immintrin.h>
+
+// Thin wrappers around the vector instruction sets used by the escape-time
+// kernels. Every wrapper exposes the same static interface, so a kernel
+// written once as a template over the wrapper runs 1 (plain C++), 2 (SSE2),
+// 4 (AVX) or 8 (AVX-512) pixels per register in structure-of-arrays layout.
+//
+// muladd rounds the product and the sum separately on every instruction
+// set, so that all of them iterate to the same bits; the build keeps the
+// compiler from fusing it with -ffp-contract=off. fmadd and fmsub round
+// once and exist only where FMA does.
+//
+// Translation units built for different instruction sets compile the same
+// wrapper to different code, so each set of flags gets its own namespace.
+// Otherwise the linker could keep an AVX-512 copy for all of them.
+#if defined(__AVX512F__)
+#define SIMD_NAMESPACE simd_avx512
+#elif defined(__AVX2__)
+#define SIMD_NAMESPACE simd_avx2
+#elif defined(__AVX__)
+#define SIMD_NAMESPACE simd_avx
+#else
+#define SIMD_NAMESPACE simd_base
+#endif
+
+inline namespace SIMD_NAMESPACE {
+
+// A single lane in scalar code
+struct vec1d {
+    using reg = double;
+    using mask = bool;
+    static constexpr uint32_t width = 1;
+
+    static inline reg set1(double v) { return v; }
+    static inline reg load(const double* p) { return *p; }
+    static inline void store(double* p, reg v) { *p = v; }
+
+    static inline reg add(reg a, reg b) { return a + b; }
+    static inline reg sub(reg a, reg b) { return a - b; }
+    static inline reg mul(reg a, reg b) { return a * b; }
+    static inline reg muladd(reg a, reg b, reg c) { return a * b + c; }
+    static inline reg abs(reg a) { return __builtin_fabs(a); }
+
+    static inline mask ones() { return true; }
+    static inline mask lt(reg a, reg b) { return a < b; }
+    static inline mask le(reg a, reg b) { return a <= b; }
+    static inline mask mask_and(mask a, mask b) { return a && b; }
+    static inline mask mask_or(mask a, mask b) { return a || b; }
+    static inline mask mask_andnot(mask a, mask b) { return !a && b; }
+    static inline int movemask(mask m) { return m; }
+    static inline reg blend(reg a, reg b, mask m) { return m ? b : a; }
+};
+
+#ifdef __SSE2__
+struct vec2d {
+    using reg = __m128d;
+    using mask = __m128d;
+    static constexpr uint32_t width = 2;
+
+    static inline reg set1(double v) { return _mm_set1_pd(v); }
+    static inline reg load(const double* p) { return _mm_loadu_pd(p); }
+    static inline void store(double* p, reg v) { _mm_storeu_pd(p, v); }
+
+    static inline reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+
+    static inline reg muladd(reg a, reg b, reg c) {
+        return _mm_add_pd(_mm_mul_pd(a, b), c);
+    }
+
+    static inline reg abs(reg a) {
+        return _mm_andnot_pd(_mm_set1_pd(-0.0), a);
+    }
+
+    static inline mask ones() {
+        return _mm_castsi128_pd(_mm_set1_epi64x(-1));
+    }
+    static inline mask lt(reg a, reg b) { return _mm_cmplt_pd(a, b); }
+    static inline mask le(reg a, reg b) { return _mm_cmple_pd(a, b); }
+    static inline mask mask_and(mask a, mask b) { return _mm_and_pd(a, b); }
+    static inline mask mask_or(mask a, mask b) { return _mm_or_pd(a, b); }
+    static inline mask mask_andnot(mask a, mask b) {
+        return _mm_andnot_pd(a, b);
+    }
+    static inline int movemask(mask m) { return _mm_movemask_pd(m); }
+
+    // No blendv before SSE4.1
+    static inline reg blend(reg a, reg b, mask m) {
+        return _mm_or_pd(_mm_and_pd(m, b), _mm_andnot_pd(m, a));
+    }
+};
+#endif
+
+#ifdef __AVX__
+struct vec4d {
+    using reg = __m256d;
+    using mask = __m256d;
+    static constexpr uint32_t width = 4;
+
+    static inline reg set1(double v) { return _mm256_set1_pd(v); }
+    static inline reg load(const double* p) { return _mm256_loadu_pd(p); }
+    static inline void store(double* p, reg v) { _mm256_storeu_pd(p, v); }
+
+    static inline reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+
+    static inline reg muladd(reg a, reg b, reg c) {
+        return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+    }
+
+#ifdef __FMA__
+    // a * b + c and a * b - c with a single rounding
+    static inline reg fmadd(reg a, reg b, reg c) {
+        return _mm256_fmadd_pd(a, b, c);
+    }
+    static inline reg fmsub(reg a, reg b, reg c) {
+        return _mm256_fmsub_pd(a, b, c);
+    }
+#endif
+
+    static inline reg abs(reg a) {
+        return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);
+    }
+
+    static inline mask ones() {
+        return _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    }
+    static inline mask lt(reg a, reg b) {
+        return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+    }
+    static inline mask le(reg a, reg b) {
+        return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+    }
+    static inline mask mask_and(mask a, mask b) { return _mm256_and_pd(a, b); }
+    static inline mask mask_or(mask a, mask b) { return _mm256_or_pd(a, b); }
+    // ~a & b
+    static inline mask mask_andnot(mask a, mask b) {
+        return _mm256_andnot_pd(a, b);
+    }
+    static inline int movemask(mask m) { return _mm256_movemask_pd(m); }
+
+    // m ? b : a, per lane
+    static inline reg blend(reg a, reg b, mask m) {
+        return _mm256_blendv_pd(a, b, m);
+    }
+};
+#endif
+
+#ifdef __AVX512F__
+struct vec8d {
+    using reg = __m512d;
+    using mask = __mmask8;
+    static constexpr uint32_t width = 8;
+
+    static inline reg set1(double v) { return _mm512_set1_pd(v); }
+    static inline reg load(const double* p) { return _mm512_loadu_pd(p); }
+    static inline void store(double* p, reg v) { _mm512_storeu_pd(p, v); }
+
+    static inline reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+    static inline reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+    static inline reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+    static inline reg muladd(reg a, reg b, reg c) {
+        return _mm512_add_pd(_mm512_mul_pd(a, b), c);
+    }
+    static inline reg fmadd(reg a, reg b, reg c) {
+        return _mm512_fmadd_pd(a, b, c);
+    }
+    static inline reg fmsub(reg a, reg b, reg c) {
+        return _mm512_fmsub_pd(a, b, c);
+    }
+
+    static inline reg abs(reg a) { return _mm512_abs_pd(a); }
+
+    static inline mask ones() { return 0xff; }
+    static inline mask lt(reg a, reg b) {
+        return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ);
+    }
+    static inline mask le(reg a, reg b) {
+        return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ);
+    }
+    static inline mask mask_and(mask a, mask b) { return a & b; }
+    static inline mask mask_or(mask a, mask b) { return a | b; }
+    static inline mask mask_andnot(mask a, mask b) { return ~a & b; }
+    static inline int movemask(mask m) { return m; }
+
+    static inline reg blend(reg a, reg b, mask m) {
+        return _mm512_mask_blend_pd(m, a, b);
+    }
+};
+#endif
+
+}
+
+#endif // SIMD_H
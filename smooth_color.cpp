@@ -1,6 +1,28 @@
 #include <immintrin.h>
+#include <cstring>
+#include <cfloat>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include "kernels.h"
 #include "smooth_color.h"
 
+// log2 of a positive finite float, accurate to about 3e-5: the exponent is
+// taken from the bit pattern, the mantissa goes through a polynomial.
+static inline float fastLog2(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    float e = static_cast<float>(static_cast<int32_t>(bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+
+    float t;
+    std::memcpy(&t, &bits, sizeof(t));
+    t -= 1.0f;
+
+    return e + t * (1.44182512f + t * (-0.708674935f + t * (0.415397767f
+            + t * (-0.194390433f + t * 0.0458707517f))));
+}
+
 SmoothColoring::SmoothColoring(): SmoothColoring(3) {
 }
 
@@ -9,16 +31,18 @@ SmoothColoring::SmoothColoring(uint32_t num_colors):
 }
 
 SmoothColoring::SmoothColoring(uint32_t num_colors, uint32_t num_gradient):
-    n_colors(num_colors), n_gradient(num_gradient) {
-    
-    // Initialize base colors randomly.
-    std::srand(std::time(nullptr));
+    SmoothColoring(randomColors(num_colors), num_gradient) {
+}
+
+SmoothColoring::SmoothColoring(const std::vector<uint32_t>& colors,
+        uint32_t num_gradient):
+    n_colors(colors.size()), n_gradient(num_gradient) {
+
     base_colors.resize(n_colors);
     for(uint32_t i=0; i<base_colors.size(); i++) {
-        double r = (static_cast<double>(std::rand()) / RAND_MAX) * 255;
-        double g = (static_cast<double>(std::rand()) / RAND_MAX) * 255;
-        double b = (static_cast<double>(std::rand()) / RAND_MAX) * 255;
-        base_colors.at(i) = QColor(r, g, b);
+        uint32_t c = colors.at(i);
+        base_colors.at(i) = rgb_color{((c >> 16) & 0xff) / 255.0,
+                ((c >> 8) & 0xff) / 255.0, (c & 0xff) / 255.0};
     }
 
     // Create gradient of base colors over a larger LUT.
@@ -27,8 +51,8 @@ SmoothColoring::SmoothColoring(uint32_t num_colors, uint32_t num_gradient):
             / (base_colors.size() - 1);
 
     for(uint32_t i=0; i<gradient_colors.size(); i++) {
-        QColor& curc = base_colors.at(i / dist);
-        QColor& nexc = i / dist + 1 < base_colors.size() ?
+        rgb_color& curc = base_colors.at(i / dist);
+        rgb_color& nexc = i / dist + 1 < base_colors.size() ?
                     base_colors.at((i / dist) + 1):
                     base_colors.at(i / dist);
         double distance = static_cast<double>(i) / (dist * (i / dist + 1));
@@ -37,34 +61,54 @@ SmoothColoring::SmoothColoring(uint32_t num_colors, uint32_t num_gradient):
     }
 
     log_2 = std::log(2.0);
+    buildPalette();
 }
 
-QColor SmoothColoring::interpolateColor(const QColor& c1, const QColor& c2, 
-        double r) {
-    double red = c1.redF() + static_cast<double>(c2.redF() - c1.redF()) * r;
-    double green = c1.greenF() + static_cast<double>(c2.greenF() 
-            - c1.greenF()) * r;
-    double blue = c1.blueF() + static_cast<double>(c2.blueF() - c1.blueF()) * r;
-
-    QColor ret;
-    ret.setRgbF(red, green, blue);
+std::vector<uint32_t> SmoothColoring::randomColors(uint32_t num_colors) {
+    // Initialize base colors randomly.
+    std::srand(std::time(nullptr));
+    std::vector<uint32_t> colors(num_colors);
+    for(uint32_t i=0; i<colors.size(); i++) {
+        uint32_t r = (static_cast<double>(std::rand()) / RAND_MAX) * 255;
+        uint32_t g = (static_cast<double>(std::rand()) / RAND_MAX) * 255;
+        uint32_t b = (static_cast<double>(std::rand()) / RAND_MAX) * 255;
+        colors.at(i) = (r << 16) | (g << 8) | b;
+    }
+    return colors;
+}
 
-    return ret;
+uint32_t SmoothColoring::toArgb(const rgb_color& c) {
+    auto channel = [](double v) {
+        return static_cast<uint32_t>(std::lround(
+                    std::min(std::max(v, 0.0), 1.0) * 255));
+    };
+    return 0xff000000 | (channel(c.r) << 16) | (channel(c.g) << 8)
+            | channel(c.b);
 }
 
-QColor SmoothColoring::interpolateColor_avx(const QColor& c1, const QColor& c2,
-        double r) {
-    __m256d vr = _mm256_set1_pd(r);
-    __m256d vc1 = _mm256_setr_pd(c1.redF(), c1.greenF(), c1.blueF(), 0);
-    __m256d vc2 = _mm256_setr_pd(c2.redF(), c2.greenF(), c2.blueF(), 0);
+void SmoothColoring::buildPalette() {
+    palette.resize(gradient_colors.size() * PALETTE_STEPS);
 
-    __m256d vcdiff = _mm256_sub_pd(vc2, vc1);
-    vc1 = _mm256_fmadd_pd(vcdiff, vr, vc1);
+    for(uint32_t i=0; i<palette.size(); i++) {
+        uint32_t g = i / PALETTE_STEPS;
+        const rgb_color& c1 = gradient_colors.at(g);
+        const rgb_color& c2 = gradient_colors.at((g + 1)
+                % gradient_colors.size());
+        double r = static_cast<double>(i % PALETTE_STEPS) / PALETTE_STEPS;
 
-    QColor ret;
-    ret.setRgbF(vc1[0], vc1[1], vc1[2]);
+        palette.at(i) = toArgb(interpolateColor(c1, c2, r));
+    }
+}
 
-    return ret;
+rgb_color SmoothColoring::interpolateColor(const rgb_color& c1,
+        const rgb_color& c2, double r) {
+    return rgb_color{c1.r + (c2.r - c1.r) * r, c1.g + (c2.g - c1.g) * r,
+            c1.b + (c2.b - c1.b) * r};
+}
+
+rgb_color SmoothColoring::interpolateColor_avx(const rgb_color& c1,
+        const rgb_color& c2, double r, const kernel_table& k) {
+    return k.interpolate_color(c1, c2, r);
 }
 
 double SmoothColoring::nu(int32_t it, double norm) {
@@ -73,30 +117,62 @@ double SmoothColoring::nu(int32_t it, double norm) {
     return static_cast<double>(it) + 1 - nu;
 }
 
-QColor SmoothColoring::getColor(int32_t iterations, double normal) {
+uint32_t SmoothColoring::getColor(int32_t iterations, double normal) {
     if(iterations == INT32_MIN)
-        return QColor(0, 0, 0);
+        return 0xff000000;
 
     double itnorm = nu(iterations, normal);
     int32_t fcval = static_cast<int32_t>(std::floor(itnorm));
 
-    return interpolateColor(gradient_colors.at(fcval
+    return toArgb(interpolateColor(gradient_colors.at(fcval
                                           % gradient_colors.size()),
                          gradient_colors.at((fcval + 1)
                                           % gradient_colors.size()),
-                         itnorm - (long)itnorm);
+                         itnorm - (long)itnorm));
 }
 
-QColor SmoothColoring::getColor_avx(int32_t iterations, double normal) {
+uint32_t SmoothColoring::getColor_avx(int32_t iterations, double normal,
+        const kernel_table& k) {
     if(iterations == INT32_MIN)
-        return QColor(0, 0, 0);
+        return 0xff000000;
 
     double itnorm = nu(iterations, normal);
     int32_t fcval = static_cast<int32_t>(std::floor(itnorm));
 
-    return interpolateColor_avx(gradient_colors.at(fcval
+    return toArgb(interpolateColor_avx(gradient_colors.at(fcval
                                           % gradient_colors.size()),
                          gradient_colors.at((fcval + 1)
                                           % gradient_colors.size()),
-                         itnorm - (long)itnorm);
+                         itnorm - (long)itnorm, k));
+}
+
+// Same mapping as getColor, with nu() reduced to it + 2 - log2(log2(norm))
+// and the interpolation replaced by a palette lookup.
+uint32_t SmoothColoring::paletteColor(int32_t it, float norm) const {
+    if(it == INT32_MIN)
+        return 0xff000000;
+
+    norm = std::min(std::max(norm, 4.0f), FLT_MAX);
+    float frac = 2.0f - fastLog2(fastLog2(norm));
+
+    int32_t size = palette.size();
+    float pos = (static_cast<float>(it % n_gradient) + frac) * PALETTE_STEPS;
+    int32_t idx = static_cast<int32_t>(std::floor(pos));
+    idx %= size;
+    if(idx < 0)
+        idx += size;
+
+    return palette[idx];
+}
+
+void SmoothColoring::getColors(const int32_t* iterations, const float* normals,
+        uint32_t* argb, uint32_t n, const kernel_table& k) {
+    // The vector kernel colorizes a prefix, the rest goes one by one
+    uint32_t i = 0;
+    if(k.palette_colors)
+        i = k.palette_colors(iterations, normals, argb, n, palette.data(),
+                palette.size(), n_gradient);
+
+    for(; i < n; i++)
+        argb[i] = paletteColor(iterations[i], normals[i]);
 }
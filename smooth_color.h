@@ -1,30 +1,48 @@
 #ifndef _SMOOTH_COLOR_H
 #define _SMOOTH_COLOR_H
 
-#include <QPainter>
 #include <cmath>
+#include <vector>
 #include "coloring.h"
 
 class SmoothColoring: public Coloring {
     private:
-        std::vector<QColor> base_colors;
-        std::vector<QColor> gradient_colors;
+        std::vector<rgb_color> base_colors;
+        std::vector<rgb_color> gradient_colors;
+        // Gradient resampled to PALETTE_STEPS entries per gradient color,
+        // indexed by the smooth iteration count in fixed point.
+        std::vector<uint32_t> palette;
         uint32_t n_colors;
         uint32_t n_gradient;
         double log_2;
 
-        QColor interpolateColor(const QColor& c1, 
-                const QColor& c2, double r);
-        QColor interpolateColor_avx(const QColor& c1, 
-                const QColor& c2, double r);
+        void buildPalette();
+        uint32_t paletteColor(int32_t it, float norm) const;
+
+        static std::vector<uint32_t> randomColors(uint32_t num_colors);
+        static uint32_t toArgb(const rgb_color& c);
+
+        rgb_color interpolateColor(const rgb_color& c1,
+                const rgb_color& c2, double r);
+        rgb_color interpolateColor_avx(const rgb_color& c1,
+                const rgb_color& c2, double r, const kernel_table& k);
     public:
         SmoothColoring();
         SmoothColoring(uint32_t num_colors);
         SmoothColoring(uint32_t num_colors, uint32_t num_gradient);
+        // Gradient through the given 0xRRGGBB base colors
+        SmoothColoring(const std::vector<uint32_t>& colors,
+                uint32_t num_gradient);
+
+        static const uint32_t PALETTE_SHIFT = 8;
+        static const uint32_t PALETTE_STEPS = 1 << PALETTE_SHIFT;
 
         inline double nu(int32_t it, double norm);
-        virtual QColor getColor(int32_t iterations, double normal);
-        virtual QColor getColor_avx(int32_t iterations, double normal);
+        virtual uint32_t getColor(int32_t iterations, double normal);
+        virtual uint32_t getColor_avx(int32_t iterations, double normal,
+                const kernel_table& k);
+        virtual void getColors(const int32_t* iterations, const float* normals,
+                uint32_t* argb, uint32_t n, const kernel_table& k);
 };
 
 #endif //_SMOOTH_COLOR_H
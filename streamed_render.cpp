@@ -0,0 +1,46 @@
+#include <algorithm>
+#include "streamed_render.h"
+
+bool renderStreamed(Mandelbrot& m, const m_dimension& d, uint32_t width,
+        uint32_t height, ImageStream& out, std::vector<uint32_t>& pixels,
+        uint32_t band_pixels, std::vector<frame_stats>* stats) {
+    // Frames need two rows at least. With antialiasing, bands take a row
+    // of their neighbours along, so edges are found across the seams as in
+    // a single frame.
+    uint32_t band = std::min(height, std::max(band_pixels / width, 2u));
+    uint32_t apron = m.getAntialiasing() > 0 ? 1 : 0;
+    pixels.resize(static_cast<size_t>(width) * (band + 2 * apron));
+
+    // Each band is a window of the image's frame. A single last row is
+    // rendered together with the one above it.
+    m.updateComplexDimensions(d);
+    bool ok = true;
+    for(uint32_t y0 = 0; y0 < height; y0 += band) {
+        uint32_t rows = std::min(band, height - y0);
+        uint32_t bottom = std::min(height, y0 + rows + apron);
+        uint32_t top = std::min(y0 - std::min(y0, apron), bottom - 2);
+        uint32_t frame_rows = bottom - top;
+
+        m.setFrameWindow(top, height);
+
+        argb_image image;
+        image.pixels = pixels.data();
+        image.width = width;
+        image.height = frame_rows;
+        image.stride = width;
+        while(!m.refreshMandelbrotTiled(image)) {}
+        if(stats)
+            stats->push_back(m.frameStats());
+
+        argb_image rows_done = image;
+        rows_done.pixels = image.line(y0 - top);
+        rows_done.height = rows;
+        if(!out.writeRows(rows_done)) {
+            ok = false;
+            break;
+        }
+    }
+
+    m.setFrameWindow(0, 0);
+    return ok && out.finish();
+}
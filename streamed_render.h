@@ -0,0 +1,25 @@
+#ifndef STREAMED_RENDER_H
+#define STREAMED_RENDER_H
+
+#include <cstdint>
+#include <vector>
+#include "dimension.h"
+#include "image_writer.h"
+#include "mandelbrot.h"
+
+// Pixels rendered at once by renderStreamed
+constexpr uint32_t STREAM_BAND_PIXELS = 1 << 22;
+
+// Renders a width x height image of the viewport in bands of full rows,
+// each handed to out as soon as it is done. Only one band is held in
+// memory, so the image may be far larger than RAM. Bands are frame windows
+// of m, so the image is the one a single frame of it gives; with
+// antialiasing they also render the rows next to them. pixels is the band
+// buffer and is reused across calls. If stats is given, it receives
+// the frame_stats of every band; m must be collecting them.
+bool renderStreamed(Mandelbrot& m, const m_dimension& d, uint32_t width,
+        uint32_t height, ImageStream& out, std::vector<uint32_t>& pixels,
+        uint32_t band_pixels = STREAM_BAND_PIXELS,
+        std::vector<frame_stats>* stats = nullptr);
+
+#endif // STREAMED_RENDER_H
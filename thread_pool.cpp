@@ -0,0 +1,117 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(uint32_t threads): queued(0), pending(0), stop(false) {
+    if(threads == 0)
+        threads = 1;
+
+    for(uint32_t i=0; i<threads; i++)
+        queues.push_back(std::unique_ptr<worker_queue>(new worker_queue()));
+
+    for(uint32_t i=0; i<threads; i++)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> l(state_lock);
+        stop = true;
+    }
+    wake.notify_all();
+
+    for(auto& t: workers)
+        t.join();
+}
+
+uint32_t ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::submit(std::vector<task>& tasks) {
+    if(tasks.empty())
+        return;
+
+    pending += tasks.size();
+    queued += tasks.size();
+
+    // Neighbouring tasks (e.g. adjacent tiles) go to the same worker.
+    uint32_t n = queues.size();
+    uint32_t chunk = (tasks.size() + n - 1) / n;
+    for(uint32_t q=0; q<n; q++) {
+        std::lock_guard<std::mutex> l(queues.at(q)->lock);
+        for(uint32_t i=q*chunk; i<(q+1)*chunk && i<tasks.size(); i++)
+            queues.at(q)->tasks.push_back(std::move(tasks.at(i)));
+    }
+
+    // Serialize with workers that are about to sleep so none misses the
+    // wakeup.
+    {
+        std::lock_guard<std::mutex> l(state_lock);
+    }
+    wake.notify_all();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> l(state_lock);
+    done.wait(l, [this] { return pending == 0; });
+}
+
+void ThreadPool::parallelFor(uint32_t n,
+        const std::function<void(uint32_t, uint32_t)>& fn) {
+    std::vector<task> tasks;
+    tasks.reserve(n);
+    for(uint32_t i=0; i<n; i++)
+        tasks.push_back([&fn, i](uint32_t worker) { fn(i, worker); });
+
+    submit(tasks);
+    wait();
+}
+
+bool ThreadPool::popLocal(uint32_t id, task& t) {
+    worker_queue& q = *queues.at(id);
+    std::lock_guard<std::mutex> l(q.lock);
+    if(q.tasks.empty())
+        return false;
+
+    t = std::move(q.tasks.back());
+    q.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(uint32_t id, task& t) {
+    uint32_t n = queues.size();
+    for(uint32_t i=1; i<n; i++) {
+        worker_queue& q = *queues.at((id + i) % n);
+        std::lock_guard<std::mutex> l(q.lock);
+        if(q.tasks.empty())
+            continue;
+
+        t = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::workerLoop(uint32_t id) {
+    task t;
+
+    while(true) {
+        if(popLocal(id, t) || steal(id, t)) {
+            queued--;
+            t(id);
+            t = nullptr;
+
+            if(--pending == 0) {
+                std::lock_guard<std::mutex> l(state_lock);
+                done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l(state_lock);
+        wake.wait(l, [this] { return stop || queued > 0; });
+        if(stop && queued == 0)
+            return;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+// Long-lived pool of worker threads. Every worker owns a deque of tasks:
+// it pops from the back of its own deque and, once that runs dry, steals
+// from the front of the others, so uneven tasks balance across all cores.
+class ThreadPool
+{
+public:
+    // A task receives the index of the worker executing it.
+    using task = std::function<void(uint32_t)>;
+
+    explicit ThreadPool(uint32_t threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    uint32_t size() const;
+
+    // Distributes tasks in contiguous chunks over the worker deques.
+    void submit(std::vector<task>& tasks);
+    // Blocks until every submitted task has finished.
+    void wait();
+
+    // Runs fn(i, worker) for every i in [0, n) and waits for completion.
+    void parallelFor(uint32_t n,
+            const std::function<void(uint32_t, uint32_t)>& fn);
+
+private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<worker_queue>> queues;
+
+    std::mutex state_lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::atomic<uint32_t> queued;
+    std::atomic<uint32_t> pending;
+    bool stop;
+
+    bool popLocal(uint32_t id, task& t);
+    bool steal(uint32_t id, task& t);
+    void workerLoop(uint32_t id);
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cmath>
+#include "tile_cache.h"
+
+size_t tile_key_hash::operator()(const tile_key& k) const {
+    uint64_t h = static_cast<uint64_t>(k.x) * 0x9e3779b97f4a7c15ull;
+    h ^= static_cast<uint64_t>(k.y) + 0x7f4a7c159e3779b9ull + (h << 6)
+            + (h >> 2);
+    h ^= (static_cast<uint64_t>(k.level) << 32 | k.max_iter) + (h << 6)
+            + (h >> 2);
+    return static_cast<size_t>(h);
+}
+
+TileCache::TileCache(uint32_t capacity): max_tiles(std::max<uint32_t>(
+            capacity, 1)) {
+}
+
+std::shared_ptr<const grid_tile> TileCache::find(const tile_key& k) {
+    std::lock_guard<std::mutex> l(lock);
+    auto it = index.find(k);
+    if(it == index.end())
+        return nullptr;
+
+    tiles.splice(tiles.begin(), tiles, it->second);
+    return it->second->second;
+}
+
+bool TileCache::contains(const tile_key& k) const {
+    std::lock_guard<std::mutex> l(lock);
+    return index.count(k) != 0;
+}
+
+void TileCache::insert(const tile_key& k,
+        std::shared_ptr<const grid_tile> t) {
+    std::lock_guard<std::mutex> l(lock);
+    auto it = index.find(k);
+    if(it != index.end()) {
+        it->second->second = std::move(t);
+        tiles.splice(tiles.begin(), tiles, it->second);
+        return;
+    }
+
+    tiles.emplace_front(k, std::move(t));
+    index[k] = tiles.begin();
+    while(tiles.size() > max_tiles) {
+        index.erase(tiles.back().first);
+        tiles.pop_back();
+    }
+}
+
+void TileCache::clear() {
+    std::lock_guard<std::mutex> l(lock);
+    index.clear();
+    tiles.clear();
+}
+
+uint32_t TileCache::size() const {
+    std::lock_guard<std::mutex> l(lock);
+    return tiles.size();
+}
+
+uint32_t TileCache::capacity() const {
+    return max_tiles;
+}
+
+double gridStep(int32_t level) {
+    return std::ldexp(1.0 / GRID_TILE, -level);
+}
+
+int32_t nearestGridLevel(double step) {
+    // Spacings far below double's range are not reachable anyway
+    double level = std::round(std::log2(1.0 / GRID_TILE / step));
+    return static_cast<int32_t>(std::min(std::max(level, 0.0), 1000.0));
+}
+
+m_dimension gridViewport(const m_dimension& d, int32_t level, uint32_t width,
+        uint32_t height) {
+    double step = gridStep(level);
+    bigfloat x = exactOffsetX(d) + bigfloat((d.m_width - (width - 1) * step)
+            / 2);
+    bigfloat y = exactOffsetY(d) - bigfloat((d.m_height
+            - (height - 1) * step) / 2);
+
+    m_dimension r = d;
+    r.m_width = (width - 1) * step;
+    r.m_height = (height - 1) * step;
+    // Shifts the view by less than half a pixel
+    if(level <= GRID_MAX_LEVEL) {
+        x = bigfloat(std::round(x.toDouble() / step) * step);
+        y = bigfloat(std::round(y.toDouble() / step) * step);
+    }
+    setExactOffset(r, x, y);
+    return r;
+}
+
+bool frameOnGrid(const m_dimension& d, uint32_t width, uint32_t height,
+        int32_t& level, int64_t& x0, int64_t& y0) {
+    double step = d.m_width / (width - 1);
+    if(d.m_height / (height - 1) != step)
+        return false;
+
+    level = nearestGridLevel(step);
+    if(level > GRID_MAX_LEVEL || gridStep(level) != step
+            || !d.m_offset_x_lo.isZero() || !d.m_offset_y_lo.isZero())
+        return false;
+
+    // Exact, the spacing is a power of two
+    double x = d.m_offset_x / step;
+    double y = -d.m_offset_y / step;
+    x0 = std::llround(x);
+    y0 = std::llround(y);
+    return x == x0 && y == y0;
+}
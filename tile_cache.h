@@ -0,0 +1,96 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "dimension.h"
+
+// Fixed quadtree grid of the complex plane that frames share their results
+// through. Level L samples the plane every gridStep(L) = 2^-L / 64, at the
+// points x s - i y s for integers x and y, and groups the samples into
+// GRID_TILE x GRID_TILE tiles: tile (tx, ty) holds x = tx * GRID_TILE ...
+// (tx + 1) * GRID_TILE - 1 and likewise y. Each level halves the spacing
+// of the one before, so its tiles are the four quadrants of the coarser
+// level's.
+
+constexpr uint32_t GRID_TILE = 64;
+// Deepest level cached. Its spacing of about 1.5e-11 still leaves double
+// coordinates and the fp64 kernels enough bits.
+constexpr int32_t GRID_MAX_LEVEL = 30;
+
+struct tile_key {
+    int32_t level;
+    int64_t x;
+    int64_t y;
+    // Results depend on the iteration limit
+    uint32_t max_iter;
+
+    bool operator==(const tile_key& k) const {
+        return level == k.level && x == k.x && y == k.y
+                && max_iter == k.max_iter;
+    }
+};
+
+struct tile_key_hash {
+    size_t operator()(const tile_key& k) const;
+};
+
+// Iteration counts and norms of a tile in row-major order, as iter_buffer
+// holds them
+struct grid_tile {
+    int32_t iterations[GRID_TILE * GRID_TILE];
+    float norms[GRID_TILE * GRID_TILE];
+};
+
+// Least recently used tiles are evicted once the cache holds its capacity.
+// Safe to use from several threads; tiles are immutable once inserted, so
+// readers keep them alive while they copy them out.
+class TileCache
+{
+public:
+    explicit TileCache(uint32_t capacity);
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    // The tile of k, which becomes the most recently used one, or null
+    std::shared_ptr<const grid_tile> find(const tile_key& k);
+    // Whether k is cached, without counting as a use
+    bool contains(const tile_key& k) const;
+    void insert(const tile_key& k, std::shared_ptr<const grid_tile> t);
+    void clear();
+
+    uint32_t size() const;
+    uint32_t capacity() const;
+
+private:
+    using entry = std::pair<tile_key, std::shared_ptr<const grid_tile>>;
+
+    mutable std::mutex lock;
+    uint32_t max_tiles;
+    // Most recently used first
+    std::list<entry> tiles;
+    std::unordered_map<tile_key, std::list<entry>::iterator, tile_key_hash>
+            index;
+};
+
+double gridStep(int32_t level);
+// Level whose spacing is nearest to step, at least 0
+int32_t nearestGridLevel(double step);
+
+// Viewport of a width x height frame with the spacing of level, centered
+// where d is. Up to GRID_MAX_LEVEL its pixels lie on the grid, deeper only
+// the spacing is the grid's.
+m_dimension gridViewport(const m_dimension& d, int32_t level, uint32_t width,
+        uint32_t height);
+
+// Whether the pixels of a width x height frame of d lie on the grid of a
+// cached level. If so sets the level and the grid position of pixel (0, 0).
+bool frameOnGrid(const m_dimension& d, uint32_t width, uint32_t height,
+        int32_t& level, int64_t& x0, int64_t& y0);
+
+#endif // TILE_CACHE_H
@@ -1,4 +1,1163 @@
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include "gtest/gtest.h"
+#include "bigfloat.h"
+#include "distributed_render.h"
+#include "frame_budget.h"
+#include "frame_buffer.h"
+#include "kernels.h"
+#include "mandelbrot.h"
+#include "perturbation.h"
+#include "render_stats.h"
+#include "smooth_color.h"
+#include "streamed_render.h"
+#include "thread_pool.h"
+#include "tile_cache.h"
+#include "zoom_video.h"
+
+// Viewport of w x h pixels centered on (re, im), width wide in the plane
+static m_dimension centered(double re, double im, double width, uint32_t w,
+        uint32_t h) {
+    m_dimension d;
+    d.m_width = width;
+    d.m_height = width * (h - 1) / (w - 1);
+    d.m_offset_x = re - d.m_width / 2;
+    d.m_offset_y = im + d.m_height / 2;
+    return d;
+}
+
+// Complete frame of w x h pixels of d
+static const iter_buffer& renderFrame(Mandelbrot& m, const m_dimension& d,
+        uint32_t w, uint32_t h, std::vector<uint32_t>& pixels) {
+    m.updateComplexDimensions(d);
+    pixels.resize(static_cast<size_t>(w) * h);
+    argb_image image;
+    image.pixels = pixels.data();
+    image.width = w;
+    image.height = h;
+    image.stride = w;
+    while(!m.refreshMandelbrotTiled(image)) {}
+    return m.frameResults();
+}
+
+static const iter_buffer& renderFrame(Mandelbrot& m, double re, double im,
+        double width, uint32_t w, uint32_t h,
+        std::vector<uint32_t>& pixels) {
+    return renderFrame(m, centered(re, im, width, w, h), w, h, pixels);
+}
+
+// Subdivide mode fills only what full mode finds inside the set, also in
+// the seahorse valley where bulbs and the cardioid border on filaments
+TEST(Subdivide, MatchesFullRender) {
+    struct view {
+        double re;
+        double im;
+        double width;
+        uint32_t max_iter;
+    };
+    const uint32_t w = 640;
+    const uint32_t h = 480;
+    std::vector<uint32_t> pixels;
+    for(view v : {view{-0.76, 0.16, 0.05, 3000}, view{-0.76, 0.16, 0.1, 1000},
+            view{-0.76, 0.1567, 0.1, 3000}, view{-0.7435, 0.1314, 0.06, 3000},
+            view{-0.7445, 0.121, 0.015, 5000},
+            view{-0.7436447860, 0.1318252536, 0.002, 5000}}) {
+        Mandelbrot full;
+        full.setMaxIter(v.max_iter);
+        full.setPreviewBlock(1);
+        std::vector<int32_t> expected = renderFrame(full, v.re, v.im,
+                v.width, w, h, pixels).iterations;
+
+        Mandelbrot m;
+        m.setMaxIter(v.max_iter);
+        m.setRenderMode(render_mode::subdivide);
+        EXPECT_TRUE(renderFrame(m, v.re, v.im, v.width, w, h,
+                    pixels).iterations == expected)
+                << v.re << " " << v.im << " " << v.width;
+    }
+}
+
+// Frames reusing samples of the previous one after pans and zooms equal
+// fresh renders, whatever the view was before
+TEST(Reprojection, MatchesFreshRender) {
+    const uint32_t w = 320;
+    const uint32_t h = 240;
+    const double step = 0.004 / (w - 1);
+    struct view {
+        double re;
+        double im;
+        double width;
+    };
+    std::vector<uint32_t> pixels;
+    Mandelbrot m;
+    m.setMaxIter(2000);
+    renderFrame(m, -0.7445, 0.121, 0.004, w, h, pixels);
+    for(view v : {view{-0.7445 + 1e-4 * step, 0.121, 0.004},
+            view{-0.7445 + 7.0003 * step, 0.121 - 3 * step, 0.004},
+            view{-0.7445 - 20 * step, 0.121, 0.004},
+            view{-0.7445, 0.121, 0.002}, view{-0.7445, 0.121, 0.004}}) {
+        std::vector<int32_t> iterations = renderFrame(m, v.re, v.im,
+                v.width, w, h, pixels).iterations;
+        Mandelbrot fresh;
+        fresh.setMaxIter(2000);
+        EXPECT_TRUE(renderFrame(fresh, v.re, v.im, v.width, w, h,
+                    pixels).iterations == iterations)
+                << v.re << " " << v.im << " " << v.width;
+    }
+}
+
+// Frames built from cached tiles equal the frame that filled the cache,
+// also after a subdivide mode frame of the same view
+TEST(TileCache, MatchesFreshRender) {
+    const uint32_t w = 256;
+    const uint32_t h = 192;
+    m_dimension d = centered(-0.75, 0.1, 0.02, w, h);
+    int32_t level = nearestGridLevel(d.m_width / (w - 1));
+    m_dimension view = gridViewport(d, level, w, h);
+    d.m_offset_x += GRID_TILE * gridStep(level);
+    m_dimension panned = gridViewport(d, level, w, h);
+    std::vector<uint32_t> pixels;
+
+    Mandelbrot fresh;
+    fresh.setMaxIter(2000);
+    fresh.setTileCache(256);
+    iter_buffer expected = renderFrame(fresh, view, w, h, pixels);
+
+    Mandelbrot m;
+    m.setMaxIter(2000);
+    m.setTileCache(256);
+    m.setRenderMode(render_mode::subdivide);
+    renderFrame(m, view, w, h, pixels);
+    m.setRenderMode(render_mode::full);
+    renderFrame(m, view, w, h, pixels);
+    EXPECT_TRUE(m.frameResults().iterations == expected.iterations);
+    EXPECT_TRUE(m.frameResults().norms == expected.norms);
+
+    renderFrame(m, panned, w, h, pixels);
+    renderFrame(m, view, w, h, pixels);
+    EXPECT_TRUE(m.frameResults().iterations == expected.iterations);
+    EXPECT_TRUE(m.frameResults().norms == expected.norms);
+}
+
+// Keeps the image in memory
+class MemoryStream: public ImageStream
+{
+public:
+    std::vector<uint32_t> pixels;
+    // Called after each band
+    std::function<void()> written;
+
+    bool writeRows(const argb_image& band) override {
+        for(uint32_t y = 0; y < band.height; y++)
+            pixels.insert(pixels.end(), band.line(y),
+                    band.line(y) + band.width);
+        if(written)
+            written();
+        return true;
+    }
+    bool finish() override {
+        return true;
+    }
+};
+
+static std::unique_ptr<Coloring> testColoring() {
+    return std::unique_ptr<Coloring>(new SmoothColoring({0x000764,
+            0x206bcb, 0xedffff, 0xffaa00, 0x000200}, 50));
+}
+
+// Two render servers on localhost give the image renderStreamed does, also
+// when one of them goes away during the frame
+TEST(DistributedRender, MatchesStreamedRender) {
+    const uint32_t w = 640;
+    const uint32_t h = 480;
+    tile_settings s;
+    s.max_iter = 3000;
+    m_dimension d;
+    d.m_width = 0.05;
+    d.m_height = d.m_width * (h - 1) / (w - 1);
+    d.m_offset_x = -0.76 - d.m_width / 2;
+    d.m_offset_y = 0.16 + d.m_height / 2;
+
+    Mandelbrot m;
+    m.setColoring(testColoring());
+    m.setMaxIter(s.max_iter);
+    m.setPreviewBlock(1);
+    MemoryStream expected;
+    std::vector<uint32_t> pixels;
+    ASSERT_TRUE(renderStreamed(m, d, w, h, expected, pixels,
+            NODE_TILE_PIXELS));
+
+    for(bool drop : {false, true}) {
+        RenderServer servers[2];
+        std::vector<render_node> nodes;
+        std::vector<std::thread> threads;
+        for(RenderServer& r : servers) {
+            ASSERT_TRUE(r.listen(0));
+            nodes.push_back(render_node{"localhost", r.port()});
+        }
+        for(RenderServer& r : servers)
+            threads.emplace_back([&r]() { r.serve(1); });
+
+        std::unique_ptr<Coloring> coloring = testColoring();
+        MemoryStream out;
+        if(drop)
+            out.written = [&]() { servers[1].close(); };
+        EXPECT_TRUE(renderDistributed(nodes, s, d, w, h, *coloring, out));
+        EXPECT_TRUE(out.pixels == expected.pixels)
+                << (drop ? "with" : "without") << " a server dropped";
+
+        for(RenderServer& r : servers)
+            r.close();
+        for(std::thread& t : threads)
+            t.join();
+    }
+}
+
+// Decimal strings read back exactly, and sums and products of them
+TEST(Bigfloat, ParseAndArithmetic) {
+    bigfloat a;
+    bigfloat b;
+    ASSERT_TRUE(bigfloat::parse("-0.743643887037158704752191506114774",
+                160, a));
+    EXPECT_TRUE(a.isNegative());
+    bigfloat back;
+    ASSERT_TRUE(bigfloat::parse(a.toString(), a.precision(), back));
+    EXPECT_EQ(back.toString(), a.toString());
+    EXPECT_DOUBLE_EQ(a.toDouble(), -0.743643887037158704752191506114774);
+
+    ASSERT_TRUE(bigfloat::parse("1.5e-3", 64, b));
+    EXPECT_EQ(b.toDouble(), 1.5e-3);
+    ASSERT_TRUE(bigfloat::parse("2.75", 32, b));
+    EXPECT_EQ(b.toString(), "2.75");
+    EXPECT_FALSE(bigfloat::parse("4294967296", 32, b));
+    EXPECT_FALSE(bigfloat::parse("1.2.3", 32, b));
+
+    ASSERT_TRUE(bigfloat::parse("0.75", 32, a));
+    EXPECT_EQ((a + b).toString(), "3.5");
+    EXPECT_EQ((a - b).toString(), "-2");
+    EXPECT_EQ((a * b).toString(), "2.0625");
+    EXPECT_EQ((-a * b).toString(), "-2.0625");
+    EXPECT_TRUE((a - a).isZero());
+    EXPECT_FALSE((a - a).isNegative());
+
+    // Sums keep the finer precision, products truncate to it
+    b = bigfloat(std::ldexp(1.0, -100));
+    EXPECT_EQ((a + b - a).toString(), b.toString());
+    EXPECT_EQ((a * b).toDouble(), 0.75 * std::ldexp(1.0, -100));
+    EXPECT_TRUE((b * b).isZero());
+}
+
+// Doubles convert exactly, the ones beyond the integer limb saturate
+TEST(Bigfloat, FromDouble) {
+    for(double v : {0.0, 1.0, -0.5, 3.141592653589793, 1e-300, -5e-324,
+            4294967295.5, 1e9 + 0.25}) {
+        EXPECT_EQ(bigfloat(v).toDouble(), v) << v;
+    }
+    for(double v : {4294967296.0, 1e30, -1e300}) {
+        bigfloat b(v);
+        EXPECT_EQ(b.toString(), v < 0 ? "-4294967295" : "4294967295") << v;
+    }
+
+    bigfloat big(4294967295.0);
+    EXPECT_NEAR((big + big - big).toDouble(), 1, 1e-9);
+    EXPECT_NEAR((big * big - big).toDouble(), 1, 1e-9);
+    EXPECT_NEAR((-big - big + big).toDouble(), -1, 1e-9);
+}
+
+// The perturbation engine gives the direct kernel's counts at moderate
+// zooms. Views near the boundary are left out: their orbits amplify the
+// rounding errors of the direct kernel's doubles.
+TEST(Perturbation, MatchesDirectRender) {
+    struct view {
+        double re;
+        double im;
+        double width;
+        uint32_t max_iter;
+    };
+    const uint32_t w = 320;
+    const uint32_t h = 240;
+    std::vector<uint32_t> pixels;
+    for(view v : {view{-0.75, 0.1, 1e-4, 1000},
+            view{-0.1011, 0.9563, 1e-5, 2000},
+            view{-1.7685, 0.0, 1e-5, 2000}}) {
+        m_dimension d = centered(v.re, v.im, v.width, w, h);
+        Mandelbrot m;
+        m.setMaxIter(v.max_iter);
+        const iter_buffer& direct = renderFrame(m, d, w, h, pixels);
+
+        Perturbation p;
+        p.prepare(d, w, h, v.max_iter, 32);
+        iter_buffer buf;
+        buf.resize(w, h);
+        p.calcTile(m_tile{0, 0, w, h}, buf);
+        EXPECT_TRUE(buf.iterations == direct.iterations)
+                << v.re << " " << v.im << " " << v.width;
+    }
+}
+
+// A complete frame resumed at a higher limit equals a fresh render at that
+// limit, whether its pixels continue from kept orbits or start over. After
+// a pan, kept orbits only exist for the pixels iterated in the new frame.
+TEST(Resume, MatchesFreshRender) {
+    const uint32_t w = 320;
+    const uint32_t h = 240;
+    const double step = 0.01 / (w - 1);
+    std::vector<uint32_t> pixels;
+
+    Mandelbrot fresh;
+    fresh.setMaxIter(4000);
+    iter_buffer expected = renderFrame(fresh, -0.745, 0.113, 0.01, w, h,
+            pixels);
+
+    for(int variant = 0; variant < 3; variant++) {
+        Mandelbrot m;
+        m.setKeepOrbits(variant > 0);
+        m.setMaxIter(500);
+        if(variant == 2)
+            renderFrame(m, -0.745 - 40 * step, 0.113, 0.01, w, h, pixels);
+        renderFrame(m, -0.745, 0.113, 0.01, w, h, pixels);
+        m.setMaxIter(4000);
+        const iter_buffer& b = renderFrame(m, -0.745, 0.113, 0.01, w, h,
+                pixels);
+        EXPECT_TRUE(b.iterations == expected.iterations) << variant;
+        EXPECT_TRUE(b.norms == expected.norms) << variant;
+    }
+}
+
+// Every kernel table the host supports gives the scalar one's iteration
+// counts, norms and colors
+TEST(Kernels, TablesAgree) {
+    struct view {
+        double re;
+        double im;
+        double width;
+    };
+    const uint32_t w = 256;
+    const uint32_t h = 192;
+    for(view v : {view{-0.75, 0.0, 3.0}, view{-0.745, 0.113, 0.01},
+            view{-1.7685, 0.0, 1e-5}}) {
+        Mandelbrot scalar;
+        ASSERT_TRUE(scalar.setIsa(isa::scalar));
+        scalar.setColoring(testColoring());
+        scalar.setMaxIter(2000);
+        std::vector<uint32_t> expected;
+        iter_buffer reference = renderFrame(scalar, v.re, v.im, v.width, w,
+                h, expected);
+
+        for(isa level : {isa::sse2, isa::avx2, isa::avx512}) {
+            Mandelbrot m;
+            if(!m.setIsa(level))
+                continue;
+            m.setColoring(testColoring());
+            m.setMaxIter(2000);
+            std::vector<uint32_t> pixels;
+            const iter_buffer& b = renderFrame(m, v.re, v.im, v.width, w, h,
+                    pixels);
+            EXPECT_TRUE(b.iterations == reference.iterations)
+                    << m.kernelTable().name << " at " << v.width;
+            EXPECT_TRUE(b.norms == reference.norms)
+                    << m.kernelTable().name << " at " << v.width;
+            EXPECT_TRUE(pixels == expected)
+                    << m.kernelTable().name << " at " << v.width;
+        }
+    }
+}
+
+// Every index runs exactly once, also when the first worker's tasks are
+// slow and the others steal them
+TEST(ThreadPool, RunsEveryIndexOnce) {
+    const uint32_t n = 64;
+    ThreadPool pool(4);
+    ASSERT_EQ(pool.size(), 4u);
+    for(int round = 0; round < 3; round++) {
+        std::vector<std::atomic<uint32_t>> runs(n);
+        std::vector<uint32_t> worker(n);
+        pool.parallelFor(n, [&](uint32_t i, uint32_t w) {
+            if(i < n / 4)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            runs[i]++;
+            worker[i] = w;
+        });
+        std::set<uint32_t> workers;
+        for(uint32_t i = 0; i < n; i++) {
+            EXPECT_EQ(runs[i].load(), 1u) << i;
+            EXPECT_LT(worker[i], pool.size());
+            if(i < n / 4)
+                workers.insert(worker[i]);
+        }
+        EXPECT_GT(workers.size(), 1u) << "no task was stolen";
+    }
+
+    std::atomic<uint32_t> total(0);
+    std::vector<ThreadPool::task> tasks;
+    for(uint32_t i = 0; i < 3; i++)
+        tasks.push_back([&total](uint32_t) { total++; });
+    pool.submit(tasks);
+    pool.wait();
+    EXPECT_EQ(total.load(), 3u);
+}
+
+// Batch colorizing gives every table's palette lookup the same colors,
+// which are within one level per channel of getColor's
+TEST(SmoothColoring, BatchMatchesGetColor) {
+    const uint32_t w = 256;
+    const uint32_t h = 192;
+    Mandelbrot m;
+    m.setMaxIter(2000);
+    std::vector<uint32_t> pixels;
+    const iter_buffer& b = renderFrame(m, -0.745, 0.113, 0.01, w, h, pixels);
+    // Leaves a tail no vector kernel covers
+    const uint32_t n = w * h - 3;
+
+    std::unique_ptr<Coloring> c = testColoring();
+    std::vector<uint32_t> expected(n);
+    c->getColors(b.iterations.data(), b.norms.data(), expected.data(), n,
+            kernelTable_scalar());
+    for(uint32_t i = 0; i < n; i++) {
+        uint32_t single = c->getColor(b.iterations[i], b.norms[i]);
+        for(uint32_t shift : {0, 8, 16, 24}) {
+            int32_t d = static_cast<int32_t>((expected[i] >> shift) & 0xff)
+                    - static_cast<int32_t>((single >> shift) & 0xff);
+            ASSERT_LE(std::abs(d), 1) << "pixel " << i;
+        }
+    }
+
+    for(isa level : {isa::sse2, isa::avx2, isa::avx512}) {
+        const kernel_table* k = kernelsFor(level);
+        if(!k)
+            continue;
+        std::vector<uint32_t> argb(n);
+        c->getColors(b.iterations.data(), b.norms.data(), argb.data(), n,
+                *k);
+        EXPECT_TRUE(argb == expected) << k->name;
+    }
+}
+
+// Escape time of the pixel (x, y) under formula f by the definition,
+// without early-outs. Rounds as the kernels do.
+static int32_t escapeReference(formula f, double x, double y,
+        uint32_t max_iter, double bail_out, double julia_re,
+        double julia_im, double& norm) {
+    const formula_info& info = formulaInfo(f);
+    double cr = info.julia ? julia_re : x;
+    double ci = info.julia ? julia_im : y;
+    double zr = x;
+    double zi = y;
+    for(uint32_t i = 0; i < max_iter; i++) {
+        if(info.burning_ship) {
+            zr = std::abs(zr);
+            zi = std::abs(zi);
+        }
+        // z^power by repeated multiplication, z^2 first
+        double pr = zr * zr - zi * zi;
+        double pi = (zr + zr) * zi;
+        for(uint32_t k = 2; k < info.power; k++) {
+            double t = pr * zr - pi * zi;
+            pi = pr * zi + pi * zr;
+            pr = t;
+        }
+        zr = pr + cr;
+        zi = pi + ci;
+        norm = zr * zr + zi * zi;
+        if(!(norm < bail_out))
+            return i;
+    }
+    norm = 0;
+    return INT32_MIN;
+}
+
+// The main bulb test and cycle detection only stop pixels that would not
+// escape anyway, with every table the host supports
+TEST(Kernels, EarlyOutKeepsCounts) {
+    struct view {
+        double re;
+        double im;
+        double width;
+    };
+    const uint32_t w = 128;
+    const uint32_t h = 96;
+    Mandelbrot m;
+    escape_params p = {5000, static_cast<double>(m.BAIL_OUT), m.PERIOD_EPS,
+            0, 0, nullptr, nullptr, 0};
+    for(isa level : {isa::scalar, isa::sse2, isa::avx2, isa::avx512}) {
+        const kernel_table* k = kernelsFor(level);
+        if(!k)
+            continue;
+        escape_kernel kernel =
+                k->escape_time[static_cast<uint32_t>(formula::mandelbrot)];
+        for(view v : {view{-0.75, 0.0, 3.0}, view{-1.25, 0.0, 0.6},
+                view{-0.745, 0.113, 0.01}, view{-0.1528, 1.0397, 0.002}}) {
+            m_dimension d = centered(v.re, v.im, v.width, w, h);
+            uint32_t mismatches = 0;
+            for(uint32_t y = 0; y < h; y++) {
+                for(uint32_t x = 0; x < w; x += k->lanes) {
+                    double real[MAX_LANES];
+                    double imag[MAX_LANES];
+                    int32_t it[MAX_LANES];
+                    double norm[MAX_LANES];
+                    for(uint32_t l = 0; l < k->lanes; l++) {
+                        real[l] = d.m_offset_x + d.m_width * (x + l) / (w - 1);
+                        imag[l] = d.m_offset_y - d.m_height * y / (h - 1);
+                    }
+                    kernel(real, imag, p, it, norm);
+                    for(uint32_t l = 0; l < k->lanes; l++) {
+                        double expected_norm;
+                        int32_t expected = escapeReference(
+                                formula::mandelbrot, real[l], imag[l],
+                                p.max_iter, p.bail_out, 0, 0, expected_norm);
+                        if(it[l] != expected || norm[l] != expected_norm)
+                            mismatches++;
+                    }
+                }
+            }
+            EXPECT_EQ(mismatches, 0u) << k->name << " at " << v.re << " "
+                    << v.im << " " << v.width;
+        }
+    }
+}
+
+// The double-double kernel on coordinates that are plain doubles gives the
+// fp64 kernel's counts and, to rounding, its norms. The views are the
+// perturbation test's, away from the boundary's chaotic orbits.
+TEST(Kernels, DoubleDoubleMatchesFp64) {
+    struct view {
+        double re;
+        double im;
+        double width;
+        uint32_t max_iter;
+    };
+    const uint32_t w = 128;
+    const uint32_t h = 96;
+    Mandelbrot m;
+    for(isa level : {isa::avx2, isa::avx512}) {
+        const kernel_table* k = kernelsFor(level);
+        if(!k || !k->escape_time_dd)
+            continue;
+        escape_kernel kernel =
+                k->escape_time[static_cast<uint32_t>(formula::mandelbrot)];
+        for(view v : {view{-0.75, 0.1, 1e-4, 1000},
+                view{-0.1011, 0.9563, 1e-5, 2000},
+                view{-1.7685, 0.0, 1e-5, 2000}}) {
+            escape_params p = {v.max_iter, static_cast<double>(m.BAIL_OUT),
+                    m.PERIOD_EPS, 0, 0, nullptr, nullptr, 0};
+            m_dimension d = centered(v.re, v.im, v.width, w, h);
+            const double zero[MAX_LANES] = {};
+            uint32_t mismatches = 0;
+            for(uint32_t y = 0; y < h; y++) {
+                for(uint32_t x = 0; x < w; x += k->lanes) {
+                    double real[MAX_LANES];
+                    double imag[MAX_LANES];
+                    int32_t it[MAX_LANES];
+                    double norm[MAX_LANES];
+                    int32_t it_dd[MAX_LANES];
+                    double norm_dd[MAX_LANES];
+                    for(uint32_t l = 0; l < k->lanes; l++) {
+                        real[l] = d.m_offset_x + d.m_width * (x + l) / (w - 1);
+                        imag[l] = d.m_offset_y - d.m_height * y / (h - 1);
+                    }
+                    kernel(real, imag, p, it, norm);
+                    k->escape_time_dd(real, zero, imag, zero, p.max_iter,
+                            p.bail_out, it_dd, norm_dd);
+                    for(uint32_t l = 0; l < k->lanes; l++) {
+                        if(it[l] != it_dd[l] || std::abs(norm[l] - norm_dd[l])
+                                > 1e-9 * norm[l])
+                            mismatches++;
+                    }
+                }
+            }
+            EXPECT_EQ(mismatches, 0u) << k->name << " at " << v.re << " "
+                    << v.im << " " << v.width;
+        }
+    }
+}
+
+// Scrolling moves every pixel's values by the offset and leaves the ones
+// shifted in unknown
+TEST(IterBuffer, ScrollMovesPixels) {
+    const uint32_t w = 13;
+    const uint32_t h = 7;
+    for(int32_t dx : {0, 3, -5, 13, -20}) {
+        for(int32_t dy : {0, 2, -4, 7}) {
+            iter_buffer b;
+            b.resize(w, h);
+            for(uint32_t i = 0; i < w * h; i++) {
+                b.iterations[i] = i;
+                b.norms[i] = i + 0.5f;
+                b.grain[i] = 1 + i % 8;
+            }
+            b.scroll(dx, dy);
+            for(uint32_t y = 0; y < h; y++) {
+                for(uint32_t x = 0; x < w; x++) {
+                    size_t i = static_cast<size_t>(y) * w + x;
+                    int32_t sx = x + dx;
+                    int32_t sy = y + dy;
+                    if(sx < 0 || sx >= static_cast<int32_t>(w) || sy < 0
+                            || sy >= static_cast<int32_t>(h)) {
+                        EXPECT_EQ(b.grain[i], iter_buffer::GRAIN_UNKNOWN)
+                                << dx << " " << dy << " " << x << " " << y;
+                        continue;
+                    }
+                    uint32_t src = sy * w + sx;
+                    EXPECT_EQ(b.iterations[i], static_cast<int32_t>(src))
+                            << dx << " " << dy << " " << x << " " << y;
+                    EXPECT_EQ(b.norms[i], src + 0.5f);
+                    EXPECT_EQ(b.grain[i], 1 + src % 8);
+                }
+            }
+        }
+    }
+}
+
+// Frames panned by whole pixels in any direction, as the canvas pans them,
+// scrolled and completed equal fresh renders
+TEST(IterBuffer, ScrollAndRenderMatchesFresh) {
+    const uint32_t w = 320;
+    const uint32_t h = 240;
+    m_dimension start = centered(-0.745, 0.113, 0.01, w, h);
+    const double step_x = start.m_width / (w - 1);
+    const double step_y = start.m_height / (h - 1);
+    std::vector<uint32_t> pixels;
+
+    Mandelbrot m;
+    m.setMaxIter(2000);
+    renderFrame(m, start, w, h, pixels);
+    for(int32_t dx : {5, -17, 0, 400}) {
+        for(int32_t dy : {0, -3, 11}) {
+            m_dimension d = start;
+            translateDimensions(d, dx * step_x, -dy * step_y);
+            iter_buffer panned = renderFrame(m, d, w, h, pixels);
+
+            Mandelbrot fresh;
+            fresh.setMaxIter(2000);
+            const iter_buffer& expected = renderFrame(fresh, d, w, h, pixels);
+            EXPECT_TRUE(panned.iterations == expected.iterations)
+                    << dx << " " << dy;
+            EXPECT_TRUE(panned.norms == expected.norms) << dx << " " << dy;
+        }
+    }
+}
+
+// Fed pass times proportional to iterations per pixel, the budget settles
+// on the finest setting that fits the frame time and stays there
+TEST(FrameBudget, Converges) {
+    const double fps = 30;
+    for(double cost : {1e-9, 1e-6, 1e-5, 1e-4, 1e-2}) {
+        FrameBudget b(fps);
+        b.setMaxIter(5000);
+        auto pass = [&]() {
+            return cost * b.iterationCap()
+                    / (b.previewBlock() * b.previewBlock());
+        };
+        for(int i = 0; i < 40; i++)
+            b.update(pass());
+
+        uint32_t block = b.previewBlock();
+        uint32_t cap = b.iterationCap();
+        for(int i = 0; i < 20; i++) {
+            b.update(pass());
+            EXPECT_EQ(b.previewBlock(), block) << cost;
+            EXPECT_EQ(b.iterationCap(), cap) << cost;
+        }
+
+        double t = pass();
+        if(block < b.MAX_BLOCK || cap > b.MIN_ITER) {
+            EXPECT_LE(t, 1 / fps) << cost;
+        }
+        // Nothing finer fits with the headroom
+        if(cap < 5000) {
+            EXPECT_GE(2 * t, b.HEADROOM / fps) << cost;
+        } else if(block > 1) {
+            EXPECT_GE(4 * t, b.HEADROOM / fps) << cost;
+        }
+    }
+}
+
+// Images rendered band by band equal single frames of them at every
+// precision, including a single last row rendered with the one above
+TEST(StreamedRender, MatchesSingleFrame) {
+    struct view {
+        double re;
+        double im;
+        double width;
+    };
+    const uint32_t w = 320;
+    const uint32_t h = 241;
+    for(view v : {view{-0.75, 0.0, 3.0}, view{-0.745, 0.113, 0.01},
+            view{-0.743643887037158, 0.131825904205311, 1e-11},
+            view{-0.743643887037158, 0.131825904205311, 1e-27}}) {
+        m_dimension d = centered(v.re, v.im, v.width, w, h);
+        Mandelbrot one;
+        one.setColoring(testColoring());
+        one.setMaxIter(3000);
+        std::vector<uint32_t> expected;
+        renderFrame(one, d, w, h, expected);
+
+        for(uint32_t rows : {50, 40}) {
+            Mandelbrot m;
+            m.setColoring(testColoring());
+            m.setMaxIter(3000);
+            MemoryStream out;
+            std::vector<uint32_t> band;
+            ASSERT_TRUE(renderStreamed(m, d, w, h, out, band, w * rows));
+            EXPECT_TRUE(out.pixels == expected)
+                    << v.width << " in bands of " << rows << " rows";
+        }
+    }
+}
+
+// Antialiased images rendered band by band equal single frames of them:
+// edges along the band seams are found as in the whole frame
+TEST(Antialiasing, StreamedMatchesSingleFrame) {
+    const uint32_t w = 320;
+    const uint32_t h = 241;
+    m_dimension d = centered(-0.745, 0.113, 0.01, w, h);
+    Mandelbrot one;
+    one.setColoring(testColoring());
+    one.setMaxIter(2000);
+    one.setAntialiasing(4, true);
+    std::vector<uint32_t> expected;
+    renderFrame(one, d, w, h, expected);
+
+    for(uint32_t rows : {50, 40}) {
+        Mandelbrot m;
+        m.setColoring(testColoring());
+        m.setMaxIter(2000);
+        m.setAntialiasing(4, true);
+        MemoryStream out;
+        std::vector<uint32_t> band;
+        ASSERT_TRUE(renderStreamed(m, d, w, h, out, band, w * rows));
+        EXPECT_TRUE(out.pixels == expected) << "bands of " << rows << " rows";
+    }
+}
+
+// Antialiasing only touches pixels next to an edge: frames inside the set
+// and pixels with only inside neighbours keep their colors
+TEST(Antialiasing, LeavesInteriorUntouched) {
+    struct view {
+        double re;
+        double im;
+        double width;
+    };
+    const uint32_t w = 256;
+    const uint32_t h = 192;
+    for(view v : {view{-0.2, 0.0, 0.2}, view{-0.75, 0.0, 3.0},
+            view{-0.745, 0.113, 0.01}}) {
+        Mandelbrot plain;
+        plain.setColoring(testColoring());
+        plain.setMaxIter(2000);
+        std::vector<uint32_t> expected;
+        iter_buffer b = renderFrame(plain, v.re, v.im, v.width, w, h,
+                expected);
+
+        Mandelbrot m;
+        m.setColoring(testColoring());
+        m.setMaxIter(2000);
+        m.setAntialiasing(4, true);
+        std::vector<uint32_t> pixels;
+        renderFrame(m, v.re, v.im, v.width, w, h, pixels);
+
+        auto inside = [&](int32_t x, int32_t y) {
+            return x < 0 || y < 0 || x >= static_cast<int32_t>(w)
+                    || y >= static_cast<int32_t>(h)
+                    || b.iterations[y * w + x] == INT32_MIN;
+        };
+        uint32_t interior = 0;
+        uint32_t changed = 0;
+        for(int32_t y = 0; y < static_cast<int32_t>(h); y++) {
+            for(int32_t x = 0; x < static_cast<int32_t>(w); x++) {
+                size_t i = static_cast<size_t>(y) * w + x;
+                changed += pixels[i] != expected[i];
+                if(!inside(x, y) || !inside(x - 1, y) || !inside(x + 1, y)
+                        || !inside(x, y - 1) || !inside(x, y + 1))
+                    continue;
+                interior++;
+                EXPECT_EQ(pixels[i], expected[i]) << x << " " << y;
+            }
+        }
+        EXPECT_GT(interior, 0u) << v.width;
+        if(v.width == 0.2) {
+            EXPECT_EQ(changed, 0u);
+        } else {
+            EXPECT_GT(changed, 0u) << v.width;
+        }
+    }
+}
+
+// Targets count as within the start frame up to its edges, to the last
+// bit, and sequences aimed anywhere else fail before rendering
+TEST(ZoomVideo, TargetInFrame) {
+    zoom_sequence z;
+    z.width = 64;
+    z.height = 48;
+    z.frames = 3;
+    z.start = centered(-0.75, 0.1, 0.05, z.width, z.height);
+    bigfloat left = exactOffsetX(z.start);
+    bigfloat top = exactOffsetY(z.start);
+    bigfloat right = left + bigfloat(z.start.m_width);
+    bigfloat bottom = top - bigfloat(z.start.m_height);
+    bigfloat tiny(std::ldexp(1.0, -80));
+
+    struct target {
+        bigfloat x;
+        bigfloat y;
+        bool inside;
+    };
+    for(const target& t : {target{bigfloat(-0.75), bigfloat(0.1), true},
+            target{left, top, true}, target{right, bottom, true},
+            target{left - tiny, bigfloat(0.1), false},
+            target{right + tiny, bigfloat(0.1), false},
+            target{bigfloat(-0.75), top + tiny, false},
+            target{bigfloat(-0.75), bottom - tiny, false}}) {
+        z.target_x = t.x;
+        z.target_y = t.y;
+        EXPECT_EQ(zoomTargetInFrame(z), t.inside)
+                << t.x.toString() << " " << t.y.toString();
+
+        Mandelbrot m;
+        uint32_t frames = 0;
+        EXPECT_EQ(renderZoomSequence(m, z, 1,
+                    [&](uint32_t, const argb_image&) {
+                        frames++;
+                        return true;
+                    }), t.inside);
+        EXPECT_EQ(frames, t.inside ? z.frames : 0);
+    }
+}
+
+// Resampling a key image whose red and green channels are its column and
+// row gives every output pixel the key position of its center, whether it
+// shrinks, enlarges or copies the key
+TEST(ZoomVideo, ResampleFrame) {
+    const uint32_t kw = 256;
+    const uint32_t kh = 200;
+    m_dimension key_dim = centered(-0.5, 0.25, 1.0, kw, kh);
+    const double step_x = key_dim.m_width / (kw - 1);
+    const double step_y = key_dim.m_height / (kh - 1);
+    std::vector<uint32_t> key_pixels(kw * kh);
+    argb_image key;
+    key.pixels = key_pixels.data();
+    key.width = kw;
+    key.height = kh;
+    key.stride = kw;
+    for(uint32_t y = 0; y < kh; y++) {
+        for(uint32_t x = 0; x < kw; x++)
+            key.line(y)[x] = 0xff000007 | x << 16 | y << 8;
+    }
+
+    struct window {
+        // Key position of output pixel (0, 0) and the output pixel
+        // spacing in key pixels
+        double u0;
+        double v0;
+        double ratio;
+        uint32_t width;
+        uint32_t height;
+    };
+    ThreadPool pool(2);
+    std::vector<std::vector<float>> rows;
+    for(window v : {window{0, 0, 1, kw, kh}, window{30.25, 40.5, 1.7, 100, 80},
+            window{10.5, 20.75, 0.6, 120, 90}}) {
+        m_dimension d = key_dim;
+        d.m_width = v.ratio * step_x * (v.width - 1);
+        d.m_height = v.ratio * step_y * (v.height - 1);
+        setExactOffset(d, exactOffsetX(key_dim) + bigfloat(v.u0 * step_x),
+                exactOffsetY(key_dim) - bigfloat(v.v0 * step_y));
+
+        std::vector<uint32_t> pixels(v.width * v.height);
+        argb_image out;
+        out.pixels = pixels.data();
+        out.width = v.width;
+        out.height = v.height;
+        out.stride = v.width;
+        resampleFrame(key, key_dim, d, out, pool, rows);
+
+        uint32_t off = 0;
+        for(uint32_t y = 0; y < v.height; y++) {
+            for(uint32_t x = 0; x < v.width; x++) {
+                uint32_t c = out.line(y)[x];
+                double u = v.u0 + x * v.ratio;
+                double w = v.v0 + y * v.ratio;
+                if(std::abs(((c >> 16) & 0xff) - u) > 0.51
+                        || std::abs(((c >> 8) & 0xff) - w) > 0.51
+                        || (c & 0xff0000ff) != 0xff000007)
+                    off++;
+            }
+        }
+        EXPECT_EQ(off, 0u) << "spacing " << v.ratio;
+        if(v.ratio == 1) {
+            EXPECT_TRUE(pixels == key_pixels);
+        }
+    }
+}
+
+static void skipSpace(const std::string& s, size_t& i) {
+    while(i < s.size() && std::isspace(static_cast<unsigned char>(s[i])))
+        i++;
+}
+
+static bool skipJsonString(const std::string& s, size_t& i) {
+    if(i >= s.size() || s[i] != '"')
+        return false;
+    for(i++; i < s.size() && s[i] != '"'; i++) {
+        if(static_cast<unsigned char>(s[i]) < 0x20)
+            return false;
+        if(s[i] == '\\' && ++i < s.size()
+                && std::string("\"\\/bfnrtu").find(s[i]) == std::string::npos)
+            return false;
+    }
+    return i++ < s.size();
+}
+
+// Moves i past the JSON value at s[i], false if it is malformed
+static bool skipJson(const std::string& s, size_t& i) {
+    skipSpace(s, i);
+    if(i >= s.size())
+        return false;
+    char c = s[i];
+    if(c == '{' || c == '[') {
+        char close = c == '{' ? '}' : ']';
+        i++;
+        skipSpace(s, i);
+        if(i < s.size() && s[i] == close) {
+            i++;
+            return true;
+        }
+        for(;;) {
+            if(c == '{') {
+                skipSpace(s, i);
+                if(!skipJsonString(s, i))
+                    return false;
+                skipSpace(s, i);
+                if(i >= s.size() || s[i++] != ':')
+                    return false;
+            }
+            if(!skipJson(s, i))
+                return false;
+            skipSpace(s, i);
+            if(i < s.size() && s[i] == ',') {
+                i++;
+                continue;
+            }
+            return i < s.size() && s[i++] == close;
+        }
+    }
+    if(c == '"')
+        return skipJsonString(s, i);
+    for(const char* word : {"true", "false", "null"}) {
+        if(s.compare(i, std::strlen(word), word) == 0) {
+            i += std::strlen(word);
+            return true;
+        }
+    }
+
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    auto digits = [&]() {
+        size_t from = i;
+        while(i < s.size() && std::isdigit(static_cast<unsigned char>(s[i])))
+            i++;
+        return i > from;
+    };
+    if(s[i] == '-')
+        i++;
+    if(i < s.size() && s[i] == '0')
+        i++;
+    else if(!digits())
+        return false;
+    if(i < s.size() && s[i] == '.' && (++i, !digits()))
+        return false;
+    if(i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if(i < s.size() && (s[i] == '+' || s[i] == '-'))
+            i++;
+        if(!digits())
+            return false;
+    }
+    return true;
+}
+
+static bool isJson(const std::string& s) {
+    size_t i = 0;
+    if(!skipJson(s, i))
+        return false;
+    skipSpace(s, i);
+    return i == s.size();
+}
+
+static size_t count(const std::string& s, const std::string& what) {
+    size_t n = 0;
+    for(size_t i = s.find(what); i != std::string::npos;
+            i = s.find(what, i + 1))
+        n++;
+    return n;
+}
+
+// Traces of no frames and of the frames of a streamed render are valid
+// JSON with an event per tile, phase and frame
+TEST(RenderStats, ChromeTraceIsJson) {
+    std::ostringstream empty;
+    ASSERT_TRUE(writeChromeTrace(std::vector<frame_stats>(), empty));
+    EXPECT_TRUE(isJson(empty.str())) << empty.str();
+
+    Mandelbrot m(4);
+    m.setMaxIter(1000);
+    m.setCollectStats(true);
+    MemoryStream out;
+    std::vector<uint32_t> pixels;
+    std::vector<frame_stats> frames;
+    ASSERT_TRUE(renderStreamed(m, centered(-0.745, 0.113, 0.01, 320, 240),
+            320, 240, out, pixels, 320 * 100, &frames));
+    ASSERT_EQ(frames.size(), 3u);
+
+    std::ostringstream trace;
+    ASSERT_TRUE(writeChromeTrace(frames, trace));
+    std::string json = trace.str();
+    EXPECT_TRUE(isJson(json));
+    size_t events = 0;
+    for(const frame_stats& f : frames)
+        events += f.tiles.size() + f.phases.size() + 1;
+    EXPECT_GT(events, 3u);
+    EXPECT_EQ(count(json, "\"ph\": \"X\""), events);
+
+    for(const char* bad : {"{\"a\": [1, 2,]}", "{\"a\" 1}", "[nan]",
+            "{\"a\": \"b}", "[1] 2"})
+        EXPECT_FALSE(isJson(bad)) << bad;
+}
+
+// Every table's kernels of every formula give the counts and norms of
+// the plain loop, Julia sets at the default constant
+TEST(Kernels, FormulasMatchReference) {
+    struct view {
+        formula f;
+        double re;
+        double im;
+        double width;
+    };
+    const uint32_t w = 128;
+    const uint32_t h = 96;
+    Mandelbrot m;
+    escape_params p = {2000, static_cast<double>(m.BAIL_OUT), m.PERIOD_EPS,
+            -0.8, 0.156, nullptr, nullptr, 0};
+    for(isa level : {isa::scalar, isa::sse2, isa::avx2, isa::avx512}) {
+        const kernel_table* k = kernelsFor(level);
+        if(!k)
+            continue;
+        for(view v : {view{formula::multibrot3, 0.0, 0.0, 3.0},
+                view{formula::multibrot4, 0.0, 0.0, 3.0},
+                view{formula::burning_ship, -0.5, -0.5, 3.2},
+                view{formula::burning_ship, -1.76, -0.03, 0.1},
+                view{formula::julia, 0.0, 0.0, 3.0},
+                view{formula::julia, 0.3, 0.1, 0.05},
+                view{formula::julia3, 0.0, 0.0, 3.0}}) {
+            escape_kernel kernel = k->escape_time[static_cast<uint32_t>(v.f)];
+            m_dimension d = centered(v.re, v.im, v.width, w, h);
+            uint32_t mismatches = 0;
+            for(uint32_t y = 0; y < h; y++) {
+                for(uint32_t x = 0; x < w; x += k->lanes) {
+                    double real[MAX_LANES];
+                    double imag[MAX_LANES];
+                    int32_t it[MAX_LANES];
+                    double norm[MAX_LANES];
+                    for(uint32_t l = 0; l < k->lanes; l++) {
+                        real[l] = d.m_offset_x + d.m_width * (x + l) / (w - 1);
+                        imag[l] = d.m_offset_y - d.m_height * y / (h - 1);
+                    }
+                    kernel(real, imag, p, it, norm);
+                    for(uint32_t l = 0; l < k->lanes; l++) {
+                        double expected_norm;
+                        int32_t expected = escapeReference(v.f, real[l],
+                                imag[l], p.max_iter, p.bail_out, p.julia_re,
+                                p.julia_im, expected_norm);
+                        if(it[l] != expected || norm[l] != expected_norm)
+                            mismatches++;
+                    }
+                }
+            }
+            EXPECT_EQ(mismatches, 0u) << k->name << " " << formulaInfo(v.f).name
+                    << " at " << v.re << " " << v.im << " " << v.width;
+        }
+    }
+}
+
+// Rows start on cache lines, and scrolling moves every pixel by the
+// offset and fills the ones shifted in
+TEST(FrameBuffer, ScrollMovesPixels) {
+    const uint32_t w = 13;
+    const uint32_t h = 7;
+    const uint32_t fill = 0xff123456;
+    for(int32_t dx : {0, 3, -5, 13, -20}) {
+        for(int32_t dy : {0, 2, -4, 7}) {
+            FrameBuffer f(w, h);
+            const argb_image& image = f.image();
+            ASSERT_EQ(reinterpret_cast<uintptr_t>(image.pixels) % FRAME_ALIGN,
+                    0u);
+            ASSERT_EQ(image.stride * sizeof(uint32_t) % FRAME_ALIGN, 0u);
+            for(uint32_t y = 0; y < h; y++) {
+                for(uint32_t x = 0; x < w; x++)
+                    image.line(y)[x] = y << 8 | x;
+            }
+
+            f.scroll(dx, dy, fill);
+            for(uint32_t y = 0; y < h; y++) {
+                for(uint32_t x = 0; x < w; x++) {
+                    int32_t sx = x + dx;
+                    int32_t sy = y + dy;
+                    bool outside = sx < 0 || sx >= static_cast<int32_t>(w)
+                            || sy < 0 || sy >= static_cast<int32_t>(h);
+                    uint32_t expected = outside ? fill
+                            : static_cast<uint32_t>(sy << 8 | sx);
+                    EXPECT_EQ(image.line(y)[x], expected)
+                            << dx << " " << dy << " " << x << " " << y;
+                }
+            }
+        }
+    }
+}
+
+// Buffers given back are taken again for their size, the most recently
+// given first, and only the FRAME_POOL_SIZE most recent are kept
+TEST(FramePool, TakeReusesBuffers) {
+    FramePool pool;
+    std::unique_ptr<FrameBuffer> a = pool.take(64, 48);
+    std::unique_ptr<FrameBuffer> b = pool.take(64, 48);
+    ASSERT_NE(a.get(), b.get());
+    FrameBuffer* first = a.get();
+    FrameBuffer* second = b.get();
+    pool.give(std::move(a));
+    pool.give(std::move(b));
+
+    std::unique_ptr<FrameBuffer> other = pool.take(32, 48);
+    EXPECT_NE(other.get(), first);
+    EXPECT_NE(other.get(), second);
+    a = pool.take(64, 48);
+    b = pool.take(64, 48);
+    EXPECT_EQ(a.get(), second);
+    EXPECT_EQ(b.get(), first);
+    std::unique_ptr<FrameBuffer> fresh = pool.take(64, 48);
+    EXPECT_NE(fresh.get(), first);
+    EXPECT_NE(fresh.get(), second);
+
+    // Beyond FRAME_POOL_SIZE the least recently given buffer is dropped:
+    // one taken for its size is new, its pixels zero rather than the ones
+    // it was given back with
+    FramePool full;
+    for(uint32_t i = 0; i <= FRAME_POOL_SIZE; i++) {
+        std::unique_ptr<FrameBuffer> f = full.take(16, 16 + i);
+        f->fill(0xffabcdef);
+        full.give(std::move(f));
+    }
+    for(uint32_t i = 0; i <= FRAME_POOL_SIZE; i++) {
+        std::unique_ptr<FrameBuffer> f = full.take(16, 16 + i);
+        EXPECT_EQ(f->image().line(0)[0] == 0xffabcdef, i > 0) << i;
+    }
+}
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
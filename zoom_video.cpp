@@ -0,0 +1,173 @@
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "zoom_video.h"
+
+m_dimension zoomFrame(const zoom_sequence& z, uint32_t k) {
+    double scale = std::pow(z.frame_zoom, -static_cast<double>(k));
+
+    m_dimension d = z.start;
+    d.m_width = z.start.m_width * scale;
+    d.m_height = z.start.m_height * scale;
+    bigfloat s(scale);
+    setExactOffset(d, z.target_x + (exactOffsetX(z.start) - z.target_x) * s,
+            z.target_y + (exactOffsetY(z.start) - z.target_y) * s);
+    return d;
+}
+
+bool zoomTargetInFrame(const zoom_sequence& z) {
+    bigfloat x = z.target_x - exactOffsetX(z.start);
+    bigfloat y = exactOffsetY(z.start) - z.target_y;
+    return !x.isNegative() && !(bigfloat(z.start.m_width) - x).isNegative()
+            && !y.isNegative()
+            && !(bigfloat(z.start.m_height) - y).isNegative();
+}
+
+// Filter weights along one axis. Output pixel i averages n bilinear
+// samples spread over its footprint, which covers the key pixels
+// first[i] .. first[i] + window - 1 with the weights
+// weights[i * window ...].
+struct axis_filter {
+    uint32_t window;
+    std::vector<uint32_t> first;
+    std::vector<float> weights;
+};
+
+static axis_filter axisFilter(uint32_t out_n, uint32_t key_n, double origin,
+        double ratio, uint32_t n) {
+    axis_filter f;
+    f.window = std::min(n + 2, key_n);
+    f.first.resize(out_n);
+    f.weights.assign(static_cast<size_t>(out_n) * f.window, 0);
+
+    for(uint32_t i=0; i<out_n; i++) {
+        double lo = origin + (i + 0.5 / n - 0.5) * ratio;
+        uint32_t first = std::min<double>(std::max(std::floor(lo), 0.0),
+                key_n - f.window);
+        f.first[i] = first;
+
+        float* w = f.weights.data() + static_cast<size_t>(i) * f.window;
+        for(uint32_t k=0; k<n; k++) {
+            double u = origin + (i + (k + 0.5) / n - 0.5) * ratio;
+            u = std::min(std::max(u, 0.0), key_n - 1.0);
+            uint32_t x0 = std::min<uint32_t>(u, key_n - 2);
+            double fx = u - x0;
+            w[x0 - first] += (1 - fx) / n;
+            w[x0 + 1 - first] += fx / n;
+        }
+    }
+    return f;
+}
+
+// Separably: the vertical filter blends key rows into one row, the
+// horizontal filter then reduces it to the output pixels.
+void resampleFrame(const argb_image& key, const m_dimension& key_dim,
+        const m_dimension& d, argb_image& out, ThreadPool& pool,
+        std::vector<std::vector<float>>& rows) {
+    double key_step_x = key_dim.m_width / (key.width - 1);
+    double key_step_y = key_dim.m_height / (key.height - 1);
+    double ratio_x = d.m_width / (out.width - 1) / key_step_x;
+    double ratio_y = d.m_height / (out.height - 1) / key_step_y;
+    double u0 = (exactOffsetX(d) - exactOffsetX(key_dim)).toDouble()
+            / key_step_x;
+    double v0 = (exactOffsetY(key_dim) - exactOffsetY(d)).toDouble()
+            / key_step_y;
+    uint32_t n = std::max(1.0, std::ceil(std::max(ratio_x, ratio_y) - 1e-9));
+
+    axis_filter fx = axisFilter(out.width, key.width, u0, ratio_x, n);
+    axis_filter fy = axisFilter(out.height, key.height, v0, ratio_y, n);
+    rows.resize(pool.size());
+
+    pool.parallelFor(out.height, [&](uint32_t y, uint32_t worker) {
+        std::vector<float>& row = rows.at(worker);
+        row.assign(static_cast<size_t>(key.width) * 3, 0);
+        const float* wy = fy.weights.data()
+                + static_cast<size_t>(y) * fy.window;
+        for(uint32_t j=0; j<fy.window; j++) {
+            if(wy[j] == 0)
+                continue;
+            const uint32_t* src = key.line(fy.first[y] + j);
+            for(uint32_t x=0; x<key.width; x++) {
+                row[3 * x] += wy[j] * ((src[x] >> 16) & 0xff);
+                row[3 * x + 1] += wy[j] * ((src[x] >> 8) & 0xff);
+                row[3 * x + 2] += wy[j] * (src[x] & 0xff);
+            }
+        }
+
+        uint32_t* line = out.line(y);
+        for(uint32_t x=0; x<out.width; x++) {
+            const float* wx = fx.weights.data()
+                    + static_cast<size_t>(x) * fx.window;
+            const float* src = row.data() + 3 * fx.first[x];
+            float acc[3] = {0, 0, 0};
+            for(uint32_t i=0; i<fx.window; i++) {
+                acc[0] += wx[i] * src[3 * i];
+                acc[1] += wx[i] * src[3 * i + 1];
+                acc[2] += wx[i] * src[3 * i + 2];
+            }
+            line[x] = 0xff000000
+                    | static_cast<uint32_t>(acc[0] + 0.5f) << 16
+                    | static_cast<uint32_t>(acc[1] + 0.5f) << 8
+                    | static_cast<uint32_t>(acc[2] + 0.5f);
+        }
+    });
+}
+
+bool renderZoomSequence(Mandelbrot& m, const zoom_sequence& z,
+        uint32_t threads,
+        const std::function<bool(uint32_t, const argb_image&)>& frame) {
+    if(!zoomTargetInFrame(z))
+        return false;
+
+    // A keyframe serves the frames until the zoom since the keyframe
+    // exceeds key_scale, it is rendered at the resolution of the last one.
+    uint32_t per_key = 1;
+    if(z.frame_zoom > 1)
+        per_key += std::floor(std::log(z.key_scale) / std::log(z.frame_zoom));
+    per_key = std::max(per_key, 1u);
+    double scale = std::pow(z.frame_zoom, per_key - 1.0);
+
+    uint32_t key_width = std::ceil((z.width - 1) * scale) + 1;
+    uint32_t key_height = std::ceil((z.height - 1) * scale) + 1;
+    std::vector<uint32_t> key_pixels(static_cast<size_t>(key_width)
+            * key_height);
+    argb_image key;
+    key.pixels = key_pixels.data();
+    key.width = key_width;
+    key.height = key_height;
+    key.stride = key_width;
+
+    std::vector<uint32_t> pixels(static_cast<size_t>(z.width) * z.height);
+    argb_image out;
+    out.pixels = pixels.data();
+    out.width = z.width;
+    out.height = z.height;
+    out.stride = z.width;
+
+    ThreadPool pool(threads);
+    std::vector<std::vector<float>> rows;
+    for(uint32_t k0 = 0; k0 < z.frames; k0 += per_key) {
+        // Same origin and pixel grid as frame k0, only finer
+        m_dimension key_dim = zoomFrame(z, k0);
+        double step_x = key_dim.m_width / (z.width - 1) / scale;
+        double step_y = key_dim.m_height / (z.height - 1) / scale;
+        key_dim.m_width = step_x * (key_width - 1);
+        key_dim.m_height = step_y * (key_height - 1);
+
+        m.updateComplexDimensions(key_dim);
+        while(!m.refreshMandelbrotTiled(key)) {}
+
+        for(uint32_t k = k0; k < std::min(z.frames, k0 + per_key); k++) {
+            if(per_key == 1) {
+                if(!frame(k, key))
+                    return false;
+                continue;
+            }
+
+            resampleFrame(key, key_dim, zoomFrame(z, k), out, pool, rows);
+            if(!frame(k, out))
+                return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef ZOOM_VIDEO_H
+#define ZOOM_VIDEO_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "argb_image.h"
+#include "dimension.h"
+#include "mandelbrot.h"
+#include "thread_pool.h"
+
+struct zoom_sequence {
+    // First frame of the video
+    m_dimension start;
+    // Point the video zooms into, it stays at the same place in the frame
+    // and has to lie within it
+    bigfloat target_x;
+    bigfloat target_y;
+    uint32_t frames = 0;
+    // Magnification from one frame to the next
+    double frame_zoom = 1.05;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // Upper bound for the resolution of keyframes relative to the frames
+    double key_scale = 2;
+};
+
+// Whether the target of z lies within its start frame, edges included
+bool zoomTargetInFrame(const zoom_sequence& z);
+
+// Renders a zoom video frame by frame. Only keyframes are iterated, each at
+// up to key_scale times the resolution of the frames. The frames up to the
+// next keyframe all lie within it and are resampled from it on the given
+// number of threads. Calls frame(index, image) for every frame in order and
+// stops early if it returns false. Fails at once if the target lies outside
+// the start frame, the frames would not lie within their keyframes.
+bool renderZoomSequence(Mandelbrot& m, const zoom_sequence& z,
+        uint32_t threads,
+        const std::function<bool(uint32_t, const argb_image&)>& frame);
+
+// Viewport of frame k of the sequence
+m_dimension zoomFrame(const zoom_sequence& z, uint32_t k);
+
+// Resamples the part of key, an image of viewport key_dim, covering
+// viewport d into out. Each output pixel averages bilinear samples spread
+// over its footprint in key. rows is scratch space of the pool's workers.
+void resampleFrame(const argb_image& key, const m_dimension& key_dim,
+        const m_dimension& d, argb_image& out, ThreadPool& pool,
+        std::vector<std::vector<float>>& rows);
+
+#endif // ZOOM_VIDEO_H